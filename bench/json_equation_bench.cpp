@@ -0,0 +1,485 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * json_equation_bench measures loading equations from JSON (in total and per
+ * loader phase), looking up pieces and evaluating polynomials over synthetic
+ * equations of varying piece count, degree, kind of powers and input
+ * distribution. Results are printed as CSV
+ * or JSON, one row per measurement.
+ *
+ * Usage: json_equation_bench [--format csv|json] [--max-pieces N] [--inputs N]
+ *                            [--repeats N]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../src/bytecode_equation.hpp"
+#include "../src/equation_generator.hpp"
+#include "../src/equation_registry.hpp"
+#include "../src/evaluation_planner.hpp"
+#include "../src/fixed_point_equation.hpp"
+#include "../src/json_equation.hpp"
+#include "../src/kernel_equation.hpp"
+#include "../src/shifted_equation.hpp"
+
+using namespace json_equation;
+
+namespace {
+
+enum class Distribution
+{
+  uniform,
+  sorted,
+  clustered,
+  skewed,
+  out_of_domain
+};
+
+const char* name_of (const PowerTypes powers)
+{
+  switch (powers)
+  {
+    case PowerTypes::integer: return "integer";
+    case PowerTypes::fractional: return "fractional";
+    case PowerTypes::real: return "real";
+    case PowerTypes::negative: return "negative";
+    default: return "mixed";
+  }
+}
+
+const char* name_of (const Distribution distribution)
+{
+  switch (distribution)
+  {
+    case Distribution::uniform: return "uniform";
+    case Distribution::sorted: return "sorted";
+    case Distribution::clustered: return "clustered";
+    case Distribution::skewed: return "skewed";
+    default: return "out_of_domain";
+  }
+}
+
+struct Options
+{
+  std::string format = "csv";
+  size_t max_pieces = 1000000;
+  size_t inputs = 1 << 16;
+  size_t repeats = 5;
+};
+
+/**
+ * One measurement. Times are per operation: per piece for loads, per input
+ * otherwise. Memory rows report bytes per piece instead of times.
+ */
+struct Result
+{
+  std::string benchmark;
+  size_t pieces = 0;
+  int degree = 0;
+  PowerTypes powers = PowerTypes::integer;
+  std::string distribution;
+  size_t operations = 0;
+  double min_ns = 0;
+  double median_ns = 0;
+  double bytes_per_piece = 0;
+};
+
+/*
+ * Results are folded into this so that the timed work cannot be optimized
+ * away.
+ */
+volatile double sink = 0;
+
+/**
+ * Generate an equation of consecutive pieces [1 + i, 2 + i), each with a
+ * constant term and degree further terms of the given kind of powers.
+ */
+nlohmann::json make_equation (const size_t pieces, const int degree, const PowerTypes powers,
+                              std::mt19937_64& rng)
+{
+  GeneratorOptions options;
+  options.seed = rng();
+  options.pieces = pieces;
+  options.domain_start = 1.0;
+  options.domain_end = 1.0 + static_cast<double>(pieces);
+  options.min_degree = options.max_degree = degree;
+  options.powers = powers;
+  return generate_equation(options);
+}
+
+/**
+ * Inputs over the domain [1, 1 + pieces) of an equation from make_equation.
+ */
+std::vector<double> make_inputs (const size_t count, const size_t pieces,
+                                 const Distribution distribution, std::mt19937_64& rng)
+{
+  const double lo = 1.0;
+  const double hi = 1.0 + static_cast<double>(pieces);
+  std::uniform_real_distribution<double> uniform(lo, hi);
+  std::vector<double> inputs(count);
+
+  switch (distribution)
+  {
+    case Distribution::uniform:
+    case Distribution::sorted:
+      for (auto& x : inputs)
+        x = uniform(rng);
+      if (distribution == Distribution::sorted)
+        std::sort(inputs.begin(), inputs.end());
+      break;
+    case Distribution::clustered:
+    {
+      /*
+       * Four hot spots, each a few pieces wide
+       */
+      double centers[4];
+      for (auto& center : centers)
+        center = uniform(rng);
+      std::normal_distribution<double> spread(0.0, 2.0);
+      std::uniform_int_distribution<int> pick(0, 3);
+      for (auto& x : inputs)
+        x = std::clamp(centers[pick(rng)] + spread(rng), lo, std::nextafter(hi, lo));
+      break;
+    }
+    case Distribution::skewed:
+    {
+      /*
+       * Zipf-distributed pieces (exponent 1.2) in shuffled order, so that the
+       * hot pieces are scattered over the domain
+       */
+      std::vector<double> cumulative(pieces);
+      double total = 0;
+      for (size_t rank = 0; rank < pieces; ++rank)
+        cumulative[rank] = total += std::pow(static_cast<double>(rank + 1), -1.2);
+      std::vector<size_t> piece_of(pieces);
+      std::iota(piece_of.begin(), piece_of.end(), 0);
+      std::shuffle(piece_of.begin(), piece_of.end(), rng);
+      std::uniform_real_distribution<double> unit(0.0, 1.0);
+      for (auto& x : inputs)
+      {
+        const size_t rank = std::min<size_t>(
+            std::lower_bound(cumulative.begin(), cumulative.end(), unit(rng) * total) - cumulative.begin(),
+            pieces - 1);
+        x = lo + static_cast<double>(piece_of[rank]) + unit(rng);
+      }
+      break;
+    }
+    default:
+    {
+      std::uniform_real_distribution<double> below(lo - hi, lo - 1.0);
+      std::uniform_real_distribution<double> above(hi + 1.0, 2 * hi);
+      std::bernoulli_distribution side(0.5);
+      for (auto& x : inputs)
+        x = side(rng) ? below(rng) : above(rng);
+      break;
+    }
+  }
+  return inputs;
+}
+
+/**
+ * Run body() repeats times and record the minimum and median time per
+ * operation.
+ */
+template<typename Body>
+void time_it (Result& result, const size_t operations, const size_t repeats, Body body)
+{
+  std::vector<double> samples;
+  for (size_t r = 0; r < repeats; ++r)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    body();
+    const auto stop = std::chrono::steady_clock::now();
+    samples.push_back(std::chrono::duration<double, std::nano>(stop - start).count()
+                      / static_cast<double>(operations));
+  }
+  std::sort(samples.begin(), samples.end());
+  result.operations = operations;
+  result.min_ns = samples.front();
+  result.median_ns = samples[samples.size() / 2];
+}
+
+/**
+ * Time loading, then break one more load down by phase into load_<phase> rows
+ */
+std::vector<Result> bench_load (const std::string& text, const size_t pieces, const int degree,
+                                const PowerTypes powers, const size_t repeats)
+{
+  Result result{"load", pieces, degree, powers, "-"};
+  time_it(result, pieces, repeats, [&] ()
+  {
+    std::istringstream is(text);
+    JSONEquation equation(is);
+    sink = sink + static_cast<double>(equation.pieces.size());
+  });
+  std::vector<Result> results{result};
+
+  LoadReport report;
+  std::istringstream is(text);
+  const JSONEquation equation(is, report);
+  for (size_t i = 0; i < load_phase_count; ++i)
+  {
+    const auto phase = static_cast<LoadPhase>(i);
+    Result row{std::string("load_") + load_phase_name(phase), pieces, degree, powers, "-", pieces};
+    row.min_ns = row.median_ns = static_cast<double>(report[phase].time.count()) / static_cast<double>(pieces);
+    results.push_back(row);
+  }
+  return results;
+}
+
+/**
+ * Bytes per piece of every storage layout of an equation, as memory_<layout>
+ * rows
+ */
+std::vector<Result> bench_memory (const JSONEquation& equation, const size_t pieces, const int degree,
+                                  const PowerTypes powers)
+{
+  std::vector<Result> results;
+  const auto add = [&] (const char* layout, const MemoryUsage& usage)
+  {
+    Result row{std::string("memory_") + layout, pieces, degree, powers, "-", pieces};
+    row.bytes_per_piece = static_cast<double>(usage.total()) / static_cast<double>(pieces);
+    results.push_back(row);
+  };
+
+  add("json_equation", equation.memory_usage());
+  EquationRegistry registry;
+  registry.add(equation);
+  add("registry", registry.memory_usage());
+  add("kernel", KernelEquation(equation).memory_usage());
+  add("bytecode", BytecodeEquation(equation).memory_usage());
+  add("shifted", ShiftedEquation(equation).memory_usage());
+  try
+  {
+    add("fixed_point", FixedPointEquation(equation).memory_usage());
+  }
+  catch (const std::exception&)
+  {
+    /*
+     * Only equations of polynomial pieces have a fixed-point layout
+     */
+  }
+  return results;
+}
+
+std::vector<Result> bench_evaluation (const JSONEquation& equation, const size_t pieces,
+                                      const int degree, const PowerTypes powers,
+                                      const Distribution distribution, const Options& options,
+                                      std::mt19937_64& rng)
+{
+  const std::vector<double> inputs = make_inputs(options.inputs, pieces, distribution, rng);
+  std::vector<Result> results;
+
+  Result find{"find", pieces, degree, powers, name_of(distribution)};
+  time_it(find, inputs.size(), options.repeats, [&] ()
+  {
+    size_t found = 0;
+    for (const double x : inputs)
+      found += equation.pieces.find(numeric_range::NumericRange<double>{x}) != equation.pieces.end();
+    sink = sink + static_cast<double>(found);
+  });
+  results.push_back(find);
+
+  /*
+   * PolynomialEquation::calculate alone, on pieces located beforehand
+   */
+  std::vector<const PolynomialEquation*> located;
+  std::vector<double> located_inputs;
+  for (const double x : inputs)
+  {
+    const auto piece = equation.pieces.find(numeric_range::NumericRange<double>{x});
+    if (piece != equation.pieces.end())
+    {
+      located.push_back(&piece->second);
+      located_inputs.push_back(x);
+    }
+  }
+  if (!located.empty())
+  {
+    Result calculate{"polynomial_calculate", pieces, degree, powers, name_of(distribution)};
+    time_it(calculate, located.size(), options.repeats, [&] ()
+    {
+      double sum = 0;
+      for (size_t i = 0; i < located.size(); ++i)
+        sum += located[i]->calculate(located_inputs[i]);
+      sink = sink + sum;
+    });
+    results.push_back(calculate);
+  }
+
+  Result end_to_end{"equation_calculate", pieces, degree, powers, name_of(distribution)};
+  time_it(end_to_end, inputs.size(), options.repeats, [&] ()
+  {
+    double sum = 0;
+    for (const double x : inputs)
+      sum += equation.calculate(x).value_or(0.0);
+    sink = sink + sum;
+  });
+  results.push_back(end_to_end);
+  return results;
+}
+
+void print (const std::vector<Result>& results, const std::string& format)
+{
+  if (format == "json")
+  {
+    nlohmann::json rows = nlohmann::json::array();
+    for (const auto& result : results)
+    {
+      rows.push_back({{"benchmark", result.benchmark}, {"pieces", result.pieces},
+                      {"degree", result.degree}, {"powers", name_of(result.powers)},
+                      {"distribution", result.distribution}, {"operations", result.operations},
+                      {"min_ns", result.min_ns}, {"median_ns", result.median_ns},
+                      {"bytes_per_piece", result.bytes_per_piece}});
+    }
+    std::cout << rows.dump(2) << std::endl;
+    return;
+  }
+
+  std::cout << "benchmark,pieces,degree,powers,distribution,operations,min_ns,median_ns,bytes_per_piece\n";
+  for (const auto& result : results)
+  {
+    std::cout << result.benchmark << "," << result.pieces << "," << result.degree << ","
+              << name_of(result.powers) << "," << result.distribution << ","
+              << result.operations << "," << result.min_ns << "," << result.median_ns << ","
+              << result.bytes_per_piece << "\n";
+  }
+}
+
+bool parse_options (const int argc, char** argv, Options& options)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    const std::string value = argv[++i];
+    if (arg == "--format" && (value == "csv" || value == "json"))
+      options.format = value;
+    else if (arg == "--max-pieces")
+      options.max_pieces = std::strtoull(value.c_str(), nullptr, 10);
+    else if (arg == "--inputs")
+      options.inputs = std::max<size_t>(std::strtoull(value.c_str(), nullptr, 10), 1);
+    else if (arg == "--repeats")
+      options.repeats = std::max<size_t>(std::strtoull(value.c_str(), nullptr, 10), 1);
+    else
+      return false;
+  }
+  return true;
+}
+
+/**
+ * KernelEquation as compiled by default, for an access profile, and to the
+ * evaluation planner's layout. The profile is taken from a training trace
+ * drawn from the same distribution as, but disjoint from, the timed inputs.
+ */
+std::vector<Result> bench_layouts (const JSONEquation& equation, const size_t pieces,
+                                   const Distribution distribution, const Options& options,
+                                   std::mt19937_64& rng)
+{
+  const std::vector<double> drawn = make_inputs(2 * options.inputs, pieces, distribution, rng);
+  const std::vector<double> training(drawn.begin(), drawn.begin() + options.inputs);
+  const std::vector<double> inputs(drawn.begin() + options.inputs, drawn.end());
+
+  const KernelEquation kernels(equation);
+  const KernelEquation profiled(equation, kernels.profile(training));
+  const KernelEquation planned(equation, plan_equation(equation).layout);
+  std::vector<Result> results;
+  for (const auto& [name, layout] : {std::make_pair("kernel_calculate", &kernels),
+                                     std::make_pair("kernel_profiled_calculate", &profiled),
+                                     std::make_pair("kernel_planned_calculate", &planned)})
+  {
+    Result result{name, pieces, 3, PowerTypes::integer, name_of(distribution)};
+    time_it(result, inputs.size(), options.repeats, [&] ()
+    {
+      double sum = 0;
+      for (const double x : inputs)
+        sum += layout->calculate(x).value_or(0.0);
+      sink = sink + sum;
+    });
+    results.push_back(result);
+  }
+  return results;
+}
+
+} /* namespace */
+
+int main (int argc, char** argv)
+{
+  Options options;
+  if (!parse_options(argc, argv, options))
+  {
+    std::cerr << "Usage: " << argv[0]
+              << " [--format csv|json] [--max-pieces N] [--inputs N] [--repeats N]" << std::endl;
+    return 1;
+  }
+
+  std::mt19937_64 rng(20200101);
+  std::vector<Result> results;
+
+  /*
+   * Piece count: loading, and lookups under every input distribution, for
+   * cubic pieces with integer powers
+   */
+  for (size_t pieces = 1; pieces <= options.max_pieces; pieces *= 10)
+  {
+    const nlohmann::json json_in = make_equation(pieces, 3, PowerTypes::integer, rng);
+    const std::string text = json_in.dump();
+    const auto load_rows = bench_load(text, pieces, 3, PowerTypes::integer,
+                                      pieces >= 100000 ? 1 : options.repeats);
+    results.insert(results.end(), load_rows.begin(), load_rows.end());
+
+    const JSONEquation equation(json_in);
+    const auto memory_rows = bench_memory(equation, pieces, 3, PowerTypes::integer);
+    results.insert(results.end(), memory_rows.begin(), memory_rows.end());
+    for (const Distribution distribution : {Distribution::uniform, Distribution::sorted,
+                                            Distribution::clustered, Distribution::skewed,
+                                            Distribution::out_of_domain})
+    {
+      const auto rows = bench_evaluation(equation, pieces, 3, PowerTypes::integer, distribution, options, rng);
+      results.insert(results.end(), rows.begin(), rows.end());
+    }
+    for (const Distribution distribution : {Distribution::uniform, Distribution::clustered,
+                                            Distribution::skewed})
+    {
+      const auto rows = bench_layouts(equation, pieces, distribution, options, rng);
+      results.insert(results.end(), rows.begin(), rows.end());
+    }
+  }
+
+  /*
+   * Degree and kind of powers: loading and evaluation of 100 pieces
+   */
+  const size_t pieces = std::min<size_t>(100, std::max<size_t>(options.max_pieces, 1));
+  for (const PowerTypes powers : {PowerTypes::integer, PowerTypes::fractional, PowerTypes::negative})
+  {
+    for (const int degree : {0, 1, 2, 3, 5, 8, 12, 16, 20})
+    {
+      const nlohmann::json json_in = make_equation(pieces, degree, powers, rng);
+      const auto load_rows = bench_load(json_in.dump(), pieces, degree, powers, options.repeats);
+      results.insert(results.end(), load_rows.begin(), load_rows.end());
+
+      const JSONEquation equation(json_in);
+      const auto memory_rows = bench_memory(equation, pieces, degree, powers);
+      results.insert(results.end(), memory_rows.begin(), memory_rows.end());
+      const auto rows = bench_evaluation(equation, pieces, degree, powers, Distribution::uniform,
+                                         options, rng);
+      results.insert(results.end(), rows.begin(), rows.end());
+    }
+  }
+
+  print(results, options.format);
+  return 0;
+}
@@ -0,0 +1,502 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * An accuracy report runs every evaluation mode of an equation over the same
+ * sample inputs and measures each against a long double evaluation of the
+ * same JSON: throughput, worst absolute, relative and ULP error, and the
+ * inputs the worst errors occurred at.
+ */
+
+#ifndef ACCURACY_REPORT_HPP
+#define ACCURACY_REPORT_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bytecode_equation.hpp"
+#include "equation_generator.hpp"
+#include "fixed_point_equation.hpp"
+#include "json_equation.hpp"
+#include "kernel_equation.hpp"
+#include "shifted_equation.hpp"
+
+namespace json_equation {
+
+/**
+ * How sample inputs are drawn from an equation's domain.
+ */
+enum class SampleDistribution
+{
+  uniform,   /* Uniform over [first lower bound, last upper bound], gaps included */
+  per_piece, /* The same number of samples uniform over each piece */
+  edges      /* Every piece's bounds and their neighbouring doubles, then per_piece */
+};
+
+struct AccuracyOptions
+{
+  uint64_t seed = 1;
+  size_t samples = 100000;
+  SampleDistribution distribution = SampleDistribution::uniform;
+
+  /*
+   * Number of worst inputs kept per mode
+   */
+  size_t worst_inputs = 5;
+
+  /*
+   * Timed passes over the samples per mode; the fastest is reported
+   */
+  size_t repeats = 5;
+};
+
+/**
+ * An input at which a mode was among its least accurate.
+ */
+struct WorstInput
+{
+  double x = 0;
+  double value = 0;
+  long double reference = 0;
+  double ulp_error = 0;
+};
+
+/**
+ * Accuracy and speed of one evaluation mode. Errors are measured where both
+ * the mode and the reference return a value. ULPs are those of the mode's
+ * result type at the reference value; fixed point is measured in ULPs of
+ * double, its output type after conversion.
+ */
+struct ModeAccuracy
+{
+  std::string mode;
+  std::string precision;
+
+  /*
+   * Why the mode could not be built for this equation, or empty
+   */
+  std::string skipped;
+
+  double ns_per_eval = 0;
+
+  /*
+   * Inputs at which both the mode and the reference returned a value
+   */
+  size_t compared = 0;
+
+  /*
+   * Inputs at which exactly one of the mode and the reference returned a
+   * value
+   */
+  size_t domain_mismatches = 0;
+
+  double max_abs_error = 0;
+  double max_rel_error = 0;
+  double max_ulp_error = 0;
+  double mean_ulp_error = 0;
+
+  /*
+   * Worst inputs by ULP error, worst first
+   */
+  std::vector<WorstInput> worst;
+};
+
+using AccuracyReport = std::vector<ModeAccuracy>;
+
+namespace detail {
+
+/**
+ * @return Size of one unit in the last place of T at value, never below the
+ * smallest subnormal of T
+ */
+template<typename T>
+long double ulp_at (const long double value)
+{
+  const int exponent = value == 0 ?
+                       std::numeric_limits<T>::min_exponent - 1 :
+                       std::max(std::ilogb(value), std::numeric_limits<T>::min_exponent - 1);
+  return std::ldexp(1.0L, exponent - (std::numeric_limits<T>::digits - 1));
+}
+
+/**
+ * One evaluation mode: a name, the ULPs its errors are measured in, and a
+ * batch evaluation writing one result per input.
+ */
+struct AccuracyMode
+{
+  std::string name;
+  std::string precision;
+  long double (*ulp) (long double);
+  std::function<void (const std::vector<double>&, std::vector<std::optional<double> >&)> evaluate;
+};
+
+/**
+ * Compare a mode's results with the reference and fill in the error figures
+ * of accuracy.
+ */
+inline void measure_errors (const std::vector<double>& inputs,
+                            const std::vector<std::optional<double> >& results,
+                            const std::vector<std::optional<long double> >& reference,
+                            long double (*ulp) (long double), const size_t worst_inputs,
+                            ModeAccuracy& accuracy)
+{
+  const double infinity = std::numeric_limits<double>::infinity();
+  std::vector<WorstInput> errors;
+  long double ulp_sum = 0;
+  for (size_t i = 0; i < inputs.size(); ++i)
+  {
+    if (results[i].has_value() != reference[i].has_value())
+    {
+      ++accuracy.domain_mismatches;
+      continue;
+    }
+    if (!results[i].has_value())
+      continue;
+
+    const double value = *results[i];
+    const long double expected = *reference[i];
+    double abs_error = 0;
+    double rel_error = 0;
+    double ulp_error = 0;
+    if (!std::isfinite(value) || !std::isfinite(expected))
+    {
+      /*
+       * Matching infinities or NaNs are exact; anything else is infinitely
+       * wrong
+       */
+      const bool same = (std::isnan(value) && std::isnan(expected)) || value == expected;
+      abs_error = rel_error = ulp_error = same ? 0 : infinity;
+    }
+    else
+    {
+      const long double difference = std::fabs(static_cast<long double>(value) - expected);
+      abs_error = static_cast<double>(difference);
+      rel_error = expected == 0 ? (difference == 0 ? 0 : infinity) :
+                  static_cast<double>(difference / std::fabs(expected));
+      ulp_error = static_cast<double>(difference / ulp(expected));
+    }
+
+    ++accuracy.compared;
+    accuracy.max_abs_error = std::max(accuracy.max_abs_error, abs_error);
+    accuracy.max_rel_error = std::max(accuracy.max_rel_error, rel_error);
+    accuracy.max_ulp_error = std::max(accuracy.max_ulp_error, ulp_error);
+    ulp_sum += ulp_error;
+    errors.push_back({inputs[i], value, expected, ulp_error});
+  }
+
+  accuracy.mean_ulp_error = accuracy.compared == 0 ?
+                            0 : static_cast<double>(ulp_sum / static_cast<long double>(accuracy.compared));
+  const size_t kept = std::min(worst_inputs, errors.size());
+  std::partial_sort(errors.begin(), errors.begin() + static_cast<std::ptrdiff_t>(kept), errors.end(),
+                    [] (const WorstInput& a, const WorstInput& b)
+                    {
+                      return a.ulp_error > b.ulp_error;
+                    });
+  accuracy.worst.assign(errors.begin(), errors.begin() + static_cast<std::ptrdiff_t>(kept));
+}
+
+/**
+ * Build every mode that the equation can be compiled to. Modes that cannot
+ * are returned in skipped, with the reason.
+ */
+inline std::vector<AccuracyMode> accuracy_modes (const nlohmann::json& json_in, const JSONEquation& equation,
+                                                 AccuracyReport& skipped)
+{
+  std::vector<AccuracyMode> modes;
+  const auto add = [&] (const std::string& name, const std::string& precision, long double (*ulp) (long double),
+                        const std::function<AccuracyMode ()>& build)
+  {
+    try
+    {
+      modes.push_back(build());
+      modes.back().name = name;
+      modes.back().precision = precision;
+      modes.back().ulp = ulp;
+    }
+    catch (const std::exception& e)
+    {
+      ModeAccuracy accuracy;
+      accuracy.mode = name;
+      accuracy.precision = precision;
+      accuracy.skipped = e.what();
+      skipped.push_back(accuracy);
+    }
+  };
+
+  /*
+   * Each mode owns its compiled form through the shared_ptr captured by its
+   * evaluate function
+   */
+  const auto mode_of = [] (auto compiled, auto evaluate_one)
+  {
+    AccuracyMode mode;
+    mode.evaluate = [compiled, evaluate_one] (const std::vector<double>& xs,
+                                              std::vector<std::optional<double> >& out)
+    {
+      for (size_t i = 0; i < xs.size(); ++i)
+      {
+        const auto value = evaluate_one(*compiled, xs[i]);
+        out[i] = value.has_value() ? std::optional<double>(static_cast<double>(*value)) : std::nullopt;
+      }
+    };
+    return mode;
+  };
+
+  add("json_equation", "double", ulp_at<double>, [&] ()
+  {
+    return mode_of(std::make_shared<JSONEquation>(json_in), [] (const JSONEquation& e, const double x)
+    {
+      return e.calculate(x);
+    });
+  });
+  add("json_equation_float", "float", ulp_at<float>, [&] ()
+  {
+    return mode_of(std::make_shared<BasicJSONEquation<float> >(json_in),
+                   [] (const BasicJSONEquation<float>& e, const double x)
+                   {
+                     return e.calculate(static_cast<float>(x));
+                   });
+  });
+  add("kernel", "double", ulp_at<double>, [&] ()
+  {
+    return mode_of(std::make_shared<KernelEquation>(equation), [] (const KernelEquation& e, const double x)
+    {
+      return e.calculate(x);
+    });
+  });
+  add("bytecode", "double", ulp_at<double>, [&] ()
+  {
+    return mode_of(std::make_shared<BytecodeEquation>(equation), [] (const BytecodeEquation& e, const double x)
+    {
+      return e.calculate(x);
+    });
+  });
+  add("shifted", "double", ulp_at<double>, [&] ()
+  {
+    return mode_of(std::make_shared<ShiftedEquation>(equation), [] (const ShiftedEquation& e, const double x)
+    {
+      return e.calculate(x);
+    });
+  });
+  add("shifted_float", "float", ulp_at<float>, [&] ()
+  {
+    return mode_of(std::make_shared<BasicShiftedEquation<float> >(equation),
+                   [] (const BasicShiftedEquation<float>& e, const double x)
+                   {
+                     return e.calculate(x);
+                   });
+  });
+  add("fixed_point", "fixed", ulp_at<double>, [&] ()
+  {
+    return mode_of(std::make_shared<FixedPointEquation>(equation), [] (const FixedPointEquation& e, const double x)
+    {
+      const auto value = e.calculate(e.input_to_fixed(x));
+      return value.has_value() ? std::optional<double>(e.output_to_double(*value)) : std::nullopt;
+    });
+  });
+  return modes;
+}
+
+} /* namespace detail */
+
+/**
+ * Draw sample inputs from an equation's domain.
+ * @param equation Equation whose piece bounds define the domain
+ * @param options Seed, sample count and distribution
+ * @return Sample inputs, reproducible from the seed on any platform
+ * @throws invalid_argument If the equation has no pieces, or a bound the
+ * distribution needs is not finite
+ */
+inline std::vector<double> accuracy_inputs (const JSONEquation& equation, const AccuracyOptions& options)
+{
+  if (equation.pieces.empty())
+    throw std::invalid_argument("Equation has no pieces to sample.");
+
+  detail::GeneratorRandom random(options.seed);
+  std::vector<double> inputs;
+  inputs.reserve(options.samples);
+  const auto check_finite = [] (const double bound)
+  {
+    if (!std::isfinite(bound))
+      throw std::invalid_argument("Cannot sample a domain with non-finite bound " + std::to_string(bound) + ".");
+  };
+
+  if (options.distribution == SampleDistribution::uniform)
+  {
+    const double lo = equation.pieces.begin()->first.lb;
+    const double hi = equation.pieces.rbegin()->first.ub;
+    check_finite(lo);
+    check_finite(hi);
+    for (size_t i = 0; i < options.samples; ++i)
+      inputs.push_back(random.between(lo, hi));
+    return inputs;
+  }
+
+  if (options.distribution == SampleDistribution::edges)
+  {
+    for (const auto& piece : equation.pieces)
+    {
+      for (const double bound : {piece.first.lb, piece.first.ub})
+      {
+        for (const double x : {std::nextafter(bound, -HUGE_VAL), bound, std::nextafter(bound, HUGE_VAL)})
+        {
+          if (inputs.size() < options.samples)
+            inputs.push_back(x);
+        }
+      }
+    }
+    /*
+     * Adjacent pieces often share a bound
+     */
+    std::sort(inputs.begin(), inputs.end());
+    inputs.erase(std::unique(inputs.begin(), inputs.end()), inputs.end());
+  }
+
+  const size_t remaining = options.samples - inputs.size();
+  const size_t per_piece = remaining / equation.pieces.size();
+  size_t extra = remaining % equation.pieces.size();
+  for (const auto& piece : equation.pieces)
+  {
+    check_finite(piece.first.lb);
+    check_finite(piece.first.ub);
+    const size_t count = per_piece + (extra > 0 ? 1 : 0);
+    extra -= extra > 0 ? 1 : 0;
+    for (size_t i = 0; i < count; ++i)
+      inputs.push_back(random.between(piece.first.lb, piece.first.ub));
+  }
+  return inputs;
+}
+
+/**
+ * Run every evaluation mode the equation can be compiled to over inputs, and
+ * measure each against a long double evaluation of the same JSON. Where long
+ * double is no wider than double, the reference is no more precise than the
+ * double modes and their errors read as zero.
+ * @param json_in Equation JSON
+ * @param inputs Sample inputs, e.g. from accuracy_inputs()
+ * @param options Number of worst inputs to keep and timed repeats
+ * @return One entry per mode, including modes skipped for this equation
+ */
+inline AccuracyReport accuracy_report (const nlohmann::json& json_in, const std::vector<double>& inputs,
+                                       const AccuracyOptions& options)
+{
+  const BasicJSONEquation<long double> reference_equation(json_in);
+  std::vector<std::optional<long double> > reference(inputs.size());
+  for (size_t i = 0; i < inputs.size(); ++i)
+    reference[i] = reference_equation.calculate(static_cast<long double>(inputs[i]));
+
+  const JSONEquation equation(json_in);
+  AccuracyReport skipped;
+  AccuracyReport report;
+  std::vector<std::optional<double> > results(inputs.size());
+  for (const auto& mode : detail::accuracy_modes(json_in, equation, skipped))
+  {
+    ModeAccuracy accuracy;
+    accuracy.mode = mode.name;
+    accuracy.precision = mode.precision;
+
+    double best = std::numeric_limits<double>::infinity();
+    for (size_t repeat = 0; repeat < std::max<size_t>(options.repeats, 1); ++repeat)
+    {
+      const auto start = std::chrono::steady_clock::now();
+      mode.evaluate(inputs, results);
+      const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+      best = std::min(best, elapsed.count());
+    }
+    accuracy.ns_per_eval = inputs.empty() ? 0 : best / static_cast<double>(inputs.size());
+
+    detail::measure_errors(inputs, results, reference, mode.ulp, options.worst_inputs, accuracy);
+    report.push_back(accuracy);
+  }
+  report.insert(report.end(), skipped.begin(), skipped.end());
+  return report;
+}
+
+/**
+ * Write a report as a table of modes followed by each mode's worst inputs.
+ */
+inline void write_text (std::ostream& os, const AccuracyReport& report)
+{
+  os << std::left << std::setw(20) << "mode" << std::setw(8) << "type" << std::right
+     << std::setw(12) << "ns/eval" << std::setw(14) << "max abs" << std::setw(14) << "max rel"
+     << std::setw(14) << "max ulp" << std::setw(14) << "mean ulp" << std::setw(12) << "mismatches" << "\n";
+  for (const auto& mode : report)
+  {
+    os << std::left << std::setw(20) << mode.mode << std::setw(8) << mode.precision << std::right;
+    if (!mode.skipped.empty())
+    {
+      os << "  skipped: " << mode.skipped << "\n";
+      continue;
+    }
+    os << std::setprecision(4) << std::setw(12) << mode.ns_per_eval << std::setw(14) << mode.max_abs_error
+       << std::setw(14) << mode.max_rel_error << std::setw(14) << mode.max_ulp_error
+       << std::setw(14) << mode.mean_ulp_error << std::setw(12) << mode.domain_mismatches << "\n";
+  }
+
+  os << std::setprecision(17);
+  for (const auto& mode : report)
+  {
+    if (mode.worst.empty())
+      continue;
+    os << "\nworst inputs of " << mode.mode << " (x, value, reference, ulp)\n";
+    for (const auto& input : mode.worst)
+      os << "  " << input.x << ", " << input.value << ", " << static_cast<double>(input.reference)
+         << ", " << input.ulp_error << "\n";
+  }
+}
+
+/**
+ * @return A report as a JSON array of modes. Infinite errors are written as
+ * null, as JSON has no infinity.
+ */
+inline nlohmann::json accuracy_json (const AccuracyReport& report)
+{
+  const auto number = [] (const double value) -> nlohmann::json
+  {
+    return std::isfinite(value) ? nlohmann::json(value) : nlohmann::json(nullptr);
+  };
+
+  nlohmann::json out = nlohmann::json::array();
+  for (const auto& mode : report)
+  {
+    nlohmann::json entry = {{"mode", mode.mode}, {"precision", mode.precision}};
+    if (!mode.skipped.empty())
+    {
+      entry["skipped"] = mode.skipped;
+      out.push_back(entry);
+      continue;
+    }
+    entry["ns_per_eval"] = mode.ns_per_eval;
+    entry["compared"] = mode.compared;
+    entry["domain_mismatches"] = mode.domain_mismatches;
+    entry["max_abs_error"] = number(mode.max_abs_error);
+    entry["max_rel_error"] = number(mode.max_rel_error);
+    entry["max_ulp_error"] = number(mode.max_ulp_error);
+    entry["mean_ulp_error"] = number(mode.mean_ulp_error);
+    entry["worst"] = nlohmann::json::array();
+    for (const auto& input : mode.worst)
+      entry["worst"].push_back({{"x", input.x}, {"value", number(input.value)},
+                                {"reference", number(static_cast<double>(input.reference))},
+                                {"ulp_error", number(input.ulp_error)}});
+    out.push_back(entry);
+  }
+  return out;
+}
+
+} /* namespace json_equation */
+
+#endif //ACCURACY_REPORT_HPP
@@ -0,0 +1,471 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * BytecodeEquation compiles every piece of a JSONEquation into a compact
+ * instruction stream, stored contiguously for all pieces, and evaluates it
+ * with a small threaded interpreter. The cost of evaluating a piece then
+ * depends on how complex its polynomial actually is rather than on generic
+ * per-monomial overhead, and the code for all pieces fits in a few cache
+ * lines.
+ */
+
+#ifndef BYTECODE_EQUATION_HPP
+#define BYTECODE_EQUATION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "json_equation_core.hpp"
+
+namespace json_equation {
+
+/**
+ * BytecodeEquation is a compiled, read-only form of a JSONEquation.
+ *
+ * Each piece is lowered as follows. Monomials are grouped by the fractional
+ * part of their power (integer, half, one third, two thirds) and each group
+ * is evaluated as a root of x times Horner-form polynomials in x and in 1/x,
+ * for its non-negative and negative powers. Every other real power is
+ * evaluated with std::pow, as are very large powers and groups whose root or
+ * reciprocal is not defined everywhere in the piece's range. Pieces proven
+ * pole-free when the equation was loaded end in a plain division; the rest
+ * end in the same pole checks as PolynomialEquation::calculate (0/0 -> 0,
+ * n/0 -> inf).
+ *
+ * Horner form rounds differently from a sum of powers, so results agree with
+ * JSONEquation::calculate to within a few ULP rather than bit for bit. Horner
+ * steps are fused multiply-adds on targets that have them (FP_FAST_FMA, e.g.
+ * with -mfma), which round once per step; results then differ from other
+ * builds in the last bits.
+ */
+class BytecodeEquation
+{
+public:
+  enum class Opcode : uint8_t
+  {
+    load_const,     /* acc = constants[operand] */
+    horner,         /* acc = acc * x + constants[operand] */
+    horner_recip,   /* acc = acc / x + constants[operand], with 1 / x from recip */
+    mul_x,          /* acc *= x */
+    mul_recip,      /* acc *= 1 / x */
+    mul_sqrt,       /* acc *= sqrt(x) */
+    mul_cbrt,       /* acc *= cbrt(x) */
+    recip,          /* compute 1 / x for later mul_recip */
+    sqrt,           /* compute sqrt(x) for later mul_sqrt */
+    cbrt,           /* compute cbrt(x) for later mul_cbrt */
+    accumulate,     /* sum += acc */
+    add_pow,        /* sum += constants[operand + 1] * pow(x, constants[operand]) */
+    end_numerator,  /* numerator = sum, sum = 0 */
+    divide,         /* return numerator / sum */
+    divide_checked  /* return numerator / sum, with 0/0 -> 0 and n/0 -> inf */
+  };
+
+  struct Instruction
+  {
+    Opcode op;
+    uint32_t operand;
+  };
+
+  BytecodeEquation () = default;
+
+  /**
+   * Compile every piece of an equation.
+   * @param equation Loaded equation. Its pieces' pole analysis decides which
+   * pieces need pole checks.
+   */
+  explicit BytecodeEquation (const JSONEquation& equation)
+  {
+    for (const auto& piece : equation.pieces)
+    {
+      lower_bounds.push_back(piece.first.lb);
+      upper_bounds.push_back(piece.first.ub);
+      lb_inclusive.push_back(piece.first.lb_inclusive);
+      ub_inclusive.push_back(piece.first.ub_inclusive);
+      entry_points.push_back(static_cast<uint32_t>(code.size()));
+      compile_piece(piece.first, piece.second);
+    }
+  }
+
+  /**
+   * Calculate the output of the polynomial system given input x. If x is not
+   * included in the range for any piece, std::nullopt is returned instead.
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range. Else, double val
+   */
+  std::optional<double> calculate (const double x) const
+  {
+    const size_t idx = find_piece(x);
+    if (idx == npos)
+      return std::nullopt;
+    return run(code.data() + entry_points[idx], x);
+  }
+
+  std::optional<double> operator() (const double x) const
+  {
+    return calculate(x);
+  }
+
+  /**
+   * @return Number of pieces
+   */
+  size_t size () const
+  {
+    return entry_points.size();
+  }
+
+  /**
+   * @return Total number of instructions across all pieces
+   */
+  size_t instruction_count () const
+  {
+    return code.size();
+  }
+
+  /**
+   * @return Memory held by this equation: bound arrays as index, code and
+   * constants as polynomials, and entry points as metadata
+   */
+  MemoryUsage memory_usage () const
+  {
+    MemoryUsage usage;
+    usage.metadata += sizeof(*this);
+    detail::count_vector(usage, usage.index, lower_bounds);
+    detail::count_vector(usage, usage.index, upper_bounds);
+    detail::count_vector(usage, usage.index, lb_inclusive);
+    detail::count_vector(usage, usage.index, ub_inclusive);
+    detail::count_vector(usage, usage.polynomials, code);
+    detail::count_vector(usage, usage.polynomials, constants);
+    detail::count_vector(usage, usage.metadata, entry_points);
+    return usage;
+  }
+
+  /**
+   * Human-readable listing of every piece's code, for inspecting how pieces
+   * were lowered.
+   */
+  std::string disassemble () const
+  {
+    static const char* const names[] = {
+        "load_const", "horner", "horner_recip", "mul_x", "mul_recip", "mul_sqrt", "mul_cbrt",
+        "recip", "sqrt", "cbrt", "accumulate", "add_pow", "end_numerator",
+        "divide", "divide_checked"};
+
+    std::ostringstream os;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+      const auto entry = std::find(entry_points.begin(), entry_points.end(), i);
+      if (entry != entry_points.end())
+        os << "piece " << (entry - entry_points.begin()) << ":\n";
+      const Instruction& instruction = code[i];
+      os << "  " << names[static_cast<size_t>(instruction.op)];
+      if (instruction.op == Opcode::load_const || instruction.op == Opcode::horner
+          || instruction.op == Opcode::horner_recip)
+        os << " " << constants[instruction.operand];
+      else if (instruction.op == Opcode::add_pow)
+        os << " " << constants[instruction.operand + 1] << " * x^" << constants[instruction.operand];
+      os << "\n";
+    }
+    return os.str();
+  }
+
+private:
+  static constexpr size_t npos = detail::no_piece;
+
+  /*
+   * Powers beyond this magnitude would unroll into too many instructions and
+   * are evaluated with std::pow instead.
+   */
+  static constexpr double max_horner_power = 64;
+
+  /*
+   * Piece bounds, in ascending order, as parallel arrays for the search
+   */
+  std::vector<double> lower_bounds;
+  std::vector<double> upper_bounds;
+  std::vector<bool> lb_inclusive;
+  std::vector<bool> ub_inclusive;
+
+  /*
+   * Code and constants for all pieces, stored contiguously
+   */
+  std::vector<uint32_t> entry_points;
+  std::vector<Instruction> code;
+  std::vector<double> constants;
+
+  size_t find_piece (const double x) const
+  {
+    return detail::find_in_bounds(x, lower_bounds, upper_bounds, lb_inclusive, ub_inclusive, 0, upper_bounds.size());
+  }
+
+  void emit (const Opcode op, const uint32_t operand = 0)
+  {
+    code.push_back({op, operand});
+  }
+
+  uint32_t constant (const double value)
+  {
+    constants.push_back(value);
+    return static_cast<uint32_t>(constants.size() - 1);
+  }
+
+  void compile_piece (const numeric_range::NumericRange<double>& range,
+                      const PolynomialEquation& function)
+  {
+    /*
+     * Roots of x are only used where they agree with std::pow, i.e. for
+     * x > 0, and 1/x only where x != 0.
+     */
+    const bool positive = range.lb > 0 || (range.lb == 0 && !range.lb_inclusive);
+    const bool nonzero = positive || range.ub < 0 || (range.ub == 0 && !range.ub_inclusive);
+
+    const size_t prologue = code.size();
+    bool needs_recip = false;
+    bool needs_sqrt = false;
+    bool needs_cbrt = false;
+    compile_sum(function.numerator, positive, nonzero, needs_recip, needs_sqrt, needs_cbrt);
+    emit(Opcode::end_numerator);
+    compile_sum(function.denominator, positive, nonzero, needs_recip, needs_sqrt, needs_cbrt);
+    emit(function.pole_status() == PoleStatus::pole_free ? Opcode::divide : Opcode::divide_checked);
+
+    std::vector<Instruction> setup;
+    if (needs_recip)
+      setup.push_back({Opcode::recip, 0});
+    if (needs_sqrt)
+      setup.push_back({Opcode::sqrt, 0});
+    if (needs_cbrt)
+      setup.push_back({Opcode::cbrt, 0});
+    code.insert(code.begin() + static_cast<std::ptrdiff_t>(prologue), setup.begin(), setup.end());
+  }
+
+  /**
+   * Emit code that adds the sum of the given monomials to the sum register.
+   */
+  void compile_sum (const std::vector<Monomial>& terms, const bool positive, const bool nonzero,
+                    bool& needs_recip, bool& needs_sqrt, bool& needs_cbrt)
+  {
+    /*
+     * Laurent polynomials in x, keyed by power, for each root of x:
+     * 0 -> 1, 1 -> sqrt(x), 2 -> cbrt(x), 3 -> cbrt(x)^2
+     */
+    std::map<long, double> groups[4];
+
+    for (const auto& term : terms)
+    {
+      const double whole = std::floor(term.power);
+      const double fraction = term.power - whole;
+      const detail::TermPlan plan = detail::plan_term(term.power);
+
+      int group = -1;
+      if (plan.kind == detail::PowerKind::integer)
+        group = 0;
+      else if (positive && plan.kind == detail::PowerKind::half)
+        group = 1;
+      else if (positive && plan.kind == detail::PowerKind::third)
+        group = (fraction < 0.5) ? 2 : 3;
+
+      if (group < 0 || (whole < 0 && !nonzero) || std::fabs(whole) > max_horner_power)
+      {
+        const uint32_t power = constant(term.power);
+        constant(term.coefficient);
+        emit(Opcode::add_pow, power);
+        continue;
+      }
+      groups[group][static_cast<long>(whole)] += term.coefficient;
+    }
+
+    for (int group = 0; group < 4; ++group)
+    {
+      /*
+       * Non-negative and negative powers are evaluated as separate Horner
+       * polynomials in x and in 1 / x. Horner over the whole span, scaled by
+       * (1/x)^m, overflows for large |x| where the sum does not, e.g. for
+       * x^-3 + x^3 at x = 1e60.
+       */
+      std::map<long, double> positive_powers;
+      std::map<long, double> negative_powers;
+      for (const auto& [power, coefficient] : groups[group])
+      {
+        if (power >= 0)
+          positive_powers[power] = coefficient;
+        else
+          negative_powers[-power] = coefficient;
+      }
+      needs_recip = needs_recip || !negative_powers.empty();
+
+      for (const bool reciprocal : {false, true})
+      {
+        const std::map<long, double>& powers = reciprocal ? negative_powers : positive_powers;
+        if (powers.empty())
+          continue;
+        compile_horner(powers, reciprocal ? Opcode::horner_recip : Opcode::horner,
+                       reciprocal ? Opcode::mul_recip : Opcode::mul_x);
+
+        if (group == 1)
+          emit(Opcode::mul_sqrt);
+        for (int i = 2; i <= group; ++i)
+          emit(Opcode::mul_cbrt);
+        emit(Opcode::accumulate);
+      }
+      needs_sqrt = needs_sqrt || (group == 1 && !groups[group].empty());
+      needs_cbrt = needs_cbrt || (group >= 2 && !groups[group].empty());
+    }
+  }
+
+  /**
+   * Emit code that leaves the polynomial sum of coefficients[p] * v^p in the
+   * accumulator, in Horner form, where v is x or 1 / x.
+   * @param coefficients Coefficients keyed by non-negative power
+   * @param horner Horner step for v
+   * @param multiply Multiplication by v
+   */
+  void compile_horner (const std::map<long, double>& coefficients, const Opcode horner, const Opcode multiply)
+  {
+    const long lowest = coefficients.begin()->first;
+    const long highest = coefficients.rbegin()->first;
+
+    emit(Opcode::load_const, constant(coefficients.rbegin()->second));
+    for (long power = highest - 1; power >= lowest; --power)
+    {
+      const auto found = coefficients.find(power);
+      if (found != coefficients.end())
+        emit(horner, constant(found->second));
+      else
+        emit(multiply);
+    }
+    for (long i = 0; i < lowest; ++i)
+      emit(multiply);
+  }
+
+  /**
+   * Execute one piece's code. With GCC and Clang each handler jumps straight
+   * to the next one through a table of label addresses (threaded dispatch);
+   * other compilers use a switch in a loop.
+   */
+  double run (const Instruction* ip, const double x) const
+  {
+    const double* const c = constants.data();
+    double acc = 0;
+    double sum = 0;
+    double numerator = 0;
+    double recip_x = 0;
+    double sqrt_x = 0;
+    double cbrt_x = 0;
+
+#if defined(__GNUC__)
+    static const void* const handlers[] = {
+        &&op_load_const, &&op_horner, &&op_horner_recip, &&op_mul_x, &&op_mul_recip, &&op_mul_sqrt,
+        &&op_mul_cbrt, &&op_recip, &&op_sqrt, &&op_cbrt, &&op_accumulate,
+        &&op_add_pow, &&op_end_numerator, &&op_divide, &&op_divide_checked};
+#define JSON_EQUATION_DISPATCH() goto *handlers[static_cast<size_t>(ip->op)]
+#define JSON_EQUATION_NEXT() do { ++ip; JSON_EQUATION_DISPATCH(); } while (0)
+
+    JSON_EQUATION_DISPATCH();
+  op_load_const:
+    acc = c[ip->operand];
+    JSON_EQUATION_NEXT();
+  op_horner:
+    acc = horner_step(acc, x, c[ip->operand]);
+    JSON_EQUATION_NEXT();
+  op_horner_recip:
+    acc = horner_step(acc, recip_x, c[ip->operand]);
+    JSON_EQUATION_NEXT();
+  op_mul_x:
+    acc *= x;
+    JSON_EQUATION_NEXT();
+  op_mul_recip:
+    acc *= recip_x;
+    JSON_EQUATION_NEXT();
+  op_mul_sqrt:
+    acc *= sqrt_x;
+    JSON_EQUATION_NEXT();
+  op_mul_cbrt:
+    acc *= cbrt_x;
+    JSON_EQUATION_NEXT();
+  op_recip:
+    recip_x = 1 / x;
+    JSON_EQUATION_NEXT();
+  op_sqrt:
+    sqrt_x = std::sqrt(x);
+    JSON_EQUATION_NEXT();
+  op_cbrt:
+    cbrt_x = std::cbrt(x);
+    JSON_EQUATION_NEXT();
+  op_accumulate:
+    sum += acc;
+    JSON_EQUATION_NEXT();
+  op_add_pow:
+    sum += c[ip->operand + 1] * std::pow(x, c[ip->operand]);
+    JSON_EQUATION_NEXT();
+  op_end_numerator:
+    numerator = sum;
+    sum = 0;
+    JSON_EQUATION_NEXT();
+  op_divide:
+    return numerator / sum;
+  op_divide_checked:
+    return checked_divide(numerator, sum);
+
+#undef JSON_EQUATION_NEXT
+#undef JSON_EQUATION_DISPATCH
+#else
+    for (;; ++ip)
+    {
+      switch (ip->op)
+      {
+        case Opcode::load_const: acc = c[ip->operand]; break;
+        case Opcode::horner: acc = horner_step(acc, x, c[ip->operand]); break;
+        case Opcode::horner_recip: acc = horner_step(acc, recip_x, c[ip->operand]); break;
+        case Opcode::mul_x: acc *= x; break;
+        case Opcode::mul_recip: acc *= recip_x; break;
+        case Opcode::mul_sqrt: acc *= sqrt_x; break;
+        case Opcode::mul_cbrt: acc *= cbrt_x; break;
+        case Opcode::recip: recip_x = 1 / x; break;
+        case Opcode::sqrt: sqrt_x = std::sqrt(x); break;
+        case Opcode::cbrt: cbrt_x = std::cbrt(x); break;
+        case Opcode::accumulate: sum += acc; break;
+        case Opcode::add_pow: sum += c[ip->operand + 1] * std::pow(x, c[ip->operand]); break;
+        case Opcode::end_numerator: numerator = sum; sum = 0; break;
+        case Opcode::divide: return numerator / sum;
+        case Opcode::divide_checked: return checked_divide(numerator, sum);
+      }
+    }
+#endif
+  }
+
+  /**
+   * One Horner step, acc * v + c, fused where the target has a fused
+   * multiply-add instruction. Elsewhere std::fma is a slow library call, and
+   * the step is left as a multiply and an add.
+   */
+  static double horner_step (const double acc, const double v, const double c)
+  {
+#ifdef FP_FAST_FMA
+    return std::fma(acc, v, c);
+#else
+    return acc * v + c;
+#endif
+  }
+
+  static double checked_divide (const double numerator_val, const double denominator_val)
+  {
+    if (numerator_val == 0 && denominator_val == 0)
+      return 0;
+    else if (numerator_val != 0 && denominator_val == 0)
+      return std::numeric_limits<double>::infinity();
+    return numerator_val / denominator_val;
+  }
+};
+
+} /* namespace json_equation */
+
+#endif //BYTECODE_EQUATION_HPP
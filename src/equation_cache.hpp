@@ -0,0 +1,258 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * Opt-in memoization for JSONEquation. Callers that evaluate the same handful
+ * of inputs over and over (e.g. control loops cycling through setpoints) can
+ * wrap an equation in an EquationCache to skip the piece lookup and the
+ * polynomial evaluation on repeated inputs.
+ */
+
+#ifndef EQUATION_CACHE_HPP
+#define EQUATION_CACHE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+
+#include "json_equation_core.hpp"
+#include "thread_slots.hpp"
+
+namespace json_equation {
+
+/**
+ * Hit and miss counts for a cache, as observed at the time of the query.
+ */
+struct CacheStats
+{
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+};
+
+/**
+ * EquationCache is a fixed-size, direct-mapped memo of JSONEquation results.
+ * Each input x is keyed on its exact bit pattern (so 0.0 and -0.0 are cached
+ * separately) and maps to exactly one slot; a colliding input simply evicts
+ * the previous occupant. Both a computed value and the "x is not in any
+ * piece" outcome are cached.
+ *
+ * The cache refers to the equation it wraps and does not observe changes to
+ * it. Call clear() after modifying the equation's pieces.
+ *
+ * A single EquationCache must not be used from multiple threads at once;
+ * see ThreadLocalEquationCache for that.
+ * @tparam Slots Number of cache slots. Must be a power of two.
+ */
+template<size_t Slots = 256>
+class alignas(64) EquationCache
+{
+  static_assert(Slots > 0 && (Slots & (Slots - 1)) == 0,
+                "EquationCache slot count must be a power of two");
+
+public:
+  explicit EquationCache (const JSONEquation& _equation) :
+      equation(_equation)
+  {}
+
+  /**
+   * Calculate the output of the wrapped equation given input x, serving the
+   * result from the cache if x was the last input stored in its slot.
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range. Else, double val
+   */
+  std::optional<double> calculate (const double x)
+  {
+    const uint64_t key = key_of(x);
+    Entry& entry = entries[slot_of(key)];
+
+    if (entry.state != EntryState::empty && entry.key == key)
+    {
+      bump(hit_count);
+      if (entry.state == EntryState::no_piece)
+        return std::nullopt;
+      return entry.value;
+    }
+
+    bump(miss_count);
+    const auto result = equation.calculate(x);
+    entry.key = key;
+    entry.value = result.value_or(0);
+    entry.state = result.has_value() ? EntryState::value : EntryState::no_piece;
+    return result;
+  }
+
+  /**
+   * Shorthand operator provided for convenience, equivalent to calculate().
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range. Else, double val
+   */
+  std::optional<double> operator() (const double x)
+  {
+    return calculate(x);
+  }
+
+  /**
+   * Drop every cached result. Counters are left untouched.
+   */
+  void clear ()
+  {
+    for (auto& entry : entries)
+      entry.state = EntryState::empty;
+  }
+
+  /**
+   * Reset the hit and miss counters to zero.
+   */
+  void reset_stats ()
+  {
+    hit_count.store(0, std::memory_order_relaxed);
+    miss_count.store(0, std::memory_order_relaxed);
+  }
+
+  CacheStats stats () const
+  {
+    return {hit_count.load(std::memory_order_relaxed),
+            miss_count.load(std::memory_order_relaxed)};
+  }
+
+  static constexpr size_t slots () { return Slots; }
+
+private:
+  enum class EntryState : uint8_t
+  {
+    empty,
+    value,
+    no_piece
+  };
+
+  struct Entry
+  {
+    uint64_t key = 0;
+    double value = 0;
+    EntryState state = EntryState::empty;
+  };
+
+  const JSONEquation& equation;
+  std::array<Entry, Slots> entries{};
+
+  /*
+   * The counters are only ever written by the thread that owns this cache, so
+   * a relaxed load/store pair is enough and avoids a locked read-modify-write.
+   * They are atomic so that other threads may read them for aggregation.
+   */
+  std::atomic<uint64_t> hit_count{0};
+  std::atomic<uint64_t> miss_count{0};
+
+  static void bump (std::atomic<uint64_t>& counter)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+
+  static uint64_t key_of (const double x)
+  {
+    uint64_t key;
+    std::memcpy(&key, &x, sizeof(key));
+    return key;
+  }
+
+  /*
+   * Fibonacci hashing: setpoints tend to differ only in their low mantissa
+   * bits, so mix every bit of the key into the top bits used as the index.
+   */
+  static size_t slot_of (const uint64_t key)
+  {
+    if constexpr (Slots == 1)
+      return 0;
+    else
+      return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> (64 - log2_slots()));
+  }
+
+  static constexpr unsigned log2_slots ()
+  {
+    unsigned bits = 0;
+    while ((size_t{1} << bits) < Slots)
+      ++bits;
+    return bits;
+  }
+};
+
+/**
+ * ThreadLocalEquationCache gives every calling thread its own private
+ * EquationCache over a shared equation, so concurrent callers never contend
+ * on cache slots or counters. Per-thread caches are created on first use and
+ * live as long as this object.
+ * @tparam Slots Number of cache slots per thread. Must be a power of two.
+ */
+template<size_t Slots = 256>
+class ThreadLocalEquationCache
+{
+public:
+  explicit ThreadLocalEquationCache (const JSONEquation& _equation) :
+      equation(_equation)
+  {}
+
+  ThreadLocalEquationCache (const ThreadLocalEquationCache&) = delete;
+  ThreadLocalEquationCache& operator= (const ThreadLocalEquationCache&) = delete;
+
+  /**
+   * Calculate the output of the wrapped equation given input x using the
+   * calling thread's cache.
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range. Else, double val
+   */
+  std::optional<double> calculate (const double x)
+  {
+    return local().calculate(x);
+  }
+
+  std::optional<double> operator() (const double x)
+  {
+    return calculate(x);
+  }
+
+  /**
+   * The calling thread's cache.
+   */
+  EquationCache<Slots>& local ()
+  {
+    return caches.local([this] { return std::make_unique<EquationCache<Slots> >(equation); });
+  }
+
+  /**
+   * Hit and miss counts summed over every thread's cache.
+   */
+  CacheStats stats () const
+  {
+    CacheStats total;
+    caches.for_each([&total] (const EquationCache<Slots>& cache)
+    {
+      const auto s = cache.stats();
+      total.hits += s.hits;
+      total.misses += s.misses;
+    });
+    return total;
+  }
+
+  /**
+   * Drop every cached result in every thread's cache. Must not race with
+   * calculate() on other threads.
+   */
+  void clear ()
+  {
+    caches.for_each([] (EquationCache<Slots>& cache) { cache.clear(); });
+  }
+
+private:
+  const JSONEquation& equation;
+  detail::ThreadSlots<EquationCache<Slots> > caches;
+};
+
+} /* namespace json_equation */
+
+#endif //EQUATION_CACHE_HPP
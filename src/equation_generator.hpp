@@ -0,0 +1,335 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * A deterministic, seeded generator of synthetic piecewise equations for
+ * benchmarks and stress tests. It emits JSON that follows the library's
+ * schema, or any of the binary encodings nlohmann::json supports, so large
+ * realistic inputs can be produced on demand instead of checked in.
+ */
+
+#ifndef EQUATION_GENERATOR_HPP
+#define EQUATION_GENERATOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../include/json.hpp"
+
+namespace json_equation {
+
+/**
+ * How piece bounds are placed over the domain.
+ */
+enum class Spacing : uint8_t
+{
+  uniform,   /* Equal widths */
+  geometric, /* Widths growing by a constant ratio; the domain must be positive */
+  random     /* Random widths */
+};
+
+/**
+ * Which bounds of each piece are inclusive. Where two pieces share a bound
+ * and both would include it, the later piece's lower bound is made exclusive
+ * so that pieces never overlap.
+ */
+enum class Inclusivity : uint8_t
+{
+  lower,       /* [lb, ub) */
+  upper,       /* (lb, ub] */
+  both,        /* [lb, ub] */
+  alternating, /* [lb, ub] and (lb, ub) in turn */
+  random       /* Each bound independently */
+};
+
+/**
+ * Powers of the non-constant terms of each polynomial. Term k (1-based) has a
+ * power of about k, or -k for negative powers.
+ */
+enum class PowerTypes : uint8_t
+{
+  integer,    /* k */
+  fractional, /* k - 1/2 or k - 1/3 */
+  real,       /* k - u for a random u in (0, 1) */
+  negative,   /* -k */
+  mixed       /* Any of the above, chosen per term */
+};
+
+/**
+ * Encodings an equation can be emitted in.
+ */
+enum class EquationFormat : uint8_t
+{
+  json,
+  cbor,
+  msgpack,
+  ubjson,
+  bson
+};
+
+/**
+ * Parameters of a generated equation. The same options always generate the
+ * same equation, on every platform.
+ */
+struct GeneratorOptions
+{
+  uint64_t seed = 1;
+  size_t pieces = 100;
+
+  /*
+   * The pieces cover [domain_start, domain_end], less the gaps
+   */
+  double domain_start = 1;
+  double domain_end = 101;
+  Spacing spacing = Spacing::uniform;
+
+  /*
+   * Fraction of every piece's share of the domain left uncovered, as a gap
+   * after the piece. 0 gives contiguous pieces.
+   */
+  double gap_fraction = 0;
+  Inclusivity inclusivity = Inclusivity::lower;
+
+  /*
+   * Each polynomial has a constant term and a number of non-constant terms
+   * chosen uniformly in [min_degree, max_degree]
+   */
+  int min_degree = 3;
+  int max_degree = 3;
+  PowerTypes powers = PowerTypes::integer;
+
+  /*
+   * Fraction of pieces that get a denominator besides 1. Denominators have
+   * positive coefficients, so they have no poles over a positive domain.
+   */
+  double rational_fraction = 0;
+};
+
+namespace detail {
+
+/**
+ * mt19937_64 is fully specified by the standard but the distributions are
+ * not, so generated values are derived from its raw output directly.
+ */
+class GeneratorRandom
+{
+public:
+  explicit GeneratorRandom (const uint64_t seed) : engine(seed) {}
+
+  /**
+   * @return A uniformly distributed double in [0, 1)
+   */
+  double unit ()
+  {
+    return static_cast<double>(engine() >> 11) * 0x1.0p-53;
+  }
+
+  double between (const double lo, const double hi)
+  {
+    return lo + (hi - lo) * unit();
+  }
+
+  /**
+   * @return A uniformly distributed integer in [lo, hi]
+   */
+  int between (const int lo, const int hi)
+  {
+    const auto range = static_cast<uint64_t>(hi - lo) + 1;
+    return lo + static_cast<int>(engine() % range);
+  }
+
+  bool chance (const double probability)
+  {
+    return unit() < probability;
+  }
+
+private:
+  std::mt19937_64 engine;
+};
+
+inline std::vector<double> piece_edges (const GeneratorOptions& options, GeneratorRandom& random)
+{
+  const size_t n = options.pieces;
+  const double start = options.domain_start;
+  const double end = options.domain_end;
+  std::vector<double> edges(n + 1);
+
+  switch (options.spacing)
+  {
+    case Spacing::uniform:
+      for (size_t i = 0; i <= n; ++i)
+        edges[i] = start + (end - start) * static_cast<double>(i) / static_cast<double>(n);
+      break;
+    case Spacing::geometric:
+      if (!(start > 0))
+        throw std::runtime_error("Geometric spacing needs a positive domain_start.");
+      for (size_t i = 0; i <= n; ++i)
+        edges[i] = start * std::pow(end / start, static_cast<double>(i) / static_cast<double>(n));
+      break;
+    case Spacing::random:
+    {
+      /*
+       * Widths are bounded away from zero so that no piece is degenerate
+       */
+      std::vector<double> widths(n);
+      double total = 0;
+      for (auto& width : widths)
+        total += (width = 0.05 + random.unit());
+      double sum = 0;
+      edges[0] = start;
+      for (size_t i = 0; i < n; ++i)
+      {
+        sum += widths[i];
+        edges[i + 1] = start + (end - start) * (sum / total);
+      }
+      break;
+    }
+  }
+  edges[n] = end;
+  return edges;
+}
+
+inline double term_power (const PowerTypes powers, const int k, GeneratorRandom& random)
+{
+  PowerTypes type = powers;
+  if (type == PowerTypes::mixed)
+    type = static_cast<PowerTypes>(random.between(0, 3));
+
+  switch (type)
+  {
+    case PowerTypes::integer: return k;
+    case PowerTypes::fractional: return k - ((k % 2) ? 0.5 : 1.0 / 3.0);
+    case PowerTypes::real: return k - (0.05 + 0.9 * random.unit());
+    default: return -k;
+  }
+}
+
+/**
+ * Terms as parallel "powers" and "coefficients" arrays, constant term first.
+ */
+inline nlohmann::json generate_terms (const GeneratorOptions& options, const int degree,
+                                      const double coefficient_lo, const double coefficient_hi,
+                                      GeneratorRandom& random)
+{
+  std::vector<double> powers{0.0};
+  std::vector<double> coefficients{random.between(coefficient_lo, coefficient_hi)};
+  for (int k = 1; k <= degree; ++k)
+  {
+    powers.push_back(term_power(options.powers, k, random));
+    coefficients.push_back(random.between(coefficient_lo, coefficient_hi));
+  }
+  return {{"powers", powers}, {"coefficients", coefficients}};
+}
+
+} /* namespace detail */
+
+/**
+ * Generate a synthetic piecewise equation.
+ * @param options Shape of the equation
+ * @return JSON following the library's equation schema
+ * @throws runtime_error If the options are inconsistent
+ */
+inline nlohmann::json generate_equation (const GeneratorOptions& options)
+{
+  if (options.pieces == 0)
+    throw std::runtime_error("An equation needs at least one piece.");
+  if (!(options.domain_start < options.domain_end))
+    throw std::runtime_error("domain_start must be less than domain_end.");
+  if (!(options.gap_fraction >= 0 && options.gap_fraction < 1))
+    throw std::runtime_error("gap_fraction must be in [0, 1).");
+  if (options.min_degree < 0 || options.min_degree > options.max_degree)
+    throw std::runtime_error("Degrees must satisfy 0 <= min_degree <= max_degree.");
+
+  detail::GeneratorRandom random(options.seed);
+  const std::vector<double> edges = detail::piece_edges(options, random);
+
+  nlohmann::json equation;
+  nlohmann::json& list = equation["pieces"] = nlohmann::json::array();
+  bool previous_ub_inclusive = false;
+  double previous_ub = 0;
+  for (size_t i = 0; i < options.pieces; ++i)
+  {
+    const double lb = edges[i];
+    double ub = edges[i + 1];
+    if (options.gap_fraction > 0)
+      ub = lb + (ub - lb) * (1 - options.gap_fraction);
+
+    bool lb_inclusive = true;
+    bool ub_inclusive = true;
+    switch (options.inclusivity)
+    {
+      case Inclusivity::lower: ub_inclusive = false; break;
+      case Inclusivity::upper: lb_inclusive = false; break;
+      case Inclusivity::both: break;
+      case Inclusivity::alternating: lb_inclusive = ub_inclusive = (i % 2 == 0); break;
+      case Inclusivity::random:
+        lb_inclusive = random.chance(0.5);
+        ub_inclusive = random.chance(0.5);
+        break;
+    }
+    if (i > 0 && previous_ub == lb && previous_ub_inclusive)
+      lb_inclusive = false;
+
+    nlohmann::json piece = {{"lower_bound", lb}, {"lb_inclusive", lb_inclusive},
+                            {"upper_bound", ub}, {"ub_inclusive", ub_inclusive}};
+    const int degree = random.between(options.min_degree, options.max_degree);
+    piece["numerator"] = detail::generate_terms(options, degree, -1.0, 1.0, random);
+    if (random.chance(options.rational_fraction))
+      piece["denominator"] = detail::generate_terms(options, degree, 0.5, 1.5, random);
+    list.push_back(std::move(piece));
+
+    previous_ub = ub;
+    previous_ub_inclusive = ub_inclusive;
+  }
+  return equation;
+}
+
+/**
+ * Encode an equation in one of the formats nlohmann::json supports. Binary
+ * encodings can be loaded back with nlohmann::json::from_cbor() and friends
+ * and passed to the JSONEquation constructor.
+ * @param equation Equation, e.g. from generate_equation()
+ * @param format Encoding
+ * @return Encoded bytes (text for EquationFormat::json)
+ */
+inline std::vector<uint8_t> encode_equation (const nlohmann::json& equation, const EquationFormat format)
+{
+  switch (format)
+  {
+    case EquationFormat::cbor: return nlohmann::json::to_cbor(equation);
+    case EquationFormat::msgpack: return nlohmann::json::to_msgpack(equation);
+    case EquationFormat::ubjson: return nlohmann::json::to_ubjson(equation);
+    case EquationFormat::bson: return nlohmann::json::to_bson(equation);
+    default:
+    {
+      const std::string text = equation.dump();
+      return std::vector<uint8_t>(text.begin(), text.end());
+    }
+  }
+}
+
+/**
+ * Decode an equation produced by encode_equation().
+ */
+inline nlohmann::json decode_equation (const std::vector<uint8_t>& bytes, const EquationFormat format)
+{
+  switch (format)
+  {
+    case EquationFormat::cbor: return nlohmann::json::from_cbor(bytes);
+    case EquationFormat::msgpack: return nlohmann::json::from_msgpack(bytes);
+    case EquationFormat::ubjson: return nlohmann::json::from_ubjson(bytes);
+    case EquationFormat::bson: return nlohmann::json::from_bson(bytes);
+    default: return nlohmann::json::parse(bytes.begin(), bytes.end());
+  }
+}
+
+} /* namespace json_equation */
+
+#endif //EQUATION_GENERATOR_HPP
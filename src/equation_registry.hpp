@@ -0,0 +1,342 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * EquationRegistry holds many equations (e.g. one per device) whose pieces
+ * frequently share identical polynomials. Polynomials are interned into a
+ * pool keyed by a canonical hash, so each distinct polynomial is stored once
+ * and pieces refer to it by index.
+ */
+
+#ifndef EQUATION_REGISTRY_HPP
+#define EQUATION_REGISTRY_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "json_equation_core.hpp"
+
+namespace json_equation {
+
+namespace detail {
+
+/**
+ * Two scalars are the same for interning if they are equal and have the same
+ * sign (so 0.0 and -0.0 differ), or if both are NaN.
+ */
+template<typename T>
+bool same_scalar (const T a, const T b)
+{
+  return (a == b && std::signbit(a) == std::signbit(b)) || (std::isnan(a) && std::isnan(b));
+}
+
+template<typename T>
+size_t hash_scalar (const T value)
+{
+  if (std::isnan(value))
+    return 0x7ff8u;
+  /*
+   * std::hash maps 0.0 and -0.0 together, so fold the sign in separately
+   */
+  return std::hash<T>{}(value) ^ (std::signbit(value) ? 0x9e3779b97f4a7c15u : 0u);
+}
+
+inline void hash_combine (size_t& seed, const size_t value)
+{
+  seed ^= value + 0x9e3779b97f4a7c15u + (seed << 6) + (seed >> 2);
+}
+
+template<typename T>
+bool same_terms (const std::vector<BasicMonomial<T> >& lhs, const std::vector<BasicMonomial<T> >& rhs)
+{
+  return lhs.size() == rhs.size()
+         && std::equal(lhs.begin(), lhs.end(), rhs.begin(),
+                       [] (const BasicMonomial<T>& a, const BasicMonomial<T>& b)
+                       {
+                         return same_scalar(a.power, b.power) && same_scalar(a.coefficient, b.coefficient);
+                       });
+}
+
+} /* namespace detail */
+
+/**
+ * Canonical hash of a polynomial's contents. Terms are hashed in the order
+ * they are evaluated, since reordering or merging them would change rounding;
+ * the pole status is included because it selects the evaluation path.
+ * @param function Polynomial to hash
+ * @return Hash that is equal for polynomials that same_polynomial() accepts
+ */
+template<typename T>
+size_t polynomial_hash (const BasicPolynomialEquation<T>& function)
+{
+  size_t seed = static_cast<size_t>(function.pole_status());
+  for (const auto* terms : {&function.numerator, &function.denominator})
+  {
+    detail::hash_combine(seed, terms->size());
+    for (const auto& term : *terms)
+    {
+      detail::hash_combine(seed, detail::hash_scalar(term.power));
+      detail::hash_combine(seed, detail::hash_scalar(term.coefficient));
+    }
+  }
+  return seed;
+}
+
+/**
+ * @return Whether two polynomials evaluate identically for every input
+ * because they have the same terms, in the same order, and the same pole
+ * status
+ */
+template<typename T>
+bool same_polynomial (const BasicPolynomialEquation<T>& lhs, const BasicPolynomialEquation<T>& rhs)
+{
+  return lhs.pole_status() == rhs.pole_status()
+         && detail::same_terms(lhs.numerator, rhs.numerator)
+         && detail::same_terms(lhs.denominator, rhs.denominator);
+}
+
+/**
+ * BasicPolynomialPool stores distinct polynomials once each. Interning a
+ * polynomial returns the index of an identical one already in the pool, or
+ * adds it. Indices remain valid for the lifetime of the pool.
+ * @tparam T Scalar type used for storage and evaluation
+ */
+template<typename T>
+class BasicPolynomialPool
+{
+public:
+  /**
+   * Find or add a polynomial.
+   * @param function Prepared polynomial to intern
+   * @return Index of the pooled polynomial identical to function
+   */
+  uint32_t intern (const BasicPolynomialEquation<T>& function)
+  {
+    auto& candidates = index[polynomial_hash(function)];
+    for (const uint32_t candidate : candidates)
+    {
+      if (same_polynomial(polynomials[candidate], function))
+        return candidate;
+    }
+
+    const auto idx = static_cast<uint32_t>(polynomials.size());
+    polynomials.push_back(function);
+    candidates.push_back(idx);
+    return idx;
+  }
+
+  const BasicPolynomialEquation<T>& operator[] (const uint32_t idx) const
+  {
+    return polynomials[idx];
+  }
+
+  /**
+   * @return Number of distinct polynomials in the pool
+   */
+  size_t size () const
+  {
+    return polynomials.size();
+  }
+
+  /**
+   * @return Memory held by the pool: the polynomials as for JSONEquation, and
+   * the hash index from content to candidates as index
+   */
+  MemoryUsage memory_usage () const
+  {
+    MemoryUsage usage;
+    usage.metadata += sizeof(*this);
+    detail::count_vector(usage, usage.metadata, polynomials);
+    for (const auto& function : polynomials)
+      usage += function.memory_usage();
+
+    const size_t buckets = index.bucket_count() * sizeof(void*);
+    usage.index += buckets;
+    detail::count_block(usage, buckets);
+    for (const auto& entry : index)
+    {
+      const size_t node = sizeof(void*) + sizeof(entry);
+      usage.index += node;
+      detail::count_block(usage, node);
+      detail::count_vector(usage, usage.index, entry.second);
+    }
+    return usage;
+  }
+
+private:
+  std::vector<BasicPolynomialEquation<T> > polynomials;
+  std::unordered_map<size_t, std::vector<uint32_t> > index;
+};
+
+using PolynomialPool = BasicPolynomialPool<double>;
+
+/**
+ * BasicInternedEquation is a piecewise equation whose pieces refer to
+ * polynomials in a BasicPolynomialPool. Bounds are kept in a sorted vector
+ * with the same semantics as JSONEquation's piece map.
+ * @tparam T Scalar type used for piece bounds, storage and evaluation
+ */
+template<typename T>
+class BasicInternedEquation
+{
+public:
+  /**
+   * Bounds of every piece, in ascending order.
+   */
+  std::vector<numeric_range::NumericRange<T> > bounds;
+
+  /**
+   * Index into the pool of each piece's polynomial, parallel to bounds.
+   */
+  std::vector<uint32_t> polynomials;
+
+  /**
+   * Intern the pieces of an equation into a pool.
+   * @param equation Loaded equation
+   * @param pool Pool receiving the equation's polynomials
+   */
+  BasicInternedEquation (const BasicJSONEquation<T>& equation, BasicPolynomialPool<T>& pool)
+  {
+    bounds.reserve(equation.pieces.size());
+    polynomials.reserve(equation.pieces.size());
+    for (const auto& piece : equation.pieces)
+    {
+      bounds.push_back(piece.first);
+      polynomials.push_back(pool.intern(piece.second));
+    }
+  }
+
+  /**
+   * Calculate the output of the polynomial system given input x.
+   * @param pool Pool the equation was interned into
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range, or NaN. Else, T val
+   */
+  std::optional<T> calculate (const BasicPolynomialPool<T>& pool, const T x) const
+  {
+    /*
+     * NaN is in no piece, and the comparator throws for it
+     */
+    if (std::isnan(x))
+      return std::nullopt;
+    const auto found = std::lower_bound(bounds.begin(), bounds.end(), numeric_range::NumericRange<T>{x},
+                                        numeric_range::NumericRangeComparator<T>());
+    if (found == bounds.end() || x < found->lb || (x == found->lb && !found->lb_inclusive))
+      return std::nullopt;
+    return pool[polynomials[static_cast<size_t>(found - bounds.begin())]].calculate(x);
+  }
+
+  /**
+   * @return Memory held by this equation, not counting the pool: bounds as
+   * index and polynomial indices as metadata
+   */
+  MemoryUsage memory_usage () const
+  {
+    MemoryUsage usage;
+    usage.metadata += sizeof(*this);
+    detail::count_vector(usage, usage.index, bounds);
+    detail::count_vector(usage, usage.metadata, polynomials);
+    return usage;
+  }
+};
+
+using InternedEquation = BasicInternedEquation<double>;
+
+/**
+ * BasicEquationRegistry holds many equations that share one polynomial pool.
+ * Equations are identified by the index add() returns.
+ * @tparam T Scalar type used for piece bounds, storage and evaluation
+ */
+template<typename T>
+class BasicEquationRegistry
+{
+public:
+  /**
+   * Add an equation to the registry, interning its polynomials.
+   * @param equation Loaded equation
+   * @return Index identifying the equation in this registry
+   */
+  size_t add (const BasicJSONEquation<T>& equation)
+  {
+    equations.emplace_back(equation, polynomial_pool);
+    return equations.size() - 1;
+  }
+
+  /**
+   * Calculate the output of one of the registered equations given input x.
+   * @param idx Index returned by add()
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range, or NaN. Else, T val
+   */
+  std::optional<T> calculate (const size_t idx, const T x) const
+  {
+    return equations[idx].calculate(polynomial_pool, x);
+  }
+
+  const BasicInternedEquation<T>& operator[] (const size_t idx) const
+  {
+    return equations[idx];
+  }
+
+  /**
+   * @return Number of registered equations
+   */
+  size_t size () const
+  {
+    return equations.size();
+  }
+
+  /**
+   * @return Total number of pieces across all registered equations
+   */
+  size_t piece_count () const
+  {
+    size_t count = 0;
+    for (const auto& equation : equations)
+      count += equation.bounds.size();
+    return count;
+  }
+
+  const BasicPolynomialPool<T>& pool () const
+  {
+    return polynomial_pool;
+  }
+
+  /**
+   * @return Memory held by the registry: every equation and the shared pool
+   */
+  MemoryUsage memory_usage () const
+  {
+    MemoryUsage usage;
+    usage.metadata += sizeof(*this) - sizeof(polynomial_pool);
+    usage += polynomial_pool.memory_usage();
+    detail::count_vector(usage, usage.metadata, equations);
+    for (const auto& equation : equations)
+    {
+      /*
+       * The equation objects themselves are in the vector's block
+       */
+      usage += equation.memory_usage();
+      usage.metadata -= sizeof(equation);
+    }
+    return usage;
+  }
+
+private:
+  BasicPolynomialPool<T> polynomial_pool;
+  std::vector<BasicInternedEquation<T> > equations;
+};
+
+using EquationRegistry = BasicEquationRegistry<double>;
+
+} /* namespace json_equation */
+
+#endif //EQUATION_REGISTRY_HPP
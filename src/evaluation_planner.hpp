@@ -0,0 +1,602 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * The evaluation planner chooses how a KernelEquation looks up and evaluates
+ * the pieces of an equation. It gathers the equation's statistics, estimates
+ * the cost of every candidate from a cost model, optionally calibrated on the
+ * machine at hand, and records its choices in an EvaluationPlan that can be
+ * inspected, saved as JSON, edited and compiled.
+ */
+
+#ifndef EVALUATION_PLANNER_HPP
+#define EVALUATION_PLANNER_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "json_equation.hpp"
+#include "kernel_equation.hpp"
+
+namespace json_equation {
+
+/**
+ * What the planner knows about an equation.
+ */
+struct EquationStatistics
+{
+  size_t pieces = 0;
+  double domain_lb = 0;
+  double domain_ub = 0;
+
+  /*
+   * Mean piece width, and its standard deviation relative to the mean: 0 for
+   * evenly spaced pieces
+   */
+  double mean_width = 0;
+  double width_variation = 0;
+
+  /*
+   * Share of [domain_lb, domain_ub] not covered by any piece
+   */
+  double gap_fraction = 0;
+
+  /*
+   * Pieces by the kernel KernelEquation would choose for their shape
+   */
+  std::array<size_t, 7> kernels{};
+
+  /*
+   * Largest magnitude of any power
+   */
+  double max_power = 0;
+
+  /*
+   * Monomials by how their power is evaluated: integer powers, powers with
+   * a half or third (via sqrt or cbrt), and anything else (via std::pow).
+   * Negative powers count in their kind and again in negative_terms.
+   */
+  size_t integer_terms = 0;
+  size_t root_terms = 0;
+  size_t real_terms = 0;
+  size_t negative_terms = 0;
+
+  /*
+   * Pieces whose denominator was not proven nonzero at load
+   */
+  size_t unproven_denominators = 0;
+};
+
+/**
+ * Estimated costs, in nanoseconds, of the operations lookups and kernels are
+ * made of. The defaults are typical of a desktop x86-64 core; calibrate()
+ * measures them instead.
+ */
+struct CostModel
+{
+  double search_step = 6;      /* One binary search level in cache, mispredicted half the time */
+  double cache_miss = 40;      /* One load that misses cache */
+  double cache_bytes = 1 << 20;
+  double index_lookup = 5;     /* Computing and reading a direct index cell */
+  double kernel_call = 4;      /* Bounds checks, reading a piece and calling its kernel */
+  double multiply_add = 2;     /* One dependent multiply-add */
+  double divide = 6;
+  double sqrt = 5;
+  double cbrt = 30;
+  double pow = 30;
+
+  /**
+   * Measure every cost except cache_bytes with short micro-benchmarks, in
+   * about a tenth of a second. Results vary from run to run by some percent.
+   */
+  static CostModel calibrate ();
+};
+
+/**
+ * A plan for compiling an equation, with the estimates it was chosen by.
+ * Edit layout to override the planner, and compile it with
+ * KernelEquation(equation, plan.layout).
+ */
+struct EvaluationPlan
+{
+  EquationStatistics statistics;
+  CostModel model;
+  KernelEquation::Layout layout;
+
+  /*
+   * Estimated time per lookup, or infinity where the lookup is not possible
+   */
+  double binary_search_ns = 0;
+  double direct_index_ns = 0;
+
+  /*
+   * Estimated time of each piece's chosen kernel, in ascending order of
+   * bounds
+   */
+  std::vector<double> kernel_ns;
+
+  /*
+   * Estimated time per evaluation, with inputs spread evenly over pieces
+   */
+  double predicted_ns = 0;
+};
+
+namespace detail {
+
+inline double search_levels (const size_t candidates)
+{
+  return std::ceil(std::log2(static_cast<double>(candidates) + 1));
+}
+
+/**
+ * @return Multiplications of a power ladder raising to whole
+ */
+inline double ladder_multiplies (uint32_t whole)
+{
+  double count = 0;
+  for (; whole != 0; whole >>= 1)
+    count += whole & 1;
+  return count;
+}
+
+/**
+ * @return Cost of PolynomialEquation::calculate on a piece
+ */
+inline double general_cost (const PolynomialEquation& function, const CostModel& model)
+{
+  double cost = model.kernel_call + model.divide;
+  int32_t ladder = 0;
+  for (const auto* terms : {&function.numerator, &function.denominator})
+  {
+    for (const auto& term : *terms)
+    {
+      const TermPlan plan = plan_term(term.power);
+      const int32_t whole = std::abs(plan.whole);
+      cost += model.multiply_add;
+      if (plan.kind == PowerKind::general || whole > max_ladder_power)
+      {
+        cost += model.pow;
+        continue;
+      }
+      ladder = std::max(ladder, whole);
+      cost += model.multiply_add * ladder_multiplies(static_cast<uint32_t>(whole));
+      if (plan.whole < 0)
+        cost += model.divide;
+      if (plan.kind == PowerKind::half)
+        cost += model.sqrt;
+      else if (plan.kind == PowerKind::third)
+        cost += model.cbrt;
+    }
+  }
+  /*
+   * Squarings of the shared power ladder
+   */
+  return cost + model.multiply_add * std::ceil(std::log2(static_cast<double>(ladder) + 1));
+}
+
+/**
+ * @return Cost of a piece in the kernel KernelEquation chose for its shape
+ */
+inline double kernel_cost (const KernelEquation::Kernel kernel, const PolynomialEquation& function,
+                           const CostModel& model)
+{
+  using Kernel = KernelEquation::Kernel;
+  /*
+   * Highest power of a sum of monomials
+   */
+  const auto highest = [] (const std::vector<Monomial>& terms)
+  {
+    double power = 0;
+    for (const auto& term : terms)
+      power = std::max(power, term.power);
+    return power;
+  };
+
+  /*
+   * Multiply-adds of a rational sum: Horner steps over its non-negative
+   * powers and a ladder for the lowest, and Horner steps in 1/x down from its
+   * most negative power
+   */
+  const auto laurent_steps = [] (const std::vector<Monomial>& terms)
+  {
+    double lowest = std::numeric_limits<double>::infinity();
+    double highest = 0;
+    double most_negative = 0;
+    for (const auto& term : terms)
+    {
+      if (term.power < 0)
+        most_negative = std::min(most_negative, term.power);
+      else
+        lowest = std::min(lowest, term.power), highest = std::max(highest, term.power);
+    }
+    if (std::isinf(lowest))
+      lowest = highest;
+    return highest - lowest + ladder_multiplies(static_cast<uint32_t>(lowest)) - most_negative;
+  };
+  const auto has_negative = [] (const std::vector<Monomial>& terms)
+  {
+    return std::any_of(terms.begin(), terms.end(), [] (const Monomial& term) { return term.power < 0; });
+  };
+
+  switch (kernel)
+  {
+    case Kernel::constant:
+    case Kernel::affine:
+    case Kernel::quadratic:
+    case Kernel::cubic:
+      return model.kernel_call + model.multiply_add * static_cast<double>(kernel);
+    case Kernel::dense:
+      return model.kernel_call + model.multiply_add * highest(function.numerator);
+    case Kernel::rational:
+    {
+      const bool reciprocal = has_negative(function.numerator) || has_negative(function.denominator);
+      return model.kernel_call + model.divide * (reciprocal ? 2 : 1)
+             + model.multiply_add * (laurent_steps(function.numerator) + laurent_steps(function.denominator));
+    }
+    default:
+      return general_cost(function, model);
+  }
+}
+
+/**
+ * @return Cost of a binary search of n pieces: every level, and a cache miss
+ * for each level beyond what fits in cache. Both bound arrays are read.
+ */
+inline double binary_search_cost (const size_t n, const CostModel& model)
+{
+  const double levels = search_levels(n);
+  const double cached_levels = std::log2(model.cache_bytes / (2 * sizeof(double)));
+  return levels * model.search_step + std::max(0.0, levels - cached_levels) * model.cache_miss;
+}
+
+/**
+ * @return Cost of a direct index lookup, from the pieces each cell of
+ * KernelEquation::index_cells leaves to search, or infinity if the domain
+ * cannot be indexed
+ */
+inline double direct_index_cost (const JSONEquation& equation, const CostModel& model)
+{
+  const size_t count = equation.pieces.size();
+  if (count == 0)
+    return std::numeric_limits<double>::infinity();
+  const double lo = equation.pieces.begin()->first.lb;
+  const double hi = equation.pieces.rbegin()->first.ub;
+  if (!std::isfinite(lo) || !std::isfinite(hi) || !(hi > lo))
+    return std::numeric_limits<double>::infinity();
+
+  std::vector<double> lower_bounds;
+  std::vector<double> upper_bounds;
+  for (const auto& piece : equation.pieces)
+  {
+    lower_bounds.push_back(piece.first.lb);
+    upper_bounds.push_back(piece.first.ub);
+  }
+  const std::vector<uint32_t> first = KernelEquation::index_cells(lower_bounds, upper_bounds).cells;
+
+  double steps = 0;
+  for (size_t cell = 0; cell < count; ++cell)
+    steps += search_levels(std::min<size_t>(first[cell + 1] + 1, count) - first[cell]);
+  steps /= static_cast<double>(count);
+
+  /*
+   * Reading the cell, and the bounds it points at, each miss once the table
+   * and bound arrays outgrow cache
+   */
+  const double misses = (count * sizeof(uint32_t) > model.cache_bytes ? 1 : 0)
+                        + (count * 2 * sizeof(double) > model.cache_bytes ? 1 : 0);
+  return model.index_lookup + steps * model.search_step + misses * model.cache_miss;
+}
+
+/**
+ * Time body(), which runs the given number of operations, each dependent on
+ * the one before, as the best of a few runs.
+ * @return Nanoseconds per operation
+ */
+template<typename Body>
+double time_per_operation (const size_t operations, Body body)
+{
+  double best = std::numeric_limits<double>::infinity();
+  for (int run = 0; run < 5; ++run)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    body();
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count() / static_cast<double>(operations));
+  }
+  return best;
+}
+
+} /* namespace detail */
+
+inline CostModel CostModel::calibrate ()
+{
+  CostModel model;
+  constexpr size_t operations = 1 << 18;
+  volatile double sink = 0;
+  volatile double seed = 0.5;
+
+  /*
+   * Arithmetic latencies, from chains of dependent operations
+   */
+  model.multiply_add = detail::time_per_operation(operations, [&] ()
+  {
+    double y = seed;
+    for (size_t i = 0; i < operations; ++i)
+      y = y * 0.999 + 0.25;
+    sink = y;
+  });
+  model.divide = detail::time_per_operation(operations, [&] ()
+  {
+    double y = seed;
+    for (size_t i = 0; i < operations; ++i)
+      y = 1.5 / (y + 1.0);
+    sink = y;
+  });
+  model.sqrt = detail::time_per_operation(operations, [&] ()
+  {
+    double y = seed;
+    for (size_t i = 0; i < operations; ++i)
+      y = std::sqrt(y + 1.5);
+    sink = y;
+  }) - model.multiply_add;
+  model.cbrt = detail::time_per_operation(operations / 4, [&] ()
+  {
+    double y = seed;
+    for (size_t i = 0; i < operations / 4; ++i)
+      y = std::cbrt(y + 1.5);
+    sink = y;
+  }) - model.multiply_add;
+  model.pow = detail::time_per_operation(operations / 4, [&] ()
+  {
+    double y = seed;
+    for (size_t i = 0; i < operations / 4; ++i)
+      y = std::pow(y + 1.5, 0.7);
+    sink = y;
+  }) - model.multiply_add;
+
+  /*
+   * Binary searches of an array that fits in cache, per level
+   */
+  std::mt19937_64 rng(1);
+  std::vector<double> bounds(4096);
+  std::iota(bounds.begin(), bounds.end(), 0.0);
+  std::vector<double> keys(operations / 16);
+  for (auto& key : keys)
+    key = static_cast<double>(rng() % bounds.size()) + 0.5;
+  model.search_step = detail::time_per_operation(keys.size() * 12, [&] ()
+  {
+    size_t found = 0;
+    for (const double key : keys)
+      found += static_cast<size_t>(std::lower_bound(bounds.begin(), bounds.end(), key) - bounds.begin());
+    sink = static_cast<double>(found);
+  });
+
+  /*
+   * A direct index cell: scale, convert and load, chained through the load
+   */
+  std::vector<double> table(4096);
+  for (size_t i = 0; i < table.size(); ++i)
+    table[i] = static_cast<double>(rng() % table.size()) + 0.5;
+  model.index_lookup = detail::time_per_operation(operations, [&] ()
+  {
+    double y = seed;
+    for (size_t i = 0; i < operations; ++i)
+      y = table[static_cast<size_t>((y - 0.25) * 1.0) & (table.size() - 1)];
+    sink = y;
+  });
+
+  /*
+   * Loads that miss: a random cycle through a buffer several times the
+   * cache size
+   */
+  std::vector<uint32_t> next(static_cast<size_t>(8 * model.cache_bytes / sizeof(uint32_t)));
+  std::vector<uint32_t> order(next.size());
+  std::iota(order.begin(), order.end(), 0u);
+  std::shuffle(order.begin(), order.end(), rng);
+  for (size_t i = 0; i < order.size(); ++i)
+    next[order[i]] = order[(i + 1) % order.size()];
+  model.cache_miss = detail::time_per_operation(operations / 4, [&] ()
+  {
+    uint32_t at = 0;
+    for (size_t i = 0; i < operations / 4; ++i)
+      at = next[at];
+    sink = at;
+  });
+
+  /*
+   * A one-piece constant equation: everything but the search, whose single
+   * level is always predicted
+   */
+  const JSONEquation constant(nlohmann::json::parse(R"({"pieces": [{"lower_bound": 0, "upper_bound": 1,
+      "numerator": {"powers": [0], "coefficients": [0.5]}}]})"));
+  const KernelEquation kernels(constant);
+  model.kernel_call = detail::time_per_operation(operations, [&] ()
+  {
+    double y = seed;
+    for (size_t i = 0; i < operations; ++i)
+      y = *kernels.calculate(y);
+    sink = y;
+  });
+
+  for (double* cost : {&model.sqrt, &model.cbrt, &model.pow})
+    *cost = std::max(*cost, 0.0);
+  return model;
+}
+
+/**
+ * Gather the statistics the planner works from.
+ */
+inline EquationStatistics equation_statistics (const JSONEquation& equation)
+{
+  EquationStatistics statistics;
+  statistics.pieces = equation.pieces.size();
+  if (equation.pieces.empty())
+    return statistics;
+
+  statistics.domain_lb = equation.pieces.begin()->first.lb;
+  statistics.domain_ub = equation.pieces.rbegin()->first.ub;
+  double width_sum = 0;
+  double width_square_sum = 0;
+  for (const auto& piece : equation.pieces)
+  {
+    const double width = piece.first.ub - piece.first.lb;
+    width_sum += width;
+    width_square_sum += width * width;
+  }
+  const double n = static_cast<double>(statistics.pieces);
+  statistics.mean_width = width_sum / n;
+  const double variance = std::max(0.0, width_square_sum / n - statistics.mean_width * statistics.mean_width);
+  statistics.width_variation = statistics.mean_width > 0 ? std::sqrt(variance) / statistics.mean_width : 0;
+  const double domain = statistics.domain_ub - statistics.domain_lb;
+  statistics.gap_fraction = domain > 0 ? std::max(0.0, 1 - width_sum / domain) : 0;
+
+  const KernelEquation kernels(equation);
+  size_t idx = 0;
+  for (const auto& piece : equation.pieces)
+  {
+    ++statistics.kernels[static_cast<size_t>(kernels.kernel(idx++))];
+    if (piece.second.pole_status() != PoleStatus::pole_free)
+      ++statistics.unproven_denominators;
+    for (const auto* terms : {&piece.second.numerator, &piece.second.denominator})
+    {
+      for (const auto& term : *terms)
+      {
+        statistics.max_power = std::max(statistics.max_power, std::fabs(term.power));
+        const detail::PowerKind kind = detail::plan_term(term.power).kind;
+        if (kind == detail::PowerKind::integer)
+          ++statistics.integer_terms;
+        else if (kind == detail::PowerKind::general)
+          ++statistics.real_terms;
+        else
+          ++statistics.root_terms;
+        if (term.power < 0)
+          ++statistics.negative_terms;
+      }
+    }
+  }
+  return statistics;
+}
+
+/**
+ * Choose the cheapest lookup, and for every piece the cheaper of its own
+ * kernel and the general one, by the estimates of a cost model.
+ * @param equation Loaded equation
+ * @param model Costs, e.g. CostModel::calibrate()
+ */
+inline EvaluationPlan plan_equation (const JSONEquation& equation, const CostModel& model = CostModel())
+{
+  using Kernel = KernelEquation::Kernel;
+  EvaluationPlan plan;
+  plan.statistics = equation_statistics(equation);
+  plan.model = model;
+
+  plan.binary_search_ns = detail::binary_search_cost(equation.pieces.size(), model);
+  plan.direct_index_ns = detail::direct_index_cost(equation, model);
+  plan.layout.lookup = plan.direct_index_ns < plan.binary_search_ns ?
+                       KernelEquation::Lookup::direct_index : KernelEquation::Lookup::binary_search;
+
+  const KernelEquation kernels(equation);
+  size_t idx = 0;
+  double kernel_sum = 0;
+  for (const auto& piece : equation.pieces)
+  {
+    const Kernel own = kernels.kernel(idx++);
+    const double own_ns = detail::kernel_cost(own, piece.second, model);
+    const double general_ns = detail::general_cost(piece.second, model);
+    const bool general = general_ns < own_ns;
+    plan.layout.kernels.push_back(general ? Kernel::general : own);
+    plan.kernel_ns.push_back(general ? general_ns : own_ns);
+    kernel_sum += plan.kernel_ns.back();
+  }
+
+  plan.predicted_ns = std::min(plan.binary_search_ns, plan.direct_index_ns)
+                      + (equation.pieces.empty() ? 0 : kernel_sum / static_cast<double>(equation.pieces.size()));
+  return plan;
+}
+
+/**
+ * @return A plan as JSON, for inspection and to be edited and read back by
+ * layout_from_json(). Infinite estimates are written as null.
+ */
+inline nlohmann::json plan_json (const EvaluationPlan& plan)
+{
+  const auto number = [] (const double value) -> nlohmann::json
+  {
+    return std::isfinite(value) ? nlohmann::json(value) : nlohmann::json(nullptr);
+  };
+
+  const EquationStatistics& statistics = plan.statistics;
+  nlohmann::json kernel_counts = nlohmann::json::object();
+  for (size_t kernel = 0; kernel < statistics.kernels.size(); ++kernel)
+    kernel_counts[KernelEquation::kernel_name(static_cast<KernelEquation::Kernel>(kernel))] = statistics.kernels[kernel];
+
+  nlohmann::json kernels = nlohmann::json::array();
+  for (const auto kernel : plan.layout.kernels)
+    kernels.push_back(KernelEquation::kernel_name(kernel));
+
+  const CostModel& model = plan.model;
+  return {
+      {"lookup", KernelEquation::lookup_name(plan.layout.lookup)},
+      {"kernels", kernels},
+      {"predicted_ns", plan.predicted_ns},
+      {"lookup_ns", {{"binary_search", number(plan.binary_search_ns)},
+                     {"direct_index", number(plan.direct_index_ns)}}},
+      {"kernel_ns", plan.kernel_ns},
+      {"statistics", {{"pieces", statistics.pieces}, {"domain_lb", number(statistics.domain_lb)},
+                      {"domain_ub", number(statistics.domain_ub)}, {"mean_width", number(statistics.mean_width)},
+                      {"width_variation", number(statistics.width_variation)},
+                      {"gap_fraction", statistics.gap_fraction}, {"kernels", kernel_counts},
+                      {"max_power", statistics.max_power}, {"integer_terms", statistics.integer_terms},
+                      {"root_terms", statistics.root_terms}, {"real_terms", statistics.real_terms},
+                      {"negative_terms", statistics.negative_terms},
+                      {"unproven_denominators", statistics.unproven_denominators}}},
+      {"cost_model", {{"search_step", model.search_step}, {"cache_miss", model.cache_miss},
+                      {"cache_bytes", model.cache_bytes}, {"index_lookup", model.index_lookup},
+                      {"kernel_call", model.kernel_call}, {"multiply_add", model.multiply_add},
+                      {"divide", model.divide}, {"sqrt", model.sqrt}, {"cbrt", model.cbrt}, {"pow", model.pow}}}};
+}
+
+/**
+ * Read the layout of a plan written by plan_json(), possibly edited. Only
+ * "lookup" and "kernels" are read; "kernels" may be omitted to give every
+ * piece its own kernel.
+ * @throws invalid_argument If a lookup or kernel name is unknown
+ */
+inline KernelEquation::Layout layout_from_json (const nlohmann::json& plan)
+{
+  KernelEquation::Layout layout;
+  const std::string lookup = plan.at("lookup").get<std::string>();
+  if (lookup == KernelEquation::lookup_name(KernelEquation::Lookup::direct_index))
+    layout.lookup = KernelEquation::Lookup::direct_index;
+  else if (lookup != KernelEquation::lookup_name(KernelEquation::Lookup::binary_search))
+    throw std::invalid_argument("Unknown lookup \"" + lookup + "\" in plan.");
+
+  if (!plan.contains("kernels"))
+    return layout;
+  for (const auto& name : plan.at("kernels"))
+  {
+    size_t kernel = 0;
+    while (kernel <= static_cast<size_t>(KernelEquation::Kernel::general)
+           && name.get<std::string>() != KernelEquation::kernel_name(static_cast<KernelEquation::Kernel>(kernel)))
+      ++kernel;
+    if (kernel > static_cast<size_t>(KernelEquation::Kernel::general))
+      throw std::invalid_argument("Unknown kernel \"" + name.get<std::string>() + "\" in plan.");
+    layout.kernels.push_back(static_cast<KernelEquation::Kernel>(kernel));
+  }
+  return layout;
+}
+
+} /* namespace json_equation */
+
+#endif //EVALUATION_PLANNER_HPP
@@ -0,0 +1,388 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * FixedPointEquation compiles a JSONEquation into a Q-format fixed-point
+ * representation that is evaluated with integer multiply-add and shift only.
+ * It is meant for real-time threads where floating point is unavailable and
+ * results must match bit for bit across machines.
+ */
+
+#ifndef FIXED_POINT_EQUATION_HPP
+#define FIXED_POINT_EQUATION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "json_equation_core.hpp"
+
+namespace json_equation {
+
+/**
+ * Worst quantization error found for one piece of a FixedPointEquation.
+ */
+struct FixedPointPieceError
+{
+  double max_abs_error = 0;
+  double worst_input = 0;
+};
+
+/**
+ * Quantization error of a FixedPointEquation against the double evaluation of
+ * the equation it was compiled from, measured at the same (representable)
+ * inputs, so input quantization is not counted.
+ */
+struct FixedPointReport
+{
+  int input_fraction_bits = 0;
+  int output_fraction_bits = 0;
+  double max_abs_error = 0;
+  double worst_input = 0;
+  std::vector<FixedPointPieceError> pieces;
+};
+
+/**
+ * FixedPointEquation is a fixed-point compilation of a JSONEquation.
+ *
+ * Inputs and outputs are int64_t values in Q formats chosen for the whole
+ * equation: a real value v is represented as round(v * 2^fraction_bits).
+ * Inside each piece, the polynomial is evaluated in Horner form, where every
+ * Horner stage gets its own scaling chosen from a bound on that stage's
+ * magnitude over the piece's range, keeping about 30 significant bits per
+ * stage and every product within 62 bits.
+ *
+ * The output format is shared by all pieces, so pieces whose outputs are
+ * much smaller than the largest piece's get correspondingly fewer bits.
+ *
+ * Only pieces that reduce to a polynomial can be compiled: the numerator
+ * must have non-negative integer powers and the denominator must be a
+ * nonzero constant (or the numerator must be zero). Anything else throws a
+ * runtime_error naming the piece.
+ */
+class FixedPointEquation
+{
+public:
+  FixedPointEquation () = default;
+
+  /**
+   * Compile an equation into fixed point.
+   * @param equation Loaded equation
+   * @throws runtime_error If a piece cannot be represented in fixed point
+   */
+  explicit FixedPointEquation (const JSONEquation& equation)
+  {
+    /*
+     * Inputs share one format, sized for the largest bound
+     */
+    double max_input = 0;
+    for (const auto& piece : equation.pieces)
+      max_input = std::max({max_input, std::fabs(piece.first.lb), std::fabs(piece.first.ub)});
+    input_bits = fraction_bits_for(max_input);
+
+    std::vector<std::vector<double> > polynomials;
+    std::vector<double> output_bounds;
+    size_t idx = 0;
+    for (const auto& piece : equation.pieces)
+    {
+      polynomials.push_back(to_polynomial(piece.second, idx++));
+      output_bounds.push_back(stage_bound(polynomials.back(), 0, range_magnitude(piece.first)));
+    }
+
+    output_bits = output_bounds.empty() ?
+                  magnitude_bits : fraction_bits_for(*std::max_element(output_bounds.begin(), output_bounds.end()));
+
+    idx = 0;
+    for (const auto& piece : equation.pieces)
+    {
+      lower_bounds.push_back(to_fixed(piece.first.lb, input_bits));
+      upper_bounds.push_back(to_fixed(piece.first.ub, input_bits));
+      lb_inclusive.push_back(piece.first.lb_inclusive);
+      ub_inclusive.push_back(piece.first.ub_inclusive);
+      compile_piece(polynomials[idx++], range_magnitude(piece.first));
+    }
+  }
+
+  /**
+   * Calculate the output of the system given a fixed-point input. Uses only
+   * integer operations.
+   * @param x Input in Q format with input_fraction_bits() fraction bits
+   * @return nullopt if x not included in any pieces' range. Else, the output
+   * in Q format with output_fraction_bits() fraction bits
+   */
+  std::optional<int64_t> calculate (const int64_t x) const
+  {
+    const size_t idx = find_piece(x);
+    if (idx == npos)
+      return std::nullopt;
+
+    const Stage* stage = stages.data() + entry_points[idx];
+    const Stage* const last = stages.data() + entry_points[idx + 1];
+    int64_t acc = stage->coefficient;
+    for (++stage; stage != last; ++stage)
+      acc = shift(acc * x, stage->shift) + stage->coefficient;
+    return shift(acc, output_shifts[idx]);
+  }
+
+  std::optional<int64_t> operator() (const int64_t x) const
+  {
+    return calculate(x);
+  }
+
+  int input_fraction_bits () const
+  {
+    return input_bits;
+  }
+
+  int output_fraction_bits () const
+  {
+    return output_bits;
+  }
+
+  /**
+   * Convert a real input to this equation's input format.
+   */
+  int64_t input_to_fixed (const double x) const
+  {
+    return to_fixed(x, input_bits);
+  }
+
+  /**
+   * Convert an output of calculate() back to a real value.
+   */
+  double output_to_double (const int64_t y) const
+  {
+    return std::ldexp(static_cast<double>(y), -output_bits);
+  }
+
+  /**
+   * @return Memory held by this equation: bound arrays as index, Horner
+   * stages as polynomials, and entry points and output shifts as metadata
+   */
+  MemoryUsage memory_usage () const
+  {
+    MemoryUsage usage;
+    usage.metadata += sizeof(*this);
+    detail::count_vector(usage, usage.index, lower_bounds);
+    detail::count_vector(usage, usage.index, upper_bounds);
+    detail::count_vector(usage, usage.index, lb_inclusive);
+    detail::count_vector(usage, usage.index, ub_inclusive);
+    detail::count_vector(usage, usage.polynomials, stages);
+    detail::count_vector(usage, usage.metadata, entry_points);
+    detail::count_vector(usage, usage.metadata, output_shifts);
+    return usage;
+  }
+
+  /**
+   * Measure the worst quantization error of every piece against the double
+   * evaluation of the equation this was compiled from, by sampling each
+   * piece's range at evenly spaced representable inputs (and its bounds).
+   * @param reference The equation this was compiled from
+   * @param samples_per_piece Number of evenly spaced samples in each piece
+   */
+  FixedPointReport quantization_report (const JSONEquation& reference,
+                                        const size_t samples_per_piece = 4096) const
+  {
+    FixedPointReport report;
+    report.input_fraction_bits = input_bits;
+    report.output_fraction_bits = output_bits;
+
+    size_t idx = 0;
+    for (const auto& piece : reference.pieces)
+    {
+      FixedPointPieceError error;
+      const int64_t lo = lower_bounds[idx];
+      const int64_t hi = upper_bounds[idx];
+      const size_t samples = std::max<size_t>(samples_per_piece, 2);
+      for (size_t i = 0; i < samples; ++i)
+      {
+        const int64_t x = lo + static_cast<int64_t>(
+            static_cast<double>(hi - lo) * static_cast<double>(i) / static_cast<double>(samples - 1));
+        if ((x == lo && !lb_inclusive[idx]) || (x == hi && !ub_inclusive[idx]))
+          continue;
+        const auto fixed = calculate(x);
+        if (!fixed.has_value())
+          continue;
+
+        const double real_x = std::ldexp(static_cast<double>(x), -input_bits);
+        const double abs_error = std::fabs(output_to_double(fixed.value())
+                                           - piece.second.calculate(real_x));
+        if (abs_error > error.max_abs_error)
+        {
+          error.max_abs_error = abs_error;
+          error.worst_input = real_x;
+        }
+      }
+
+      if (error.max_abs_error > report.max_abs_error)
+      {
+        report.max_abs_error = error.max_abs_error;
+        report.worst_input = error.worst_input;
+      }
+      report.pieces.push_back(error);
+      ++idx;
+    }
+    return report;
+  }
+
+private:
+  static constexpr size_t npos = detail::no_piece;
+
+  /*
+   * Magnitudes of inputs and of every Horner stage are scaled to stay below
+   * 2^30, so a stage times an input stays below 2^60 and sums never overflow.
+   */
+  static constexpr int magnitude_bits = 30;
+
+  /**
+   * One Horner stage: acc = shift(acc * x, shift) + coefficient. The first
+   * stage of a piece only loads its coefficient.
+   */
+  struct Stage
+  {
+    int64_t coefficient;
+    int32_t shift;
+  };
+
+  int input_bits = 0;
+  int output_bits = 0;
+
+  std::vector<int64_t> lower_bounds;
+  std::vector<int64_t> upper_bounds;
+  std::vector<bool> lb_inclusive;
+  std::vector<bool> ub_inclusive;
+
+  std::vector<uint32_t> entry_points{0};
+  std::vector<Stage> stages;
+  std::vector<int32_t> output_shifts;
+
+  /**
+   * Arithmetic shift right by s bits with rounding, or left by -s bits.
+   */
+  static int64_t shift (const int64_t value, const int32_t s)
+  {
+    if (s > 0)
+      return (value + (int64_t{1} << (s - 1))) >> s;
+    else if (s < 0)
+      return value * (int64_t{1} << -s);
+    return value;
+  }
+
+  static int fraction_bits_for (const double bound)
+  {
+    if (!(bound > 0))
+      return magnitude_bits;
+    int exponent = 0;
+    std::frexp(bound, &exponent);
+    /*
+     * Extra fraction bits for tiny values would only push shifts out of range
+     */
+    return std::min(magnitude_bits - exponent, 62 - magnitude_bits);
+  }
+
+  static int64_t to_fixed (const double value, const int bits)
+  {
+    return static_cast<int64_t>(std::llround(std::ldexp(value, bits)));
+  }
+
+  static double range_magnitude (const numeric_range::NumericRange<double>& range)
+  {
+    return std::max(std::fabs(range.lb), std::fabs(range.ub));
+  }
+
+  /**
+   * Bound on |sum_{j >= k} a_j x^(j - k)| for |x| <= magnitude, i.e. on the
+   * Horner stage that has folded in coefficients a_n down to a_k.
+   */
+  static double stage_bound (const std::vector<double>& a, const size_t k, const double magnitude)
+  {
+    double bound = 0;
+    for (size_t j = a.size(); j-- > k;)
+      bound = bound * magnitude + std::fabs(a[j]);
+    /*
+     * Leave room for the rounding of every earlier stage
+     */
+    return bound * (1 + 1e-6) + 1e-9;
+  }
+
+  /**
+   * Reduce a piece to dense polynomial coefficients a_0 .. a_n.
+   */
+  static std::vector<double> to_polynomial (const PolynomialEquation& function, const size_t idx)
+  {
+    const std::string error_prefix = "Piece at index " + std::to_string(idx) + " ";
+
+    bool zero_numerator = true;
+    for (const auto& term : function.numerator)
+      zero_numerator = zero_numerator && term.coefficient == 0;
+    if (zero_numerator)
+      return {0};
+
+    double denominator = 0;
+    for (const auto& term : function.denominator)
+    {
+      if (term.power != 0 && term.coefficient != 0)
+        throw std::runtime_error(error_prefix + "has a non-constant denominator and cannot be evaluated in fixed point.");
+      denominator += term.coefficient;
+    }
+    if (denominator == 0)
+      throw std::runtime_error(error_prefix + "divides by zero and cannot be evaluated in fixed point.");
+
+    std::map<long, double> coefficients;
+    for (const auto& term : function.numerator)
+    {
+      if (term.power < 0 || term.power > 64 || std::trunc(term.power) != term.power)
+        throw std::runtime_error(error_prefix + "has a power that is not a non-negative integer and cannot be evaluated in fixed point.");
+      coefficients[static_cast<long>(term.power)] += term.coefficient / denominator;
+    }
+
+    std::vector<double> a(static_cast<size_t>(coefficients.rbegin()->first) + 1, 0.0);
+    for (const auto& [power, coefficient] : coefficients)
+      a[static_cast<size_t>(power)] = coefficient;
+    return a;
+  }
+
+  void compile_piece (const std::vector<double>& a, const double magnitude)
+  {
+    const size_t degree = a.size() - 1;
+    int previous_bits = 0;
+    for (size_t k = degree + 1; k-- > 0;)
+    {
+      const int bits = fraction_bits_for(stage_bound(a, k, magnitude));
+      /*
+       * acc (previous_bits) * x (input_bits) is shifted down to this stage
+       */
+      const int32_t stage_shift = (k == degree) ? 0 : previous_bits + input_bits - bits;
+      stages.push_back({to_fixed(a[k], bits), checked_shift(stage_shift)});
+      previous_bits = bits;
+    }
+    entry_points.push_back(static_cast<uint32_t>(stages.size()));
+    output_shifts.push_back(checked_shift(previous_bits - output_bits));
+  }
+
+  int32_t checked_shift (const int32_t s) const
+  {
+    if (s > 62 || s < -62)
+    {
+      throw std::runtime_error("Piece at index " + std::to_string(output_shifts.size())
+                               + " has too wide a dynamic range to be evaluated in fixed point.");
+    }
+    return s;
+  }
+
+  size_t find_piece (const int64_t x) const
+  {
+    return detail::find_in_bounds(x, lower_bounds, upper_bounds, lb_inclusive, ub_inclusive, 0, upper_bounds.size());
+  }
+};
+
+} /* namespace json_equation */
+
+#endif //FIXED_POINT_EQUATION_HPP
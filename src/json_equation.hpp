@@ -8,6 +8,8 @@
  * of a system of piecewise polynomial equations (of a single variable) in JSON.
  * The JSON must follow a valid schema as defined in the library's
  * documentation.
+ * This header is the JSON loader; the evaluation core is json_equation_core.hpp,
+ * which it includes.
  * This library depends on:
  * - nlohmann::json <https://github.com/nlohmann/json> for JSON deserialization.
  * - numeric_range <https://github.com/amalbansode/numeric-range> for sorting,
@@ -17,330 +19,266 @@
 #ifndef JSON_EQUATION_HPP
 #define JSON_EQUATION_HPP
 
-#include <cmath>
+#include <cstddef>
+#include <exception>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 /*
- * Necessary dependencies for JSON deserialization and handling piece bounds,
- * respectively. Change these paths per your project structure if needed.
+ * Necessary dependency for JSON deserialization. Change this path per your
+ * project structure if needed.
  */
 #include "../include/json.hpp"
-#include "../include/numeric_range.hpp"
+#include "json_equation_core.hpp"
 
 namespace json_equation {
 
-/**
- * Monomial represents the power that a single variable may be raised to
- * and the coefficient this result is multiplied with. That is, given the
- * variable x, this represents c * (x)^p.
- */
-struct Monomial
+template<typename T>
+BasicJSONEquation<T>::BasicJSONEquation (std::istream& is) : BasicJSONEquation()
 {
-  double power = 0;
-  double coefficient = 1;
-};
-
-/**
- * PolynomialEquation represents an m-degree polynomial as the numerator
- * and an n-degree polynomial as the denominator. Both the numerator
- * and denominator are expressions involving the same single variable.
- */
-class PolynomialEquation
+  detail::LoadProfiler profiler(nullptr);
+  nlohmann::json json_obj;
+  is >> json_obj;
+  build_equation(json_obj, profiler);
+}
+
+template<typename T>
+BasicJSONEquation<T>::BasicJSONEquation (const nlohmann::json& json_in) : BasicJSONEquation()
 {
-public:
-  /**
-   * The numerator and denominator are simply lists of monomials (of the same
-   * single variable) that are individually evaluated and then arithmetically
-   * added to obtain a result when given an input value.
-   */
-  std::vector<Monomial> numerator;
-  std::vector<Monomial> denominator;
-
-  /**
-   * The numerator and denominator are default-constructed to 1.
-   */
-  PolynomialEquation() : numerator({{0,1}}), denominator({{0,1}}) {}
+  detail::LoadProfiler profiler(nullptr);
+  build_equation(json_in, profiler);
+}
 
-  /**
-   * Calculate the result of this polynomial expression given the input value x
-   * @param x Input to the expression
-   * @return Result of computing f(x)
+template<typename T>
+BasicJSONEquation<T>::BasicJSONEquation (std::istream& is, LoadReport& report) : BasicJSONEquation()
+{
+  /*
+   * Ask the stream buffer directly: tellg() fails once the parser has hit
+   * the end of the stream
    */
-  double calculate (const double x) const
+  const auto position = [&is] ()
   {
-    double numerator_val = 0.0;
-    double denominator_val = 0.0;
-
-    for (const auto & i : numerator)
-      numerator_val += i.coefficient * std::pow(x, i.power);
-
-    for (const auto & i : denominator)
-      denominator_val += i.coefficient * std::pow(x, i.power);
-
-    if (numerator_val == 0 && denominator_val == 0)
-      return 0;
-    else if (numerator_val != 0 && denominator_val == 0)
-      return std::numeric_limits<double>::infinity();
+    return is.rdbuf() ? is.rdbuf()->pubseekoff(0, std::ios_base::cur, std::ios_base::in)
+                      : std::streampos(std::streamoff(-1));
+  };
+  const std::streampos start = position();
+
+  detail::LoadProfiler profiler(&report, LoadPhase::tokenize);
+  nlohmann::json json_obj;
+  is >> json_obj;
+
+  const std::streampos end = position();
+  if (start != std::streampos(std::streamoff(-1)) && end != std::streampos(std::streamoff(-1)))
+    report.bytes_read = static_cast<uint64_t>(end - start);
+  build_equation(json_obj, profiler);
+}
+
+template<typename T>
+BasicJSONEquation<T>::BasicJSONEquation (const nlohmann::json& json_in, LoadReport& report) : BasicJSONEquation()
+{
+  detail::LoadProfiler profiler(&report, LoadPhase::dom_walk);
+  build_equation(json_in, profiler);
+}
 
-    return numerator_val / denominator_val;
+template<typename T>
+void BasicJSONEquation<T>::build_equation (const nlohmann::json& eq_in, detail::LoadProfiler& profiler)
+{
+  profiler.enter(LoadPhase::dom_walk);
+  pieces.clear();
+  const auto pieces_in = eq_in.find("pieces");
+  if (pieces_in != eq_in.end())
+  {
+    const auto& pieces_list_in = pieces_in.value();
+    for (size_t i = 0; i < pieces_list_in.size(); ++i)
+    {
+      try
+      {
+        build_and_add_piece(pieces_list_in[i], i, profiler);
+      }
+      catch (const std::exception& e)
+      {
+        throw std::runtime_error("Error building JSONEquation: " + std::string(e.what()));
+      }
+    }
   }
-
-  /**
-   * Calculate the result of this polynomial expression given the input value x.
-   * Shorthand operator provided for convenience.
-   * @param x Input to the expression
-   * @return Result of computing f(x)
-   */
-  inline double operator() (const double x) const
+  else
   {
-    return calculate(x);
+    throw std::runtime_error("JSON object does not contain \"pieces\" key needed for building JSONEquation.");
   }
-};
 
-/**
- * JSONEquation represents a system of piecewise polynomial equations
- * constructed using a JSON input.
- */
-class JSONEquation
+  number_pieces();
+  profiler.finish();
+  if (LoadReport* const report = profiler.get())
+    report->pieces = pieces.size();
+}
+
+template<typename T>
+void BasicJSONEquation<T>::build_and_add_piece (const nlohmann::json& piece_in, const size_t idx,
+                                                detail::LoadProfiler& profiler)
 {
-public:
-  /**
-   * The "secret sauce" of this representation is a numeric range mapped
-   * to a polynomial equation.
+  T lb = 0;
+  T ub = 0;
+  bool lb_inclusive = false;
+  bool ub_inclusive = false;
+
+  /*
+   * Construct the error string prefix beforehand for convenience
+   */
+  profiler.enter(LoadPhase::error_context);
+  const std::string idx_str = std::to_string(idx);
+  const std::string error_prefix = "Piece at index " + idx_str + " ";
+
+  /*
+   * The Lower Bound and Upper Bound attributes must be specified in JSON.
+   * Lookups and conversions are profiled as separate phases. The bounds are
+   * converted and checked before the polynomials' arrays are looked up, so
+   * that a piece with bad bounds reports them first.
    */
-  std::map<numeric_range::NumericRange<double>, PolynomialEquation,
-  numeric_range::NumericRangeComparator<double> > pieces;
+  profiler.enter(LoadPhase::dom_walk);
+  const auto lb_in = piece_in.find("lower_bound");
+  if (lb_in == piece_in.end())
+    throw std::runtime_error(error_prefix + "does not specify lower_bound.");
 
-  JSONEquation () = default;
+  const auto ub_in = piece_in.find("upper_bound");
+  if (ub_in == piece_in.end())
+    throw std::runtime_error(error_prefix + "does not specify upper_bound.");
 
-  /**
-   * Construct JSONEquation from an istream containing JSON data.
-   * @param is istream corresponding to JSON needed to build a JSONEquation
-   * object. This is expected to follow the schema laid out in documentation.
-   */
-  explicit JSONEquation (std::istream& is) : JSONEquation()
-  {
-    nlohmann::json json_obj;
-    is >> json_obj;
-    build_equation(json_obj);
-  }
+  const auto lb_inclusive_in = piece_in.find("lb_inclusive");
+  const auto ub_inclusive_in = piece_in.find("ub_inclusive");
+
+  profiler.enter(LoadPhase::numeric_conversion);
+  lb = lb_in.value();
+  ub = ub_in.value();
 
-  /**
-   * Construct JSONEquation from an nlohmann::json object containing JSON data.
-   * @param json_in JSON needed to build a JSONEquation object. This is
-   * expected to follow the schema laid out in documentation.
+  /*
+   * Get the inclusive/exclusive attribute for lower and upper bounds.
+   * If unspecified, the default is "true".
+   */
+  if (lb_inclusive_in != piece_in.end())
+    lb_inclusive = lb_inclusive_in.value();
+  else
+    lb_inclusive = true;
+
+  if (ub_inclusive_in != piece_in.end())
+    ub_inclusive = ub_inclusive_in.value();
+  else
+    ub_inclusive = true;
+
+  numeric_range::NumericRange<T> bounds{lb, lb_inclusive, ub, ub_inclusive};
+
+  /*
+   * Get the numerator and denominator attributes.
+   * If numerator AND denominator absent, both are set to "0".
+   * If numerator XOR denominator absent, the default is "1" for the absent element.
+   */
+  profiler.enter(LoadPhase::dom_walk);
+  const auto numerator_in = piece_in.find("numerator");
+  const auto denominator_in = piece_in.find("denominator");
+  bool numerator_present = numerator_in != piece_in.end();
+  bool denominator_present = denominator_in != piece_in.end();
+
+  /*
+   * In JSON, these are "parallel arrays". However, in code and memory
+   * corresponding elements are serialized to PolyTerm objects
+   * inside the PolynomialEquation object
    */
-  explicit JSONEquation (const nlohmann::json& json_in) : JSONEquation()
+  const nlohmann::json* numerator_powers_in = nullptr;
+  const nlohmann::json* numerator_coeffs_in = nullptr;
+  if (numerator_present)
   {
-    build_equation(json_in);
+    numerator_powers_in = &numerator_in->at("powers");
+    numerator_coeffs_in = &numerator_in->at("coefficients");
   }
 
-  JSONEquation (JSONEquation& other) : JSONEquation()
+  const nlohmann::json* denominator_powers_in = nullptr;
+  const nlohmann::json* denominator_coeffs_in = nullptr;
+  if (denominator_present)
   {
-    pieces = other.pieces;
+    denominator_powers_in = &denominator_in->at("powers");
+    denominator_coeffs_in = &denominator_in->at("coefficients");
   }
 
-  JSONEquation& operator= (JSONEquation other)
-  {
-    JSONEquation temp(other);
-    swap(temp, *this);
-    return *this;
-  }
+  profiler.enter(LoadPhase::numeric_conversion);
+  BasicPolynomialEquation<T> function;
 
-  /**
-   * Swap two systems (i.e. their pieces) in memory
-   * @param first
-   * @param second
+  /*
+   * If neither numerator nor denominator present, set function to return 0
    */
-  friend void swap (JSONEquation& first, JSONEquation& second)
+  if (!numerator_present && !denominator_present)
   {
-    std::swap(first.pieces, second.pieces);
+    function.numerator = {{0, 0}};
+    function.denominator = {{0, 0}};
   }
 
-  ~JSONEquation () = default;
-
-  /**
-   * Calculate the output of the polynomial system given input x. If x is not
-   * included in the range for any piece, std::nullopt is returned instead and
-   * it is up to the caller to determine the course of action.
-   * @param x Input to the system of equations
-   * @return nullopt if x not included in any pieces' range.Else, double val
-   */
-  std::optional<double> calculate (const double x)
+  if (numerator_present)
   {
-    const auto found_piece = pieces.find(numeric_range::NumericRange<double>{x});
-    if (found_piece != pieces.end())
-      return found_piece->second.calculate(x);
-    else
-      return std::nullopt;
-  }
+    function.numerator.clear();
 
-  /**
-   * Calculate the output of the polynomial system given input x. If x is not
-   * included in the range for any piece, std::nullopt is returned instead and
-   * it is up to the caller to determine the course of action.
-   * Shorthand operator provided for convenience.
-   * @param x Input to the system of equations
-   * @return nullopt if x not included in any pieces' range.Else, double val
-   */
-  std::optional<double> operator() (const double x)
-  {
-    const auto found_piece = pieces.find(numeric_range::NumericRange<double>{x});
-    if (found_piece != pieces.end())
-      return found_piece->second.calculate(x);
-    else
-      return std::nullopt;
-  }
+    const auto numerator_powers = numerator_powers_in->get<std::vector<T> >();
+    const auto numerator_coeffs = numerator_coeffs_in->get<std::vector<T> >();
 
-private:
-  /**
-   * Build the system of equations from JSON input. Input is expected to follow
-   * the schema laid out by the library. Missing attributes are handled as
-   * specified in documentation.
-   * @param eq_in JSON representing a system of piecewise polynomial equations
-   */
-  void build_equation (const nlohmann::json& eq_in)
-  {
-    pieces.clear();
-    const auto pieces_in = eq_in.find("pieces");
-    if (pieces_in != eq_in.end())
-    {
-      const auto pieces_list_in = pieces_in.value();
-      for (size_t i = 0; i < pieces_list_in.size(); ++i)
-      {
-        try
-        {
-          build_and_add_piece(pieces_list_in[i], i);
-        }
-        catch (const std::exception& e)
-        {
-          throw std::runtime_error("Error building JSONEquation: " + std::string(e.what()));
-        }
-      }
-    }
-    else
-    {
-      throw std::runtime_error("JSON object does not contain \"pieces\" key needed for building JSONEquation.");
-    }
+    if (numerator_powers.size() != numerator_coeffs.size())
+      throw std::runtime_error(error_prefix + "numerator cannot have len(powers) != len(coefficients)");
+
+    for (size_t i = 0; i < numerator_powers.size(); ++i)
+      function.numerator.push_back({numerator_powers[i], numerator_coeffs[i]});
   }
 
-  /**
-   * Perform error-checking on a given piece and add it to the current system
-   * if it is valid.
-   * @param piece_in JSON corresponding to "piece" in a piecewise equation
-   * @param idx Index of this piece in the pieces list used for error messages
-   */
-  void build_and_add_piece (const nlohmann::json& piece_in, const size_t idx)
+  if (denominator_present)
   {
-    double lb = 0;
-    double ub = 0;
-    bool lb_inclusive = false;
-    bool ub_inclusive = false;
-
-    /*
-     * Construct the error string prefix beforehand for convenience
-     */
-    const std::string idx_str = std::to_string(idx);
-    const std::string error_prefix = "Piece at index " + idx_str + " ";
-
-    /*
-     * The Lower Bound and Upper Bound attributes must be specified in JSON
-     */
-    if (piece_in.find("lower_bound") != piece_in.end())
-      lb = piece_in.find("lower_bound").value();
-    else
-      throw std::runtime_error(error_prefix + "does not specify lower_bound.");
-
-    if (piece_in.find("upper_bound") != piece_in.end())
-      ub = piece_in.find("upper_bound").value();
-    else
-      throw std::runtime_error(error_prefix + "does not specify upper_bound.");
-
-    /*
-     * Get the inclusive/exclusive attribute for lower and upper bounds.
-     * If unspecified, the default is "true".
-     */
-    if (piece_in.find("lb_inclusive") != piece_in.end())
-      lb_inclusive = piece_in.find("lb_inclusive").value();
-    else
-      lb_inclusive = true;
-
-    if (piece_in.find("ub_inclusive") != piece_in.end())
-      ub_inclusive = piece_in.find("ub_inclusive").value();
-    else
-      ub_inclusive = true;
-
-    numeric_range::NumericRange<double> bounds{lb, lb_inclusive, ub, ub_inclusive};
-
-    /*
-     * Get the numerator and denominator attributes.
-     * If numerator AND denominator absent, both are set to "0".
-     * If numerator XOR denominator absent, the default is "1" for the absent element.
-     */
-    bool numerator_present = piece_in.find("numerator") != piece_in.end();
-    bool denominator_present = piece_in.find("denominator") != piece_in.end();
-
-    PolynomialEquation function;
-
-    /*
-     * If neither numerator nor denominator present, set function to return 0
-     */
-    if (!numerator_present && !denominator_present)
-    {
-      function.numerator = {{0, 0}};
-      function.denominator = {{0, 0}};
-    }
-
-    if (numerator_present)
-    {
-      function.numerator.clear();
-
-      /*
-       * In JSON, these are "parallel arrays". However, in code and memory
-       * corresponding elements are serialized to PolyTerm objects
-       * inside the PolynomialEquation object
-       */
-      const auto numerator_powers_in = piece_in.at("numerator").at("powers").get<std::vector<double> >();
-      const auto numerator_coeffs_in = piece_in.at("numerator").at("coefficients").get<std::vector<double> >();
+    function.denominator.clear();
 
-      if (numerator_powers_in.size() != numerator_coeffs_in.size())
-        throw std::runtime_error(error_prefix + "numerator cannot have len(powers) != len(coefficients)");
+    const auto denominator_powers = denominator_powers_in->get<std::vector<T> >();
+    const auto denominator_coeffs = denominator_coeffs_in->get<std::vector<T> >();
 
-      for (size_t i = 0; i < numerator_powers_in.size(); ++i)
-        function.numerator.push_back({numerator_powers_in[i], numerator_coeffs_in[i]});
-    }
+    if (denominator_powers.size() != denominator_coeffs.size())
+      throw std::runtime_error(error_prefix + "denominator cannot have len(powers) != len(coefficients)");
 
-    if (denominator_present)
-    {
-      function.denominator.clear();
+    for (size_t i = 0; i < denominator_powers.size(); ++i)
+      function.denominator.push_back({denominator_powers[i], denominator_coeffs[i]});
+  }
 
-      /*
-       * In JSON, these are "parallel arrays". However, in code and memory
-       * corresponding elements are serialized to PolyTerm objects
-       * inside the PolynomialEquation object
-       */
-      const auto denominator_powers_in = piece_in.at("denominator").at("powers").get<std::vector<double> >();
-      const auto denominator_coeffs_in = piece_in.at("denominator").at("coefficients").get<std::vector<double> >();
+  if (LoadReport* const report = profiler.get())
+    report->monomials += function.numerator.size() + function.denominator.size();
 
-      if (denominator_powers_in.size() != denominator_coeffs_in.size())
-        throw std::runtime_error(error_prefix + "denominator cannot have len(powers) != len(coefficients)");
+  profiler.enter(LoadPhase::analysis);
+  function.prepare(bounds);
 
-      for (size_t i = 0; i < denominator_powers_in.size(); ++i)
-        function.denominator.push_back({denominator_powers_in[i], denominator_coeffs_in[i]});
-    }
+  /*
+   * Try inserting this piece into the map. Throw on error.
+   */
+  profiler.enter(LoadPhase::map_insertion);
+  try
+  {
+    pieces.insert({bounds, function});
+  }
+  catch (const std::exception& e)
+  {
+    throw std::runtime_error(error_prefix + "could not be added to piecewise equation map. Map insert operation threw error: " + e.what());
+  }
+} /* void build_and_add_piece */
 
-    /*
-     * Try inserting this piece into the map. Throw on error.
-     */
-    try
-    {
-      pieces.insert({bounds, function});
-    }
-    catch (const std::exception& e)
-    {
-      throw std::runtime_error(error_prefix + "could not be added to piecewise equation map. Map insert operation threw error: " + e.what());
-    }
-  } /* void build_and_add_piece */
-};
+/*
+ * When linking the json_equation_loader library, which defines
+ * JSON_EQUATION_COMPILED_LOADER, the loader is instantiated once in that
+ * library instead of in every translation unit that includes this header.
+ */
+#ifdef JSON_EQUATION_COMPILED_LOADER
+extern template BasicJSONEquation<float>::BasicJSONEquation (std::istream&);
+extern template BasicJSONEquation<float>::BasicJSONEquation (const nlohmann::json&);
+extern template BasicJSONEquation<double>::BasicJSONEquation (std::istream&);
+extern template BasicJSONEquation<double>::BasicJSONEquation (const nlohmann::json&);
+extern template BasicJSONEquation<long double>::BasicJSONEquation (std::istream&);
+extern template BasicJSONEquation<long double>::BasicJSONEquation (const nlohmann::json&);
+extern template BasicJSONEquation<float>::BasicJSONEquation (std::istream&, LoadReport&);
+extern template BasicJSONEquation<float>::BasicJSONEquation (const nlohmann::json&, LoadReport&);
+extern template BasicJSONEquation<double>::BasicJSONEquation (std::istream&, LoadReport&);
+extern template BasicJSONEquation<double>::BasicJSONEquation (const nlohmann::json&, LoadReport&);
+extern template BasicJSONEquation<long double>::BasicJSONEquation (std::istream&, LoadReport&);
+extern template BasicJSONEquation<long double>::BasicJSONEquation (const nlohmann::json&, LoadReport&);
+#endif
 
 } /* namespace json_equation */
 
@@ -0,0 +1,143 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * json_equation_accuracy runs every evaluation mode of an equation over
+ * sample inputs and reports the speed and error of each against a long double
+ * reference, to decide which modes an equation may be evaluated with.
+ *
+ * Usage: json_equation_accuracy equation.json [--samples N] [--seed N]
+ *                               [--distribution uniform|per_piece|edges]
+ *                               [--inputs path] [--worst N] [--repeats N]
+ *                               [--format text|json]
+ *
+ * --inputs reads whitespace-separated inputs (e.g. recorded from production)
+ * instead of drawing samples.
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "accuracy_report.hpp"
+
+using namespace json_equation;
+
+namespace {
+
+struct CommandLine
+{
+  std::string equation_path;
+  std::string inputs_path;
+  std::string format = "text";
+  AccuracyOptions options;
+};
+
+uint64_t parse_unsigned (const std::string& option, const std::string& value)
+{
+  char* end = nullptr;
+  const uint64_t parsed = std::strtoull(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || value[0] == '-')
+    throw std::runtime_error("invalid count '" + value + "' for " + option);
+  return parsed;
+}
+
+void parse_options (const int argc, char** argv, CommandLine& command_line)
+{
+  if (argc < 2)
+    throw std::runtime_error("missing equation");
+  command_line.equation_path = argv[1];
+
+  AccuracyOptions& options = command_line.options;
+  for (int i = 2; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc)
+      throw std::runtime_error("missing value for " + arg);
+    const std::string value = argv[++i];
+
+    if (arg == "--samples")
+      options.samples = parse_unsigned(arg, value);
+    else if (arg == "--seed")
+      options.seed = parse_unsigned(arg, value);
+    else if (arg == "--distribution" && value == "uniform")
+      options.distribution = SampleDistribution::uniform;
+    else if (arg == "--distribution" && value == "per_piece")
+      options.distribution = SampleDistribution::per_piece;
+    else if (arg == "--distribution" && value == "edges")
+      options.distribution = SampleDistribution::edges;
+    else if (arg == "--inputs")
+      command_line.inputs_path = value;
+    else if (arg == "--worst")
+      options.worst_inputs = parse_unsigned(arg, value);
+    else if (arg == "--repeats")
+      options.repeats = parse_unsigned(arg, value);
+    else if (arg == "--format" && (value == "text" || value == "json"))
+      command_line.format = value;
+    else
+      throw std::runtime_error("unknown option " + arg + " " + value);
+  }
+}
+
+std::vector<double> read_inputs (const std::string& path)
+{
+  std::ifstream infile(path);
+  if (!infile)
+    throw std::runtime_error("could not open " + path);
+  std::vector<double> inputs;
+  double x = 0;
+  while (infile >> x)
+    inputs.push_back(x);
+  if (!infile.eof())
+    throw std::runtime_error("invalid input in " + path + " after " + std::to_string(inputs.size()) + " values");
+  return inputs;
+}
+
+} /* namespace */
+
+int main (int argc, char** argv)
+{
+  CommandLine command_line;
+  try
+  {
+    parse_options(argc, argv, command_line);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << argv[0] << ": " << e.what() << "\n"
+              << "Usage: " << argv[0]
+              << " equation.json [--samples N] [--seed N] [--distribution uniform|per_piece|edges]"
+                 " [--inputs path] [--worst N] [--repeats N] [--format text|json]"
+              << std::endl;
+    return 1;
+  }
+
+  try
+  {
+    std::ifstream infile(command_line.equation_path);
+    if (!infile)
+      throw std::runtime_error("could not open " + command_line.equation_path);
+    nlohmann::json json_in;
+    infile >> json_in;
+
+    const std::vector<double> inputs = command_line.inputs_path.empty() ?
+                                       accuracy_inputs(JSONEquation(json_in), command_line.options) :
+                                       read_inputs(command_line.inputs_path);
+    const AccuracyReport report = accuracy_report(json_in, inputs, command_line.options);
+    if (command_line.format == "json")
+      std::cout << accuracy_json(report).dump(2) << std::endl;
+    else
+      write_text(std::cout, report);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << argv[0] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,321 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * json_equation_codegen compiles an equation JSON file into a C++ header that
+ * evaluates the same piecewise equation without any runtime parsing or map
+ * lookup. Piece bounds become a binary tree of hard-coded comparisons, and
+ * polynomials with integer powers up to max_horner_power are unrolled in
+ * Horner form so the generated function can be constexpr.
+ *
+ * Usage: json_equation_codegen <input.json> <output.hpp> <function_name> [namespace]
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "json_equation.hpp"
+
+using namespace json_equation;
+
+namespace {
+
+using Piece = std::pair<numeric_range::NumericRange<double>, PolynomialEquation>;
+
+/**
+ * Format a double as an exact hexadecimal floating point literal.
+ */
+std::string literal (const double value)
+{
+  std::ostringstream os;
+  os << std::hexfloat << value;
+  return os.str();
+}
+
+/*
+ * Integer powers beyond this magnitude would unroll into too much source and
+ * are evaluated with std::pow instead, as in BytecodeEquation.
+ */
+constexpr double max_horner_power = 64;
+
+bool is_horner_power (const Monomial& term)
+{
+  return std::isfinite(term.power) && std::trunc(term.power) == term.power
+         && std::fabs(term.power) <= max_horner_power;
+}
+
+bool has_only_horner_powers (const std::vector<Monomial>& terms)
+{
+  return std::all_of(terms.begin(), terms.end(), is_horner_power);
+}
+
+/**
+ * Emit a Horner-form expression for the sum of coefficients[p] * v^p, for
+ * powers from lowest up, where v names x or its reciprocal r.
+ */
+std::string horner (const std::map<long, double>& coefficients, const std::string& v, const long lowest)
+{
+  const long highest = coefficients.rbegin()->first;
+
+  /*
+   * Innermost (highest power) first
+   */
+  std::string horner;
+  for (long power = highest; power >= lowest; --power)
+  {
+    const auto found = coefficients.find(power);
+    if (power == highest)
+      horner = literal(found->second);
+    else if (found == coefficients.end())
+      horner = v + " * (" + horner + ")";
+    else
+      horner = literal(found->second) + " + " + v + " * (" + horner + ")";
+  }
+
+  std::string scale;
+  for (long i = 0; i < lowest; ++i)
+    scale += v + " * ";
+  return scale + "(" + horner + ")";
+}
+
+/**
+ * Emit an expression for a sum of monomials with integer powers. Non-negative
+ * powers are evaluated in Horner form in x, and negative powers in Horner
+ * form in the reciprocal r = 1 / x. A single Horner polynomial scaled by r^m
+ * would overflow for large |x| where the sum does not.
+ */
+std::string integer_sum (const std::vector<Monomial>& terms)
+{
+  std::map<long, double> positive_powers;
+  std::map<long, double> negative_powers;
+  for (const auto& term : terms)
+  {
+    const long power = static_cast<long>(term.power);
+    if (power >= 0)
+      positive_powers[power] += term.coefficient;
+    else
+      negative_powers[-power] += term.coefficient;
+  }
+
+  std::vector<std::string> parts;
+  if (!positive_powers.empty())
+    parts.push_back(horner(positive_powers, "x", 0));
+  if (!negative_powers.empty())
+    parts.push_back(horner(negative_powers, "r", negative_powers.begin()->first));
+  return parts.size() == 1 ? parts[0] : "(" + parts[0] + " + " + parts[1] + ")";
+}
+
+/**
+ * Emit an expression for a sum of monomials with real powers using std::pow,
+ * matching PolynomialEquation's general evaluation.
+ */
+std::string real_sum (const std::vector<Monomial>& terms)
+{
+  std::string sum;
+  for (const auto& term : terms)
+  {
+    if (!sum.empty())
+      sum += " + ";
+    sum += literal(term.coefficient) + " * std::pow(x, " + literal(term.power) + ")";
+  }
+  return "(" + sum + ")";
+}
+
+std::string sum_expression (const std::vector<Monomial>& terms)
+{
+  std::vector<Monomial> horner_terms;
+  std::vector<Monomial> pow_terms;
+  for (const auto& term : terms)
+    (is_horner_power(term) ? horner_terms : pow_terms).push_back(term);
+
+  if (pow_terms.empty())
+    return horner_terms.empty() ? "0.0" : integer_sum(horner_terms);
+  if (horner_terms.empty())
+    return real_sum(pow_terms);
+  return "(" + integer_sum(horner_terms) + " + " + real_sum(pow_terms) + ")";
+}
+
+bool needs_reciprocal (const std::vector<Monomial>& terms)
+{
+  return std::any_of(terms.begin(), terms.end(), [] (const Monomial& term)
+  {
+    return is_horner_power(term) && term.power < 0;
+  });
+}
+
+bool reads_x (const std::vector<Monomial>& terms)
+{
+  return std::any_of(terms.begin(), terms.end(), [] (const Monomial& term)
+  {
+    return term.power != 0;
+  });
+}
+
+void emit_piece (std::ostream& os, const std::string& qualifier, const size_t idx,
+                 const Piece& piece)
+{
+  const PolynomialEquation& function = piece.second;
+  /*
+   * Constant pieces leave x unnamed, so code built with -Wextra does not warn
+   * about an unused parameter
+   */
+  const bool uses_x = reads_x(function.numerator) || reads_x(function.denominator);
+  os << qualifier << " double piece_" << idx << (uses_x ? " (const double x)\n" : " (const double)\n")
+     << "{\n";
+  if (needs_reciprocal(function.numerator) || needs_reciprocal(function.denominator))
+    os << "  const double r = 1.0 / x;\n";
+  os << "  const double numerator_val = " << sum_expression(function.numerator) << ";\n"
+     << "  const double denominator_val = " << sum_expression(function.denominator) << ";\n";
+
+  if (function.pole_status() != PoleStatus::pole_free)
+  {
+    os << "  if (numerator_val == 0 && denominator_val == 0)\n"
+       << "    return 0;\n"
+       << "  else if (numerator_val != 0 && denominator_val == 0)\n"
+       << "    return std::numeric_limits<double>::infinity();\n";
+  }
+  os << "  return numerator_val / denominator_val;\n"
+     << "}\n\n";
+}
+
+std::string below (const numeric_range::NumericRange<double>& range)
+{
+  return range.lb_inclusive ? "x < " + literal(range.lb) : "x <= " + literal(range.lb);
+}
+
+std::string above (const numeric_range::NumericRange<double>& range)
+{
+  return range.ub_inclusive ? "x > " + literal(range.ub) : "x >= " + literal(range.ub);
+}
+
+/**
+ * Emit a binary decision tree over the sorted pieces [lo, hi).
+ */
+void emit_tree (std::ostream& os, const std::vector<Piece>& pieces,
+                const size_t lo, const size_t hi, const std::string& indent)
+{
+  if (lo >= hi)
+  {
+    os << indent << "return std::nullopt;\n";
+    return;
+  }
+
+  const size_t mid = lo + (hi - lo) / 2;
+  os << indent << "if (" << below(pieces[mid].first) << ")\n"
+     << indent << "{\n";
+  emit_tree(os, pieces, lo, mid, indent + "  ");
+  os << indent << "}\n"
+     << indent << "else if (" << above(pieces[mid].first) << ")\n"
+     << indent << "{\n";
+  emit_tree(os, pieces, mid + 1, hi, indent + "  ");
+  os << indent << "}\n"
+     << indent << "return piece_" << mid << "(x);\n";
+}
+
+std::string guard_for (const std::string& path)
+{
+  std::string name = path.substr(path.find_last_of("/\\") + 1);
+  std::string guard;
+  for (const char c : name)
+    guard += std::isalnum(static_cast<unsigned char>(c)) ? static_cast<char>(std::toupper(c)) : '_';
+  return guard;
+}
+
+} /* namespace */
+
+int main (int argc, char** argv)
+{
+  if (argc < 4 || argc > 5)
+  {
+    std::cerr << "Usage: " << argv[0]
+              << " <input.json> <output.hpp> <function_name> [namespace]" << std::endl;
+    return 1;
+  }
+
+  const std::string input_path = argv[1];
+  const std::string output_path = argv[2];
+  const std::string function_name = argv[3];
+  const std::string ns = (argc == 5) ? argv[4] : "json_equation_generated";
+
+  std::vector<Piece> pieces;
+  try
+  {
+    std::ifstream infile(input_path);
+    if (!infile)
+      throw std::runtime_error("could not open " + input_path);
+    JSONEquation equation(infile);
+    pieces.assign(equation.pieces.begin(), equation.pieces.end());
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << argv[0] << ": " << e.what() << std::endl;
+    return 1;
+  }
+
+  /*
+   * std::pow is not constexpr, so only equations evaluated entirely in Horner
+   * form can be.
+   */
+  bool all_integer = true;
+  for (const auto& piece : pieces)
+  {
+    all_integer = all_integer && has_only_horner_powers(piece.second.numerator)
+                  && has_only_horner_powers(piece.second.denominator);
+  }
+  const std::string qualifier = all_integer ? "constexpr" : "inline";
+
+  std::ostringstream os;
+  const std::string guard = guard_for(output_path);
+  os << "/*\n"
+     << " * Generated by json_equation_codegen from "
+     << input_path.substr(input_path.find_last_of("/\\") + 1) << ". Do not edit.\n"
+     << " */\n\n"
+     << "#ifndef " << guard << "\n"
+     << "#define " << guard << "\n\n"
+     << "#include <cmath>\n"
+     << "#include <limits>\n"
+     << "#include <optional>\n\n"
+     << "namespace " << ns << " {\n\n"
+     << "namespace " << function_name << "_pieces {\n\n";
+
+  for (size_t i = 0; i < pieces.size(); ++i)
+    emit_piece(os, qualifier, i, pieces[i]);
+
+  os << "} /* namespace " << function_name << "_pieces */\n\n"
+     << "/**\n"
+     << " * Calculate the output of the piecewise equation given input x.\n"
+     << " * @param x Input to the system of equations\n"
+     << " * @return nullopt if x not included in any pieces' range. Else, double val\n"
+     << " */\n"
+     << qualifier << " std::optional<double> " << function_name << " (const double x)\n"
+     << "{\n"
+     << "  using namespace " << function_name << "_pieces;\n"
+     /*
+      * NaN fails every bound comparison, and would otherwise land in the
+      * middle piece of the tree
+      */
+     << "  if (x != x)\n"
+     << "    return std::nullopt;\n";
+  emit_tree(os, pieces, 0, pieces.size(), "  ");
+  os << "}\n\n"
+     << "} /* namespace " << ns << " */\n\n"
+     << "#endif //" << guard << "\n";
+
+  std::ofstream outfile(output_path);
+  outfile << os.str();
+  if (!outfile)
+  {
+    std::cerr << argv[0] << ": could not write " << output_path << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,1312 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * The evaluation core of json_equation: pieces, polynomials and lookup,
+ * without the JSON loader. Translation units that only evaluate equations
+ * should include this header instead of json_equation.hpp so that they do not
+ * parse nlohmann::json. Equations are still constructed from JSON through the
+ * loader, either header-only by including json_equation.hpp somewhere, or by
+ * linking the json_equation_loader library, which instantiates it for float,
+ * double and long double.
+ * This header depends on:
+ * - numeric_range <https://github.com/amalbansode/numeric-range> for sorting,
+ *   validating, and indexing by pieces' bounds.
+ * Define JSON_EQUATION_USAGE_COUNTERS (in every translation unit) to count
+ * lookups per piece; see usage_counters.hpp.
+ */
+
+#ifndef JSON_EQUATION_CORE_HPP
+#define JSON_EQUATION_CORE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+/*
+ * Forward declarations of nlohmann::json for the loader's constructors, and
+ * the dependency for handling piece bounds. Change these paths per your
+ * project structure if needed.
+ */
+#include "../include/json_fwd.hpp"
+#include "../include/numeric_range.hpp"
+
+#include "load_report.hpp"
+#include "memory_usage.hpp"
+#include "usage_counters.hpp"
+
+namespace json_equation {
+
+/**
+ * Monomial represents the power that a single variable may be raised to
+ * and the coefficient this result is multiplied with. That is, given the
+ * variable x, this represents c * (x)^p.
+ * @tparam T Scalar type used for storage and evaluation
+ */
+template<typename T>
+struct BasicMonomial
+{
+  T power = 0;
+  T coefficient = 1;
+};
+
+using Monomial = BasicMonomial<double>;
+
+/*
+ * Power classification and piece search shared by the evaluation engines.
+ * Not part of the public interface.
+ */
+namespace detail {
+
+/**
+ * Integer powers beyond this magnitude are not worth a ladder of
+ * multiplications and are left to std::pow.
+ */
+constexpr int32_t max_ladder_power = 32;
+
+enum class PowerKind : uint8_t
+{
+  integer,
+  half,
+  third,
+  general
+};
+
+/**
+ * How a single monomial's power is evaluated. For half and third powers,
+ * p = whole + root_power / 2 or p = whole + root_power / 3 respectively,
+ * where whole and root_power share the sign of p.
+ */
+struct TermPlan
+{
+  int32_t whole = 0;
+  PowerKind kind = PowerKind::general;
+  int8_t root_power = 0;
+};
+
+template<typename T>
+TermPlan plan_term (const T power)
+{
+  TermPlan plan;
+  /*
+   * Keep the integer part comfortably inside int32_t; anything larger is
+   * left to std::pow.
+   */
+  if (!std::isfinite(power) || std::fabs(power) > 1e6)
+    return plan;
+
+  const T whole = std::trunc(power);
+  const T fraction = power - whole;
+  plan.whole = static_cast<int32_t>(whole);
+
+  if (fraction == 0)
+  {
+    plan.kind = PowerKind::integer;
+  }
+  else if (std::fabs(fraction) == 0.5)
+  {
+    plan.kind = PowerKind::half;
+    plan.root_power = (fraction > 0) ? 1 : -1;
+  }
+  else
+  {
+    /*
+     * Only accept a third power if it is exactly the value nearest to
+     * (3 * whole + k) / 3, i.e. what a curve author writing 4/3 would get.
+     */
+    const T k = std::round(fraction * 3);
+    if (k != 0 && (3 * whole + k) / 3 == power)
+    {
+      plan.kind = PowerKind::third;
+      plan.root_power = static_cast<int8_t>(k);
+    }
+  }
+  return plan;
+}
+
+/**
+ * x^whole, computed the same way as the power ladder in PolynomialEquation:
+ * by repeated multiplication (of 1/x for negative powers) if
+ * |whole| <= max_ladder_power, else with std::pow.
+ */
+template<typename T>
+constexpr T ladder_power (const T x, const int32_t whole)
+{
+  if (whole > max_ladder_power || whole < -max_ladder_power)
+    return static_cast<T>(std::pow(x, whole));
+
+  const T step = (whole < 0) ? 1 / x : x;
+  T result = 1;
+  for (int32_t k = 0; k < whole || k < -whole; ++k)
+    result = (k == 0) ? step : result * step;
+  return result;
+}
+
+constexpr size_t no_piece = static_cast<size_t>(-1);
+
+/**
+ * Binary search for the piece containing x among pieces [lo, end) of an
+ * engine that keeps its piece bounds, in ascending order, as parallel arrays.
+ * The comparisons are written so that NaN is in no piece.
+ * @return Index of the piece containing x, or no_piece
+ */
+template<typename B>
+size_t find_in_bounds (const B x, const std::vector<B>& lower_bounds, const std::vector<B>& upper_bounds,
+                       const std::vector<bool>& lb_inclusive, const std::vector<bool>& ub_inclusive,
+                       size_t lo, const size_t end)
+{
+  /*
+   * First piece whose upper bound is not below x
+   */
+  size_t hi = end;
+  while (lo < hi)
+  {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (x > upper_bounds[mid] || (x == upper_bounds[mid] && !ub_inclusive[mid]))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo == end || !(x > lower_bounds[lo] || (x == lower_bounds[lo] && lb_inclusive[lo])))
+    return no_piece;
+  return lo;
+}
+
+} /* namespace detail */
+
+/**
+ * The value of an expression at some x together with its first derivative
+ * with respect to x.
+ * @tparam T Scalar type used for storage and evaluation
+ */
+template<typename T>
+struct BasicValueAndDerivative
+{
+  T value = 0;
+  T derivative = 0;
+};
+
+using ValueAndDerivative = BasicValueAndDerivative<double>;
+
+/**
+ * Result of bounding a polynomial's denominator over the range of its piece.
+ */
+enum class PoleStatus : uint8_t
+{
+  unchecked, /* No range analysis has been run */
+  pole_free, /* The denominator provably never evaluates to zero */
+  has_pole,  /* The denominator evaluates to zero somewhere in the range */
+  unknown    /* Neither could be established */
+};
+
+/**
+ * PolynomialEquation represents an m-degree polynomial as the numerator
+ * and an n-degree polynomial as the denominator. Both the numerator
+ * and denominator are expressions involving the same single variable.
+ * @tparam T Scalar type used for storage and evaluation
+ */
+template<typename T>
+class BasicPolynomialEquation
+{
+public:
+  /**
+   * The numerator and denominator are simply lists of monomials (of the same
+   * single variable) that are individually evaluated and then arithmetically
+   * added to obtain a result when given an input value.
+   */
+  std::vector<BasicMonomial<T> > numerator;
+  std::vector<BasicMonomial<T> > denominator;
+
+  /**
+   * The numerator and denominator are default-constructed to 1.
+   */
+  BasicPolynomialEquation () : numerator({{0,1}}), denominator({{0,1}}) {}
+
+  /**
+   * Classify every monomial's power so that calculate() can avoid the general
+   * std::pow where a cheaper evaluation exists:
+   * - integer powers are read from a ladder x, x^2, x^3, ... (and 1/x,
+   *   1/x^2, ... for negative powers) built once per call by repeated
+   *   multiplication and shared by the numerator and the denominator,
+   * - half-integer powers use std::sqrt times an integer power,
+   * - third powers (k/3) use std::cbrt times an integer power,
+   * - if two or more terms have other real powers, log(x) is computed once per
+   *   call and each such term is evaluated as exp(p * log(x)).
+   * The fast paths are only taken for finite x > 0; every other input goes
+   * through std::pow so its domain rules are unchanged.
+   * This is done when loading an equation. Call it again after modifying the
+   * numerator or denominator, otherwise calculate() may use a stale plan.
+   */
+  void prepare ()
+  {
+    numerator_plan = plan_terms(numerator);
+    denominator_plan = plan_terms(denominator);
+
+    size_t general_terms = 0;
+    T highest_power = 0;
+    uses_sqrt = false;
+    uses_cbrt = false;
+    ladder_up = 0;
+    ladder_down = 0;
+    for (const auto* plan : {&numerator_plan, &denominator_plan})
+    {
+      for (const auto& term : *plan)
+      {
+        if (term.kind != detail::PowerKind::general)
+        {
+          if (term.whole >= 0 && term.whole <= detail::max_ladder_power)
+            ladder_up = std::max(ladder_up, term.whole);
+          else if (term.whole < 0 && term.whole >= -detail::max_ladder_power)
+            ladder_down = std::max(ladder_down, -term.whole);
+        }
+        general_terms += (term.kind == detail::PowerKind::general);
+        uses_sqrt = uses_sqrt || (term.kind == detail::PowerKind::half);
+        uses_cbrt = uses_cbrt || (term.kind == detail::PowerKind::third);
+      }
+    }
+    for (const auto* terms : {&numerator, &denominator})
+    {
+      for (const auto& term : *terms)
+        highest_power = std::max(highest_power, term.power);
+    }
+    shares_log = (general_terms >= 2);
+    slope_cutoff = highest_power > 0 ? std::pow(std::numeric_limits<T>::min(), 1 / highest_power) : 0;
+    poles = PoleStatus::unchecked;
+  }
+
+  /**
+   * Prepare as above, then bound the denominator over the given range. If it
+   * provably never evaluates to zero there, calculate() skips the 0/0 and n/0
+   * checks for this piece.
+   * The analysis uses interval arithmetic on the monomials, bisecting the
+   * range where the enclosure is too loose, with a margin for floating point
+   * rounding. It is conservative: a piece whose denominator cannot be proven
+   * nonzero is reported as PoleStatus::unknown rather than pole_free.
+   * @param domain Range of inputs this polynomial will be evaluated over
+   */
+  void prepare (const numeric_range::NumericRange<T>& domain)
+  {
+    prepare();
+    poles = analyze_denominator(domain);
+  }
+
+  /**
+   * @return Outcome of the denominator analysis done by prepare(domain)
+   */
+  PoleStatus pole_status () const
+  {
+    return poles;
+  }
+
+  /**
+   * Memory this polynomial owns on the heap: its monomials, and the plans
+   * made by prepare() as metadata. The object itself is counted by whatever
+   * holds it.
+   * @return Heap usage of this polynomial
+   */
+  MemoryUsage memory_usage () const
+  {
+    MemoryUsage usage;
+    detail::count_vector(usage, usage.polynomials, numerator);
+    detail::count_vector(usage, usage.polynomials, denominator);
+    detail::count_vector(usage, usage.metadata, numerator_plan);
+    detail::count_vector(usage, usage.metadata, denominator_plan);
+    return usage;
+  }
+
+  /**
+   * Calculate the result of this polynomial expression given the input value x
+   * @param x Input to the expression
+   * @return Result of computing f(x)
+   */
+  T calculate (const T x) const
+  {
+    T numerator_val = 0;
+    T denominator_val = 0;
+
+    if (numerator_plan.size() == numerator.size()
+        && denominator_plan.size() == denominator.size())
+    {
+      const PowerBasis basis = make_basis(x);
+      numerator_val = sum_terms(numerator, numerator_plan, basis);
+      denominator_val = sum_terms(denominator, denominator_plan, basis);
+
+      if (poles == PoleStatus::pole_free)
+        return numerator_val / denominator_val;
+    }
+    else
+    {
+      for (const auto & i : numerator)
+        numerator_val += i.coefficient * std::pow(x, i.power);
+
+      for (const auto & i : denominator)
+        denominator_val += i.coefficient * std::pow(x, i.power);
+    }
+
+    if (numerator_val == 0 && denominator_val == 0)
+      return 0;
+    else if (numerator_val != 0 && denominator_val == 0)
+      return std::numeric_limits<T>::infinity();
+
+    return numerator_val / denominator_val;
+  }
+
+  /**
+   * Calculate the result of this polynomial expression and its derivative
+   * given the input value x, in one pass over the monomials. The value is
+   * identical to calculate(x). The derivative follows the quotient rule and is
+   * NaN where the denominator evaluates to zero. It is usually read off the
+   * terms already summed for the value; near 0, where the highest power's
+   * term would underflow and lose the slope, each term's p * c * x^(p - 1) is
+   * summed with std::pow instead.
+   * @param x Input to the expression
+   * @return f(x) and f'(x)
+   */
+  BasicValueAndDerivative<T> calculate_with_derivative (const T x) const
+  {
+    T numerator_val = 0;
+    T denominator_val = 0;
+    T numerator_weighted = 0;
+    T denominator_weighted = 0;
+
+    if (numerator_plan.size() == numerator.size()
+        && denominator_plan.size() == denominator.size())
+    {
+      const PowerBasis basis = make_basis(x);
+      numerator_val = sum_terms(numerator, numerator_plan, basis, numerator_weighted);
+      denominator_val = sum_terms(denominator, denominator_plan, basis, denominator_weighted);
+    }
+    else
+    {
+      for (const auto & i : numerator)
+      {
+        const T term = i.coefficient * std::pow(x, i.power);
+        numerator_val += term;
+        numerator_weighted += i.power * term;
+      }
+
+      for (const auto & i : denominator)
+      {
+        const T term = i.coefficient * std::pow(x, i.power);
+        denominator_val += term;
+        denominator_weighted += i.power * term;
+      }
+    }
+
+    BasicValueAndDerivative<T> result;
+    if (denominator_val == 0)
+    {
+      result.value = (numerator_val == 0) ? 0 : std::numeric_limits<T>::infinity();
+      result.derivative = std::numeric_limits<T>::quiet_NaN();
+      return result;
+    }
+
+    result.value = numerator_val / denominator_val;
+    if (std::isfinite(x) && std::abs(x) > slope_cutoff)
+    {
+      /*
+       * Both slopes are weighted / x, so the quotient rule needs one division
+       */
+      result.derivative = (numerator_weighted * denominator_val - numerator_val * denominator_weighted)
+                          / (x * denominator_val * denominator_val);
+      return result;
+    }
+
+    const T numerator_slope = slope(numerator, x);
+    const T denominator_slope = slope(denominator, x);
+    result.derivative = (numerator_slope * denominator_val - numerator_val * denominator_slope)
+                        / (denominator_val * denominator_val);
+    return result;
+  }
+
+  /**
+   * Calculate the result of this polynomial expression given the input value x.
+   * Shorthand operator provided for convenience.
+   * @param x Input to the expression
+   * @return Result of computing f(x)
+   */
+  inline T operator() (const T x) const
+  {
+    return calculate(x);
+  }
+
+private:
+  /**
+   * Values derived from x that are shared by every term in one evaluation.
+   */
+  struct PowerBasis
+  {
+    T x = 0;
+    bool fast = false;
+    /* up[k] = x^k for k <= ladder_up, down[k] = x^-k for k <= ladder_down */
+    T up[detail::max_ladder_power + 1];
+    T down[detail::max_ladder_power + 1];
+    T sqrt_x = 0;
+    T cbrt_x = 0;
+    bool has_log = false;
+    T log_x = 0;
+  };
+
+  std::vector<detail::TermPlan> numerator_plan;
+  std::vector<detail::TermPlan> denominator_plan;
+  bool uses_sqrt = false;
+  bool uses_cbrt = false;
+  bool shares_log = false;
+  int32_t ladder_up = 0;
+  int32_t ladder_down = 0;
+  /* Below this |x|, x to the highest power is subnormal (0 if no power is positive) */
+  T slope_cutoff = 0;
+  PoleStatus poles = PoleStatus::unchecked;
+
+#ifdef JSON_EQUATION_USAGE_COUNTERS
+  /*
+   * Index of this piece's hit counters, set by the owning equation
+   */
+  friend class detail::UsageCounters;
+  uint32_t usage_index = detail::UsageCounters::unnumbered;
+#endif
+
+  /**
+   * Bounds on a sum of monomials over an interval: the sum lies in [lo, hi],
+   * and the sum of the monomials' absolute values is at most magnitude.
+   * same_sign is set if no two monomials can have opposite signs, and
+   * min_term is a lower bound on the largest monomial's absolute value.
+   */
+  struct Enclosure
+  {
+    T lo = 0;
+    T hi = 0;
+    T magnitude = 0;
+    bool same_sign = true;
+    T min_term = 0;
+  };
+
+  /*
+   * Limits on the bisection done while proving a denominator nonzero.
+   */
+  static constexpr int max_pole_depth = 12;
+  static constexpr int max_pole_intervals = 512;
+
+  static T sum_pow (const std::vector<BasicMonomial<T> >& terms, const T x)
+  {
+    T sum = 0;
+    for (const auto& term : terms)
+      sum += term.coefficient * std::pow(x, term.power);
+    return sum;
+  }
+
+  static bool is_integer (const T power)
+  {
+    return std::isfinite(power) && std::trunc(power) == power;
+  }
+
+  static bool contains (const numeric_range::NumericRange<T>& range, const T x)
+  {
+    return (x > range.lb || (x == range.lb && range.lb_inclusive))
+           && (x < range.ub || (x == range.ub && range.ub_inclusive));
+  }
+
+  PoleStatus analyze_denominator (const numeric_range::NumericRange<T>& domain) const
+  {
+    if (denominator.empty())
+      return PoleStatus::has_pole;
+
+    bool has_fractional = false;
+    bool has_negative = false;
+    for (const auto& term : denominator)
+    {
+      has_fractional = has_fractional || !is_integer(term.power);
+      has_negative = has_negative || term.power < 0;
+    }
+
+    /*
+     * Check the points where the enclosures below are least useful exactly.
+     */
+    for (const T x : {domain.lb, domain.ub, T(0)})
+    {
+      if (contains(domain, x) && sum_pow(denominator, x) == 0)
+        return PoleStatus::has_pole;
+    }
+
+    /*
+     * Negative and real powers are only monotonic on either side of 0, so
+     * analyze each side separately.
+     */
+    std::vector<std::pair<T, T> > segments;
+    if ((has_fractional || has_negative) && domain.lb < 0 && domain.ub > 0)
+      segments = {{domain.lb, T(0)}, {T(0), domain.ub}};
+    else
+      segments = {{domain.lb, domain.ub}};
+
+    int budget = max_pole_intervals;
+    PoleStatus status = PoleStatus::pole_free;
+    for (const auto& segment : segments)
+    {
+      /*
+       * Real powers of negative inputs are NaN, never zero, and x = 0 was
+       * checked above.
+       */
+      if (has_fractional && segment.second <= 0)
+        continue;
+
+      const PoleStatus segment_status = analyze_interval(
+          domain, segment.first, segment.second, has_negative, max_pole_depth, budget);
+      if (segment_status == PoleStatus::has_pole)
+        return segment_status;
+      if (segment_status == PoleStatus::unknown)
+        status = segment_status;
+    }
+    return status;
+  }
+
+  PoleStatus analyze_interval (const numeric_range::NumericRange<T>& domain,
+                               const T a, const T b, const bool has_negative,
+                               const int depth, int& budget) const
+  {
+    --budget;
+    if (proves_nonzero(enclose(denominator, a, b)))
+      return PoleStatus::pole_free;
+
+    /*
+     * Look for a root directly: an exact zero at a sample point, or a sign
+     * change over an interval on which the denominator is continuous.
+     */
+    const T mid = a + (b - a) / 2;
+    const T da = sum_pow(denominator, a);
+    const T db = sum_pow(denominator, b);
+    for (const auto& [x, value] : {std::pair<T, T>{a, da}, {b, db},
+                                   {mid, sum_pow(denominator, mid)}})
+    {
+      if (value == 0 && contains(domain, x))
+        return PoleStatus::has_pole;
+    }
+    /*
+     * A zero at an endpoint is not a sign change: if the endpoint is included
+     * it was caught above, and if it is excluded the root is not in the piece.
+     */
+    const bool continuous = !has_negative || a > 0 || b < 0;
+    if (continuous && std::isfinite(da) && std::isfinite(db) && da != 0 && db != 0 && (da < 0) != (db < 0))
+      return PoleStatus::has_pole;
+
+    if (depth == 0 || budget <= 0 || !(a < mid && mid < b))
+      return PoleStatus::unknown;
+
+    const PoleStatus lower = analyze_interval(domain, a, mid, has_negative, depth - 1, budget);
+    if (lower == PoleStatus::has_pole)
+      return lower;
+    const PoleStatus upper = analyze_interval(domain, mid, b, has_negative, depth - 1, budget);
+    if (upper == PoleStatus::has_pole)
+      return upper;
+    return (lower == PoleStatus::pole_free) ? upper : lower;
+  }
+
+  /**
+   * Enclose the sum of monomials over [a, b], where either every power is an
+   * integer or a >= 0, and the interval does not straddle 0 if any power is
+   * negative.
+   */
+  static Enclosure enclose (const std::vector<BasicMonomial<T> >& terms, const T a, const T b)
+  {
+    const T inf = std::numeric_limits<T>::infinity();
+    Enclosure enclosure;
+    bool seen_positive = false;
+    bool seen_negative = false;
+
+    for (const auto& term : terms)
+    {
+      if (term.coefficient == 0)
+        continue;
+
+      const T pa = std::pow(a, term.power);
+      const T pb = std::pow(b, term.power);
+      T lo = std::min(pa, pb);
+      T hi = std::max(pa, pb);
+
+      if (is_integer(term.power))
+      {
+        const bool even = std::fmod(term.power, 2) == 0;
+        if (term.power > 0 && even && a < 0 && b > 0)
+          lo = 0;
+        /*
+         * pow(0.0, odd negative) is +inf, but the limit from below is -inf.
+         */
+        if (term.power < 0 && !even && b == 0)
+          lo = -inf, hi = pa;
+      }
+
+      if (term.coefficient > 0)
+        lo *= term.coefficient, hi *= term.coefficient;
+      else
+        std::swap(lo, hi), lo *= term.coefficient, hi *= term.coefficient;
+
+      enclosure.lo += lo;
+      enclosure.hi += hi;
+      enclosure.magnitude += std::max(std::fabs(lo), std::fabs(hi));
+      seen_positive = seen_positive || hi > 0;
+      seen_negative = seen_negative || lo < 0;
+      if (lo > 0 || hi < 0)
+        enclosure.min_term = std::max(enclosure.min_term, std::min(std::fabs(lo), std::fabs(hi)));
+    }
+
+    enclosure.same_sign = !(seen_positive && seen_negative);
+    return enclosure;
+  }
+
+  /**
+   * Whether every floating point evaluation of a sum with this enclosure is
+   * nonzero. Either no cancellation is possible and some monomial is far from
+   * underflow, or the enclosure excludes zero by more than the rounding error
+   * of evaluating the sum (a generous bound covering the power ladder and
+   * exp/log paths as well as the additions).
+   */
+  bool proves_nonzero (const Enclosure& enclosure) const
+  {
+    /*
+     * Terms this far above the underflow threshold never round to zero
+     */
+    const T tiny = std::numeric_limits<T>::min() / std::numeric_limits<T>::epsilon();
+    if (enclosure.same_sign && enclosure.min_term > tiny)
+      return true;
+
+    const T margin = (denominator.size() + 256) * 4
+                     * std::numeric_limits<T>::epsilon() * enclosure.magnitude;
+    return std::isfinite(margin) && (enclosure.lo > margin || enclosure.hi < -margin);
+  }
+
+  static std::vector<detail::TermPlan> plan_terms (const std::vector<BasicMonomial<T> >& terms)
+  {
+    std::vector<detail::TermPlan> plan;
+    plan.reserve(terms.size());
+    for (const auto& term : terms)
+      plan.push_back(detail::plan_term(term.power));
+    return plan;
+  }
+
+  PowerBasis make_basis (const T x) const
+  {
+    PowerBasis basis;
+    basis.x = x;
+    basis.fast = (x > 0 && x < std::numeric_limits<T>::infinity());
+
+    basis.up[0] = 1;
+    for (int32_t k = 1; k <= ladder_up; ++k)
+      basis.up[k] = basis.up[k - 1] * x;
+
+    basis.down[0] = 1;
+    if (ladder_down > 0)
+      basis.down[1] = 1 / x;
+    for (int32_t k = 2; k <= ladder_down; ++k)
+      basis.down[k] = basis.down[k - 1] * basis.down[1];
+    if (basis.fast)
+    {
+      if (uses_sqrt)
+        basis.sqrt_x = std::sqrt(x);
+      if (uses_cbrt)
+        basis.cbrt_x = std::cbrt(x);
+      basis.has_log = shares_log;
+      if (shares_log)
+        basis.log_x = std::log(x);
+    }
+    return basis;
+  }
+
+  T sum_terms (const std::vector<BasicMonomial<T> >& terms,
+               const std::vector<detail::TermPlan>& plan,
+               const PowerBasis& basis) const
+  {
+    T sum = 0;
+    for (size_t i = 0; i < terms.size(); ++i)
+      sum += terms[i].coefficient * power_of(terms[i].power, plan[i], basis);
+    return sum;
+  }
+
+  /**
+   * As above, also accumulating sum(p * c * x^p) into weighted, which is x
+   * times the derivative of the sum.
+   */
+  T sum_terms (const std::vector<BasicMonomial<T> >& terms,
+               const std::vector<detail::TermPlan>& plan,
+               const PowerBasis& basis, T& weighted) const
+  {
+    T sum = 0;
+    for (size_t i = 0; i < terms.size(); ++i)
+    {
+      const T term = terms[i].coefficient * power_of(terms[i].power, plan[i], basis);
+      sum += term;
+      weighted += terms[i].power * term;
+    }
+    return sum;
+  }
+
+  /**
+   * Derivative of a sum of monomials, sum(p * c * x^(p - 1)), term by term.
+   * Only used near 0 and at infinity; constants contribute nothing.
+   */
+  static T slope (const std::vector<BasicMonomial<T> >& terms, const T x)
+  {
+    T sum = 0;
+    for (const auto& term : terms)
+    {
+      if (term.power != 0)
+        sum += term.coefficient * term.power * std::pow(x, term.power - 1);
+    }
+    return sum;
+  }
+
+  T integer_power (const int32_t whole, const PowerBasis& basis) const
+  {
+    if (whole >= 0 && whole <= ladder_up)
+      return basis.up[whole];
+    else if (whole < 0 && -whole <= ladder_down)
+      return basis.down[-whole];
+    else
+      return static_cast<T>(std::pow(basis.x, whole));
+  }
+
+  T power_of (const T power, const detail::TermPlan& plan,
+              const PowerBasis& basis) const
+  {
+    if (plan.kind == detail::PowerKind::integer)
+      return integer_power(plan.whole, basis);
+    if (!basis.fast)
+      return std::pow(basis.x, power);
+
+    switch (plan.kind)
+    {
+      case detail::PowerKind::half:
+      {
+        const T whole = integer_power(plan.whole, basis);
+        return (plan.root_power > 0) ? whole * basis.sqrt_x : whole / basis.sqrt_x;
+      }
+      case detail::PowerKind::third:
+      {
+        const T whole = integer_power(plan.whole, basis);
+        const T root = (plan.root_power == 1 || plan.root_power == -1) ?
+                            basis.cbrt_x : basis.cbrt_x * basis.cbrt_x;
+        return (plan.root_power > 0) ? whole * root : whole / root;
+      }
+      default:
+        return basis.has_log ? std::exp(power * basis.log_x) : std::pow(basis.x, power);
+    }
+  }
+};
+
+using PolynomialEquation = BasicPolynomialEquation<double>;
+
+/**
+ * Identifies a piece whose denominator could not be proven nonzero over the
+ * piece's range when the equation was loaded.
+ */
+template<typename T>
+struct BasicPoleReport
+{
+  numeric_range::NumericRange<T> bounds;
+  PoleStatus status;
+};
+
+using PoleReport = BasicPoleReport<double>;
+
+/**
+ * JSONEquation represents a system of piecewise polynomial equations
+ * constructed using a JSON input. Values read from JSON are converted to the
+ * scalar type T on the way in.
+ * @tparam T Scalar type used for piece bounds, storage and evaluation
+ */
+template<typename T>
+class BasicJSONEquation
+{
+public:
+  /**
+   * The "secret sauce" of this representation is a numeric range mapped
+   * to a polynomial equation.
+   */
+  using PieceMap = std::map<numeric_range::NumericRange<T>, BasicPolynomialEquation<T>,
+  numeric_range::NumericRangeComparator<T> >;
+  PieceMap pieces;
+
+  /**
+   * A PieceCursor remembers the piece that a previous lookup landed in (or,
+   * if the input was not in any piece, the piece nearest to it). Passing it
+   * back to calculate() lets inputs with temporal locality skip the full
+   * search. A cursor may only be used with the equation that produced it, and
+   * is invalidated if that piece is erased from the equation.
+   */
+  class PieceCursor
+  {
+  public:
+    PieceCursor () = default;
+
+    /**
+     * @return Whether the last lookup through this cursor found a piece
+     */
+    bool found () const
+    {
+      return in_piece;
+    }
+
+  private:
+    friend class BasicJSONEquation;
+    typename PieceMap::const_iterator piece{};
+    bool valid = false;
+    bool in_piece = false;
+  };
+
+  BasicJSONEquation () = default;
+
+  /**
+   * Construct JSONEquation from an istream containing JSON data.
+   * @param is istream corresponding to JSON needed to build a JSONEquation
+   * object. This is expected to follow the schema laid out in documentation.
+   */
+  explicit BasicJSONEquation (std::istream& is);
+
+  /**
+   * Construct JSONEquation from an nlohmann::json object containing JSON data.
+   * @param json_in JSON needed to build a JSONEquation object. This is
+   * expected to follow the schema laid out in documentation.
+   */
+  explicit BasicJSONEquation (const nlohmann::json& json_in);
+
+  /**
+   * Construct JSONEquation from an istream containing JSON data, reporting
+   * where the time went.
+   * @param is istream corresponding to JSON needed to build a JSONEquation
+   * object. This is expected to follow the schema laid out in documentation.
+   * @param report Receives time and allocations per load phase, piece and
+   * monomial counts, and bytes read. Its allocation_counter is kept.
+   */
+  BasicJSONEquation (std::istream& is, LoadReport& report);
+
+  /**
+   * Construct JSONEquation from an nlohmann::json object containing JSON
+   * data, reporting where the time went. Nothing is tokenized or read.
+   * @param json_in JSON needed to build a JSONEquation object. This is
+   * expected to follow the schema laid out in documentation.
+   * @param report Receives time and allocations per load phase, and piece and
+   * monomial counts. Its allocation_counter is kept.
+   */
+  BasicJSONEquation (const nlohmann::json& json_in, LoadReport& report);
+
+  BasicJSONEquation (BasicJSONEquation& other) : BasicJSONEquation()
+  {
+    pieces = other.pieces;
+    number_pieces();
+  }
+
+  BasicJSONEquation& operator= (BasicJSONEquation other)
+  {
+    BasicJSONEquation temp(other);
+    swap(temp, *this);
+    return *this;
+  }
+
+  /**
+   * Swap two systems (i.e. their pieces) in memory
+   * @param first
+   * @param second
+   */
+  friend void swap (BasicJSONEquation& first, BasicJSONEquation& second)
+  {
+    std::swap(first.pieces, second.pieces);
+#ifdef JSON_EQUATION_USAGE_COUNTERS
+    swap(first.usage_counters, second.usage_counters);
+#endif
+  }
+
+  ~BasicJSONEquation () = default;
+
+  /**
+   * Calculate the output of the polynomial system given input x. If x is not
+   * included in the range for any piece, std::nullopt is returned instead and
+   * it is up to the caller to determine the course of action.
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range.Else, T val
+   */
+  std::optional<T> calculate (const T x) const
+  {
+    const auto found_piece = find(x);
+    if (found_piece != pieces.end())
+    {
+      count_hit(found_piece->second);
+      return found_piece->second.calculate(x);
+    }
+    count_miss(x);
+    return std::nullopt;
+  }
+
+  /**
+   * List every piece whose denominator was not proven nonzero over its range
+   * when it was loaded, i.e. pieces that may divide by zero (PoleStatus::
+   * has_pole) or for which the analysis was inconclusive (PoleStatus::unknown).
+   * Such pieces are still evaluated as before (0/0 -> 0, n/0 -> inf).
+   * @return Reports in the order of the pieces' bounds
+   */
+  std::vector<BasicPoleReport<T> > poles () const
+  {
+    std::vector<BasicPoleReport<T> > reports;
+    for (const auto& piece : pieces)
+    {
+      const PoleStatus status = piece.second.pole_status();
+      if (status != PoleStatus::pole_free)
+        reports.push_back({piece.first, status});
+    }
+    return reports;
+  }
+
+  /**
+   * Memory held by this equation. Each piece is a map node holding its bounds
+   * (index) and its PolynomialEquation object (metadata), which in turn owns
+   * its monomials and plans. Usage counters, if compiled in, are not counted.
+   * @return Memory usage, including this object
+   */
+  MemoryUsage memory_usage () const
+  {
+    MemoryUsage usage;
+    usage.metadata += sizeof(*this);
+    for (const auto& piece : pieces)
+    {
+      usage.index += detail::map_node_overhead + sizeof(piece) - sizeof(piece.second);
+      usage.metadata += sizeof(piece.second);
+      detail::count_block(usage, detail::map_node_overhead + sizeof(piece));
+      usage += piece.second.memory_usage();
+    }
+    return usage;
+  }
+
+  /**
+   * Find the piece containing x and return a cursor to it that may be reused
+   * as a hint by calculate(x, cursor) for subsequent nearby inputs.
+   * @param x Input to the system of equations
+   * @return Cursor to the piece containing x (check found()), or to the
+   * piece nearest to x if there is none
+   */
+  PieceCursor locate (const T x) const
+  {
+    PieceCursor cursor;
+    search(x, cursor);
+    return cursor;
+  }
+
+  /**
+   * Calculate the output of the polynomial system given input x, starting the
+   * piece lookup from the hint in cursor. The hinted piece is checked first,
+   * then its neighbour in the direction of x, and only then is a full search
+   * performed. The cursor is updated to the piece x landed in (or nearest to).
+   * @param x Input to the system of equations
+   * @param cursor Hint from a previous locate() or calculate() call on this
+   * equation. A default-constructed cursor falls back to a full search.
+   * @return nullopt if x not included in any pieces' range. Else, T val
+   */
+  std::optional<T> calculate (const T x, PieceCursor& cursor) const
+  {
+    if (seek(x, cursor))
+    {
+      count_hit(cursor.piece->second);
+      return cursor.piece->second.calculate(x);
+    }
+    count_miss(x);
+    return std::nullopt;
+  }
+
+  /**
+   * Calculate the output of the polynomial system given input x. If x is not
+   * included in the range for any piece, std::nullopt is returned instead and
+   * it is up to the caller to determine the course of action.
+   * Shorthand operator provided for convenience.
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range.Else, T val
+   */
+  std::optional<T> operator() (const T x) const
+  {
+    return calculate(x);
+  }
+
+  /**
+   * Calculate the output of the polynomial system for each of count inputs.
+   * Consecutive inputs share a PieceCursor, so sorted or slowly varying
+   * inputs mostly skip the full search.
+   * @param x Inputs to the system of equations
+   * @param count Number of inputs
+   * @param out Receives count results, nullopt for inputs not included in any
+   * pieces' range
+   */
+  void calculate (const T* x, const size_t count, std::optional<T>* out) const
+  {
+    PieceCursor cursor;
+    for (size_t i = 0; i < count; ++i)
+      out[i] = calculate(x[i], cursor);
+  }
+
+  /**
+   * Calculate the output of the polynomial system for each input in xs.
+   * @param xs Inputs to the system of equations
+   * @return Results in the order of xs, nullopt for inputs not included in any
+   * pieces' range
+   */
+  std::vector<std::optional<T> > calculate (const std::vector<T>& xs) const
+  {
+    std::vector<std::optional<T> > results(xs.size());
+    calculate(xs.data(), xs.size(), results.data());
+    return results;
+  }
+
+  /**
+   * Calculate the output of the polynomial system and its derivative given
+   * input x, with one piece lookup and one pass over the piece's monomials.
+   * At a bound shared by two pieces, this is the derivative of the piece that
+   * contains x.
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range. Else, f(x) and
+   * f'(x) (see PolynomialEquation::calculate_with_derivative)
+   */
+  std::optional<BasicValueAndDerivative<T> > calculate_with_derivative (const T x) const
+  {
+    const auto found_piece = find(x);
+    if (found_piece != pieces.end())
+    {
+      count_hit(found_piece->second);
+      return found_piece->second.calculate_with_derivative(x);
+    }
+    count_miss(x);
+    return std::nullopt;
+  }
+
+  /**
+   * Calculate the output and derivative of the polynomial system for each of
+   * count inputs, sharing a PieceCursor between consecutive inputs.
+   * @param x Inputs to the system of equations
+   * @param count Number of inputs
+   * @param out Receives count results, nullopt for inputs not included in any
+   * pieces' range
+   */
+  void calculate_with_derivative (const T* x, const size_t count,
+                                  std::optional<BasicValueAndDerivative<T> >* out) const
+  {
+    PieceCursor cursor;
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (seek(x[i], cursor))
+      {
+        count_hit(cursor.piece->second);
+        out[i] = cursor.piece->second.calculate_with_derivative(x[i]);
+      }
+      else
+      {
+        count_miss(x[i]);
+        out[i] = std::nullopt;
+      }
+    }
+  }
+
+  /**
+   * Calculate the output and derivative of the polynomial system for each
+   * input in xs.
+   * @param xs Inputs to the system of equations
+   * @return Results in the order of xs, nullopt for inputs not included in any
+   * pieces' range
+   */
+  std::vector<std::optional<BasicValueAndDerivative<T> > > calculate_with_derivative (const std::vector<T>& xs) const
+  {
+    std::vector<std::optional<BasicValueAndDerivative<T> > > results(xs.size());
+    calculate_with_derivative(xs.data(), xs.size(), results.data());
+    return results;
+  }
+
+  /**
+   * Whether lookups are counted, i.e. whether JSON_EQUATION_USAGE_COUNTERS
+   * was defined.
+   */
+#ifdef JSON_EQUATION_USAGE_COUNTERS
+  static constexpr bool counts_usage = true;
+#else
+  static constexpr bool counts_usage = false;
+#endif
+
+  /**
+   * Sum the lookup counts of every thread since construction or the last
+   * reset_usage(). Copies of an equation count separately, from zero.
+   * @return Hits per piece and misses by kind. All zero unless counts_usage.
+   */
+  UsageReport usage () const
+  {
+#ifdef JSON_EQUATION_USAGE_COUNTERS
+    return usage_counters.report(pieces);
+#else
+    UsageReport report;
+    report.piece_hits.assign(pieces.size(), 0);
+    return report;
+#endif
+  }
+
+  /**
+   * Zero the lookup counts of every thread. Call this after adding pieces,
+   * which are not counted until then.
+   */
+  void reset_usage ()
+  {
+    number_pieces();
+  }
+
+private:
+#ifdef JSON_EQUATION_USAGE_COUNTERS
+  mutable detail::UsageCounters usage_counters;
+#endif
+
+  /**
+   * Give the pieces the numbers their hits are counted under, starting the
+   * counts from zero
+   */
+  void number_pieces ()
+  {
+#ifdef JSON_EQUATION_USAGE_COUNTERS
+    usage_counters.number(pieces);
+#endif
+  }
+
+  void count_hit ([[maybe_unused]] const BasicPolynomialEquation<T>& piece) const
+  {
+#ifdef JSON_EQUATION_USAGE_COUNTERS
+    usage_counters.hit(piece);
+#endif
+  }
+
+  /**
+   * Count an input that is not in any piece. Pieces are ordered and disjoint,
+   * so comparing against the first and last piece tells a gap from either
+   * side of the domain. NaN, which is on neither side, counts as a gap.
+   */
+  void count_miss ([[maybe_unused]] const T x) const
+  {
+#ifdef JSON_EQUATION_USAGE_COUNTERS
+    if (pieces.empty() || is_below(x, pieces.begin()->first))
+      usage_counters.miss(Miss::below_domain);
+    else if (is_above(x, pieces.rbegin()->first))
+      usage_counters.miss(Miss::above_domain);
+    else
+      usage_counters.miss(Miss::in_gap);
+#endif
+  }
+
+  /**
+   * @return The piece containing x, or pieces.end() if there is none. NaN is
+   * in no piece, and would otherwise break the ordering of the map.
+   */
+  typename PieceMap::const_iterator find (const T x) const
+  {
+    if (std::isnan(x))
+      return pieces.end();
+    return pieces.find(numeric_range::NumericRange<T>{x});
+  }
+
+  static bool is_below (const T x, const numeric_range::NumericRange<T>& range)
+  {
+    return x < range.lb || (x == range.lb && !range.lb_inclusive);
+  }
+
+  static bool is_above (const T x, const numeric_range::NumericRange<T>& range)
+  {
+    return x > range.ub || (x == range.ub && !range.ub_inclusive);
+  }
+
+  /**
+   * Point the cursor at the piece containing x using a full search of the map.
+   * If x is not in any piece, the cursor is left at the nearest piece above x
+   * (or the last piece) so that it remains a useful hint. NaN leaves the
+   * cursor where it was.
+   * @return Whether x is contained in a piece
+   */
+  bool search (const T x, PieceCursor& cursor) const
+  {
+    if (std::isnan(x))
+      return cursor.in_piece = false;
+
+    cursor.piece = pieces.lower_bound(numeric_range::NumericRange<T>{x});
+    if (cursor.piece == pieces.end())
+    {
+      cursor.valid = !pieces.empty();
+      if (cursor.valid)
+        --cursor.piece;
+      cursor.in_piece = false;
+      return false;
+    }
+
+    cursor.valid = true;
+    cursor.in_piece = !is_below(x, cursor.piece->first);
+    return cursor.in_piece;
+  }
+
+  /**
+   * Point the cursor at the piece containing x, checking the hinted piece and
+   * its neighbour before falling back to a full search. Pieces are disjoint
+   * and ordered, so if x lies strictly between the hint and its neighbour it
+   * is in a gap and no search is needed at all.
+   * @return Whether x is contained in a piece
+   */
+  bool seek (const T x, PieceCursor& cursor) const
+  {
+    if (!cursor.valid || std::isnan(x))
+      return search(x, cursor);
+
+    auto piece = cursor.piece;
+    if (is_below(x, piece->first))
+    {
+      if (piece == pieces.begin())
+        return cursor.in_piece = false;
+
+      --piece;
+      if (is_above(x, piece->first))
+        return cursor.in_piece = false;
+      if (is_below(x, piece->first))
+        return search(x, cursor);
+    }
+    else if (is_above(x, piece->first))
+    {
+      ++piece;
+      if (piece == pieces.end())
+        return cursor.in_piece = false;
+
+      cursor.piece = piece;
+      if (is_below(x, piece->first))
+        return cursor.in_piece = false;
+      if (is_above(x, piece->first))
+        return search(x, cursor);
+    }
+
+    cursor.piece = piece;
+    return cursor.in_piece = true;
+  }
+
+  /**
+   * Build the system of equations from JSON input. Input is expected to follow
+   * the schema laid out by the library. Missing attributes are handled as
+   * specified in documentation. Defined in json_equation.hpp.
+   * @param eq_in JSON representing a system of piecewise polynomial equations
+   * @param profiler Load phase bookkeeping, possibly without a report
+   */
+  void build_equation (const nlohmann::json& eq_in, detail::LoadProfiler& profiler);
+
+  /**
+   * Perform error-checking on a given piece and add it to the current system
+   * if it is valid. Defined in json_equation.hpp.
+   * @param piece_in JSON corresponding to "piece" in a piecewise equation
+   * @param idx Index of this piece in the pieces list used for error messages
+   * @param profiler Load phase bookkeeping, possibly without a report
+   */
+  void build_and_add_piece (const nlohmann::json& piece_in, size_t idx, detail::LoadProfiler& profiler);
+};
+
+using JSONEquation = BasicJSONEquation<double>;
+
+} /* namespace json_equation */
+
+#endif //JSON_EQUATION_CORE_HPP
@@ -0,0 +1,356 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * json_equation_eval evaluates an equation over a stream of inputs, e.g. a
+ * large recorded dataset, and writes one result per input in the same order.
+ *
+ * Usage: json_equation_eval equation.json [--input path] [--output path]
+ *                           [--input-format text|float64]
+ *                           [--output-format text|float64]
+ *                           [--marker TEXT] [--engine kernel|json_equation]
+ *                           [--threads N] [--batch BYTES] [--statistics]
+ *
+ * Inputs are read from stdin unless --input names a file, which is memory
+ * mapped. Text holds one number per line; float64 is raw doubles in native
+ * byte order. Inputs outside the equation's domain, and NaN inputs, produce
+ * --marker ("nan" by default), which must be a number for float64 output.
+ * The kernel engine compiles the equation with the evaluation planner's
+ * layout. --statistics reports counts and throughput on stderr.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "evaluation_planner.hpp"
+#include "stream_evaluation.hpp"
+
+using namespace json_equation;
+
+namespace {
+
+struct CommandLine
+{
+  std::string equation_path;
+  std::string input_path = "-";
+  std::string output_path = "-";
+  StreamFormat input_format = StreamFormat::text;
+  StreamFormat output_format = StreamFormat::text;
+  std::string marker = "nan";
+  std::string engine = "kernel";
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t batch_bytes = 16 << 20;
+  bool statistics = false;
+};
+
+uint64_t parse_unsigned (const std::string& option, const std::string& value)
+{
+  char* end = nullptr;
+  const uint64_t parsed = std::strtoull(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || value[0] == '-' || parsed == 0)
+    throw std::runtime_error("invalid count '" + value + "' for " + option);
+  return parsed;
+}
+
+StreamFormat parse_format (const std::string& option, const std::string& value)
+{
+  if (value == "text")
+    return StreamFormat::text;
+  if (value == "float64")
+    return StreamFormat::float64;
+  throw std::runtime_error("unknown value '" + value + "' for " + option);
+}
+
+void parse_options (const int argc, char** argv, CommandLine& command_line)
+{
+  if (argc < 2)
+    throw std::runtime_error("missing equation");
+  command_line.equation_path = argv[1];
+
+  for (int i = 2; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--statistics")
+    {
+      command_line.statistics = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+      throw std::runtime_error("missing value for " + arg);
+    const std::string value = argv[++i];
+
+    if (arg == "--input")
+      command_line.input_path = value;
+    else if (arg == "--output")
+      command_line.output_path = value;
+    else if (arg == "--input-format")
+      command_line.input_format = parse_format(arg, value);
+    else if (arg == "--output-format")
+      command_line.output_format = parse_format(arg, value);
+    else if (arg == "--marker")
+      command_line.marker = value;
+    else if (arg == "--engine" && (value == "kernel" || value == "json_equation"))
+      command_line.engine = value;
+    else if (arg == "--threads")
+      command_line.threads = static_cast<unsigned>(parse_unsigned(arg, value));
+    else if (arg == "--batch")
+      command_line.batch_bytes = std::max<size_t>(parse_unsigned(arg, value), sizeof(double));
+    else
+      throw std::runtime_error("unknown option " + arg + " " + value);
+  }
+}
+
+std::runtime_error system_error (const std::string& what, const std::string& path)
+{
+  return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+/**
+ * Output file descriptor, written a batch at a time
+ */
+class Output
+{
+public:
+  explicit Output (const std::string& path)
+      : path(path == "-" ? "stdout" : path)
+  {
+    if (path != "-")
+      fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      throw system_error("could not open", path);
+  }
+
+  ~Output ()
+  {
+    if (fd != STDOUT_FILENO)
+      ::close(fd);
+  }
+
+  /**
+   * Write out and empty buffer.
+   */
+  void write (std::vector<char>& buffer)
+  {
+    const char* data = buffer.data();
+    size_t remaining = buffer.size();
+    while (remaining > 0)
+    {
+      const ssize_t written = ::write(fd, data, remaining);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written < 0)
+        throw system_error("could not write", path);
+      data += written;
+      remaining -= static_cast<size_t>(written);
+    }
+    buffer.clear();
+  }
+
+private:
+  std::string path;
+  int fd = STDOUT_FILENO;
+};
+
+/**
+ * Read a whole stream, handing batches of whole lines or whole doubles to
+ * evaluate(begin, end). Regular files are memory mapped; anything else is
+ * read into a buffer that carries a partial line or double over to the next
+ * batch.
+ * @return Number of bytes read
+ */
+template<typename Evaluate>
+uint64_t read_batches (const CommandLine& command_line, Evaluate evaluate)
+{
+  const std::string path = command_line.input_path == "-" ? "stdin" : command_line.input_path;
+  const bool text = command_line.input_format == StreamFormat::text;
+  const size_t batch_bytes = text ? command_line.batch_bytes :
+                             command_line.batch_bytes / sizeof(double) * sizeof(double);
+  const int fd = command_line.input_path == "-" ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw system_error("could not open", path);
+
+  /*
+   * Whole batches end after a newline in text, or after a whole double
+   */
+  const auto batch_end = [text] (const char* begin, const char* end)
+  {
+    if (!text)
+      return begin + (end - begin) / sizeof(double) * sizeof(double);
+    const char* last = end;
+    while (last != begin && last[-1] != '\n')
+      --last;
+    return last;
+  };
+
+  struct stat status = {};
+  if (fd != STDIN_FILENO && ::fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0)
+  {
+    const size_t size = static_cast<size_t>(status.st_size);
+    void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED)
+      throw system_error("could not map", path);
+    ::close(fd);
+    ::madvise(mapped, size, MADV_SEQUENTIAL);
+
+    const char* begin = static_cast<const char*>(mapped);
+    const char* const end = begin + size;
+    try
+    {
+      if (!text && size % sizeof(double) != 0)
+        throw std::runtime_error(path + " ends in a partial float64");
+      while (begin != end)
+      {
+        /*
+         * Text batches run to the end of the line batch_bytes falls in
+         */
+        const char* next = end;
+        if (static_cast<size_t>(end - begin) > batch_bytes && !text)
+          next = begin + batch_bytes;
+        else if (static_cast<size_t>(end - begin) > batch_bytes)
+          next = std::find(begin + batch_bytes - 1, end, '\n');
+        if (next != end)
+          next += text;
+        evaluate(begin, next);
+        begin = next;
+      }
+    }
+    catch (...)
+    {
+      ::munmap(mapped, size);
+      throw;
+    }
+    ::munmap(mapped, size);
+    return size;
+  }
+
+  /*
+   * Doubles for alignment, filled with raw bytes
+   */
+  std::vector<double> storage(batch_bytes / sizeof(double) + 1);
+  size_t filled = 0;
+  uint64_t total = 0;
+  while (true)
+  {
+    char* buffer = reinterpret_cast<char*>(storage.data());
+    const size_t capacity = storage.size() * sizeof(double);
+    const ssize_t count = ::read(fd, buffer + filled, capacity - filled);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count < 0)
+      throw system_error("could not read", path);
+    filled += static_cast<size_t>(count);
+    total += static_cast<uint64_t>(count);
+
+    if (count == 0)
+    {
+      if (!text && filled % sizeof(double) != 0)
+        throw std::runtime_error(path + " ends in a partial float64");
+      if (filled > 0)
+        evaluate(buffer, buffer + filled);
+      break;
+    }
+    if (filled < capacity)
+      continue;
+
+    const char* next = batch_end(buffer, buffer + filled);
+    if (next == buffer)
+    {
+      /*
+       * A line longer than the buffer
+       */
+      storage.resize(storage.size() * 2);
+      continue;
+    }
+    evaluate(buffer, next);
+    filled = static_cast<size_t>(buffer + filled - next);
+    std::memmove(buffer, next, filled);
+  }
+  if (fd != STDIN_FILENO)
+    ::close(fd);
+  return total;
+}
+
+template<typename Equation>
+void evaluate_stream (const Equation& equation, const CommandLine& command_line)
+{
+  const auto start = std::chrono::steady_clock::now();
+  StreamEvaluator<Equation> evaluator(equation, command_line.output_format, command_line.marker,
+                                      command_line.threads);
+  Output output(command_line.output_path);
+  std::vector<char> buffer;
+  const uint64_t bytes = read_batches(command_line, [&] (const char* begin, const char* end)
+  {
+    if (command_line.input_format == StreamFormat::text)
+      evaluator.evaluate_text(begin, end, buffer);
+    else
+      evaluator.evaluate_float64(reinterpret_cast<const double*>(begin),
+                                 static_cast<size_t>(end - begin) / sizeof(double), buffer);
+    output.write(buffer);
+  });
+
+  if (!command_line.statistics)
+    return;
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  const StreamStatistics& statistics = evaluator.statistics();
+  std::cerr << statistics.inputs << " inputs, " << statistics.out_of_domain << " out of domain, "
+            << bytes << " bytes in " << seconds << " s ("
+            << static_cast<double>(bytes) / seconds / 1e6 << " MB/s, "
+            << static_cast<double>(statistics.inputs) / seconds / 1e6 << " M inputs/s)" << std::endl;
+}
+
+} /* namespace */
+
+int main (int argc, char** argv)
+{
+  CommandLine command_line;
+  try
+  {
+    parse_options(argc, argv, command_line);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << argv[0] << ": " << e.what() << "\n"
+              << "Usage: " << argv[0]
+              << " equation.json [--input path] [--output path] [--input-format text|float64]"
+                 " [--output-format text|float64] [--marker TEXT] [--engine kernel|json_equation]"
+                 " [--threads N] [--batch BYTES] [--statistics]"
+              << std::endl;
+    return 1;
+  }
+
+  try
+  {
+    std::ifstream infile(command_line.equation_path);
+    if (!infile)
+      throw std::runtime_error("could not open " + command_line.equation_path);
+    nlohmann::json json_in;
+    infile >> json_in;
+
+    const JSONEquation equation(json_in);
+    if (command_line.engine == "json_equation")
+      evaluate_stream(equation, command_line);
+    else
+      evaluate_stream(KernelEquation(equation, plan_equation(equation).layout), command_line);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << argv[0] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * json_equation_generator writes a synthetic piecewise equation, generated
+ * deterministically from a seed, as JSON or one of its binary encodings.
+ *
+ * Usage: json_equation_generator [--seed N] [--pieces N] [--start X] [--end X]
+ *                                [--spacing uniform|geometric|random]
+ *                                [--gap-fraction F]
+ *                                [--inclusivity lower|upper|both|alternating|random]
+ *                                [--min-degree N] [--max-degree N]
+ *                                [--powers integer|fractional|real|negative|mixed]
+ *                                [--rational-fraction F]
+ *                                [--format json|cbor|msgpack|ubjson|bson]
+ *                                [--output path]
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "equation_generator.hpp"
+
+using namespace json_equation;
+
+namespace {
+
+/**
+ * Look up an enumerator by name.
+ * @throws runtime_error If name is not one of names
+ */
+template<typename Enum, size_t N>
+Enum parse_name (const std::string& option, const std::string& name, const char* const (&names)[N])
+{
+  for (size_t i = 0; i < N; ++i)
+  {
+    if (name == names[i])
+      return static_cast<Enum>(i);
+  }
+  throw std::runtime_error("unknown value '" + name + "' for " + option);
+}
+
+double parse_double (const std::string& option, const std::string& value)
+{
+  char* end = nullptr;
+  const double parsed = std::strtod(value.c_str(), &end);
+  if (value.empty() || *end != '\0')
+    throw std::runtime_error("invalid number '" + value + "' for " + option);
+  return parsed;
+}
+
+uint64_t parse_unsigned (const std::string& option, const std::string& value)
+{
+  char* end = nullptr;
+  const uint64_t parsed = std::strtoull(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || value[0] == '-')
+    throw std::runtime_error("invalid count '" + value + "' for " + option);
+  return parsed;
+}
+
+void parse_options (const int argc, char** argv, GeneratorOptions& options, EquationFormat& format,
+                    std::string& output_path)
+{
+  static const char* const spacings[] = {"uniform", "geometric", "random"};
+  static const char* const inclusivities[] = {"lower", "upper", "both", "alternating", "random"};
+  static const char* const powers[] = {"integer", "fractional", "real", "negative", "mixed"};
+  static const char* const formats[] = {"json", "cbor", "msgpack", "ubjson", "bson"};
+
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc)
+      throw std::runtime_error("missing value for " + arg);
+    const std::string value = argv[++i];
+
+    if (arg == "--seed")
+      options.seed = parse_unsigned(arg, value);
+    else if (arg == "--pieces")
+      options.pieces = parse_unsigned(arg, value);
+    else if (arg == "--start")
+      options.domain_start = parse_double(arg, value);
+    else if (arg == "--end")
+      options.domain_end = parse_double(arg, value);
+    else if (arg == "--spacing")
+      options.spacing = parse_name<Spacing>(arg, value, spacings);
+    else if (arg == "--gap-fraction")
+      options.gap_fraction = parse_double(arg, value);
+    else if (arg == "--inclusivity")
+      options.inclusivity = parse_name<Inclusivity>(arg, value, inclusivities);
+    else if (arg == "--min-degree")
+      options.min_degree = static_cast<int>(parse_unsigned(arg, value));
+    else if (arg == "--max-degree")
+      options.max_degree = static_cast<int>(parse_unsigned(arg, value));
+    else if (arg == "--powers")
+      options.powers = parse_name<PowerTypes>(arg, value, powers);
+    else if (arg == "--rational-fraction")
+      options.rational_fraction = parse_double(arg, value);
+    else if (arg == "--format")
+      format = parse_name<EquationFormat>(arg, value, formats);
+    else if (arg == "--output")
+      output_path = value;
+    else
+      throw std::runtime_error("unknown option " + arg);
+  }
+}
+
+} /* namespace */
+
+int main (int argc, char** argv)
+{
+  GeneratorOptions options;
+  EquationFormat format = EquationFormat::json;
+  std::string output_path;
+  std::vector<uint8_t> bytes;
+  try
+  {
+    parse_options(argc, argv, options, format, output_path);
+    bytes = encode_equation(generate_equation(options), format);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << argv[0] << ": " << e.what() << "\n"
+              << "Usage: " << argv[0]
+              << " [--seed N] [--pieces N] [--start X] [--end X] [--spacing uniform|geometric|random]"
+                 " [--gap-fraction F] [--inclusivity lower|upper|both|alternating|random]"
+                 " [--min-degree N] [--max-degree N] [--powers integer|fractional|real|negative|mixed]"
+                 " [--rational-fraction F] [--format json|cbor|msgpack|ubjson|bson] [--output path]"
+              << std::endl;
+    return 1;
+  }
+
+  std::ofstream outfile;
+  if (!output_path.empty())
+  {
+    outfile.open(output_path, std::ios::binary);
+    if (!outfile)
+    {
+      std::cerr << argv[0] << ": could not open " << output_path << std::endl;
+      return 1;
+    }
+  }
+  std::ostream& os = output_path.empty() ? std::cout : outfile;
+  os.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+  if (format == EquationFormat::json)
+    os << "\n";
+  return os ? 0 : 1;
+}
@@ -0,0 +1,30 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * Explicit instantiations of the JSON loader for the json_equation_loader
+ * library, so that nlohmann::json is compiled into this one object file.
+ * Translation units linking the library only need json_equation_core.hpp to
+ * construct equations from JSON.
+ */
+
+#include "json_equation.hpp"
+
+namespace json_equation {
+
+template BasicJSONEquation<float>::BasicJSONEquation (std::istream&);
+template BasicJSONEquation<float>::BasicJSONEquation (const nlohmann::json&);
+template BasicJSONEquation<double>::BasicJSONEquation (std::istream&);
+template BasicJSONEquation<double>::BasicJSONEquation (const nlohmann::json&);
+template BasicJSONEquation<long double>::BasicJSONEquation (std::istream&);
+template BasicJSONEquation<long double>::BasicJSONEquation (const nlohmann::json&);
+template BasicJSONEquation<float>::BasicJSONEquation (std::istream&, LoadReport&);
+template BasicJSONEquation<float>::BasicJSONEquation (const nlohmann::json&, LoadReport&);
+template BasicJSONEquation<double>::BasicJSONEquation (std::istream&, LoadReport&);
+template BasicJSONEquation<double>::BasicJSONEquation (const nlohmann::json&, LoadReport&);
+template BasicJSONEquation<long double>::BasicJSONEquation (std::istream&, LoadReport&);
+template BasicJSONEquation<long double>::BasicJSONEquation (const nlohmann::json&, LoadReport&);
+
+} /* namespace json_equation */
@@ -0,0 +1,51 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * json_equation_plan prints the evaluation plan for an equation as JSON, to
+ * be inspected, edited and compiled with layout_from_json().
+ *
+ * Usage: json_equation_plan equation.json [--calibrate]
+ *
+ * --calibrate measures the cost model on this machine instead of using the
+ * defaults.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "evaluation_planner.hpp"
+
+using namespace json_equation;
+
+int main (int argc, char** argv)
+{
+  const bool calibrate = argc == 3 && std::string(argv[2]) == "--calibrate";
+  if (argc < 2 || (argc == 3 && !calibrate) || argc > 3)
+  {
+    std::cerr << "Usage: " << argv[0] << " equation.json [--calibrate]" << std::endl;
+    return 1;
+  }
+
+  try
+  {
+    std::ifstream infile(argv[1]);
+    if (!infile)
+      throw std::runtime_error(std::string("could not open ") + argv[1]);
+    nlohmann::json json_in;
+    infile >> json_in;
+
+    const CostModel model = calibrate ? CostModel::calibrate() : CostModel();
+    std::cout << plan_json(plan_equation(JSONEquation(json_in), model)).dump(2) << std::endl;
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << argv[0] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,793 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * KernelEquation classifies every piece of a JSONEquation by the shape of its
+ * polynomial (constant, affine, quadratic, cubic, dense, rational or general
+ * real powers) and evaluates it with a kernel specialized for that shape.
+ * Low-degree pieces keep their coefficients inline, so the common case is a
+ * piece search, one indirect call and a few multiply-adds. Given an access
+ * profile, it lays out hot pieces first and searches a tree weighted towards
+ * them.
+ */
+
+#ifndef KERNEL_EQUATION_HPP
+#define KERNEL_EQUATION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "json_equation_core.hpp"
+
+namespace json_equation {
+
+/**
+ * KernelEquation is a compiled, read-only form of a JSONEquation in which each
+ * piece is evaluated by a kernel chosen for its shape:
+ *
+ * - constant, affine, quadratic, cubic: a polynomial with non-negative
+ *   integer powers over a nonzero constant denominator, with the
+ *   denominator folded into the (inline) coefficients.
+ * - dense: the same, of higher degree, with coefficients stored out of line.
+ * - rational: numerator and denominator with integer powers, each evaluated
+ *   as x^m times a Horner-form polynomial. Negative powers are only used in
+ *   pieces whose range excludes 0.
+ * - general: anything else, evaluated by the piece's PolynomialEquation.
+ *
+ * Horner form and folded denominators round differently from a sum of
+ * powers, so results agree with JSONEquation::calculate to within a few ULP
+ * rather than bit for bit.
+ *
+ * A profile-guided KernelEquation is compiled from hit counts per piece, e.g.
+ * JSONEquation::usage().piece_hits or profile() of a sampled trace. Copies
+ * of the hot pieces and their out-of-line coefficients are stored first, in
+ * descending order of hits, so that they share the first cache lines of the
+ * piece and coefficient arrays, and lookups first walk a
+ * search tree built by weight bisection (Mehlhorn), in which a piece with a
+ * share p of the hits sits at depth of about log2(1/p) rather than
+ * log2(pieces). The tree only covers spans of pieces that drew a noticeable
+ * share of the hits; a walk that leaves it finishes with a binary search of
+ * the span it narrowed down to, so cold pieces cost about what they did
+ * before.
+ *
+ * A KernelEquation can also be compiled to an explicit Layout, e.g. one
+ * chosen by plan_equation() (evaluation_planner.hpp): a lookup structure, and
+ * per piece either its own kernel or the general one.
+ */
+class KernelEquation
+{
+public:
+  enum class Kernel : uint8_t
+  {
+    constant,
+    affine,
+    quadratic,
+    cubic,
+    dense,
+    rational,
+    general
+  };
+
+  /**
+   * How pieces are looked up. binary_search searches the bound arrays.
+   * direct_index divides the domain into one cell per piece and keeps, for
+   * each cell, the first piece that could contain it, so that evenly spaced
+   * pieces are found in a step or two.
+   */
+  enum class Lookup : uint8_t
+  {
+    binary_search,
+    direct_index
+  };
+
+  /**
+   * Lookup structure and kernel per piece.
+   */
+  struct Layout
+  {
+    Lookup lookup = Lookup::binary_search;
+
+    /*
+     * Kernel per piece, in ascending order of bounds: each piece's own
+     * kernel or general. Empty for every piece's own kernel.
+     */
+    std::vector<Kernel> kernels;
+  };
+
+  /**
+   * The direct_index lookup: for each cell of the domain, the first piece
+   * whose upper bound falls in that cell or later, then the piece count.
+   * Cell c covers offsets [c, c + 1) of (x - origin) * scale.
+   */
+  struct DirectIndex
+  {
+    std::vector<uint32_t> cells;
+    double origin = 0;
+    double scale = 0;
+
+    /**
+     * @return Cell of x, clamped to the first and last cells. Non-decreasing
+     * in x, which is all the lookup relies on.
+     */
+    size_t cell_of (const double x) const
+    {
+      const double offset = (x - origin) * scale;
+      if (!(offset > 0))
+        return 0;
+      const size_t last = cells.size() - 2;
+      return offset >= static_cast<double>(last) ? last : static_cast<size_t>(offset);
+    }
+  };
+
+  /**
+   * Build a direct index with one cell per piece. The piece containing x is
+   * the first whose upper bound is not below x: no earlier than the first
+   * piece whose upper bound is in x's cell or later, and no later than the
+   * first whose upper bound is in a later cell, as cell_of is monotonic.
+   * @param lower_bounds Lower bounds of the pieces, in ascending order
+   * @param upper_bounds Upper bounds of the pieces, in the same order
+   * @throws invalid_argument If the domain is not finite and wider than 0
+   */
+  static DirectIndex index_cells (const std::vector<double>& lower_bounds, const std::vector<double>& upper_bounds)
+  {
+    const size_t count = upper_bounds.size();
+    const double lo = count == 0 ? 0 : lower_bounds.front();
+    const double hi = count == 0 ? 0 : upper_bounds.back();
+    if (!std::isfinite(lo) || !std::isfinite(hi) || !(hi > lo))
+      throw std::invalid_argument("A direct index needs a finite domain wider than 0.");
+
+    DirectIndex index;
+    index.origin = lo;
+    index.scale = static_cast<double>(count) / (hi - lo);
+    index.cells.assign(count + 1, static_cast<uint32_t>(count));
+    size_t rank = 0;
+    for (size_t cell = 0; cell < count; ++cell)
+    {
+      while (rank < count && index.cell_of(upper_bounds[rank]) < cell)
+        ++rank;
+      index.cells[cell] = static_cast<uint32_t>(rank);
+    }
+    return index;
+  }
+
+  KernelEquation () = default;
+
+  /**
+   * Classify and compile every piece of an equation.
+   * @param equation Loaded equation. Its pieces' pole analysis decides which
+   * rational pieces need pole checks.
+   */
+  explicit KernelEquation (const JSONEquation& equation)
+  {
+    for (const auto& piece : equation.pieces)
+    {
+      lower_bounds.push_back(piece.first.lb);
+      upper_bounds.push_back(piece.first.ub);
+      lb_inclusive.push_back(piece.first.lb_inclusive);
+      ub_inclusive.push_back(piece.first.ub_inclusive);
+      pieces.push_back(compile_piece(piece.first, piece.second));
+    }
+  }
+
+  /**
+   * Compile every piece of an equation to a given layout.
+   * @param equation Loaded equation
+   * @param layout Lookup and kernels, e.g. EvaluationPlan::layout
+   * @throws invalid_argument If layout.kernels is neither empty nor one per
+   * piece, names a kernel other than general that does not fit its piece, or
+   * asks for direct_index over a domain that is not finite and wider than 0
+   */
+  KernelEquation (const JSONEquation& equation, const Layout& layout)
+  {
+    if (!layout.kernels.empty() && layout.kernels.size() != equation.pieces.size())
+      throw std::invalid_argument("Layout has " + std::to_string(layout.kernels.size())
+                                  + " kernels, but the equation has " + std::to_string(equation.pieces.size())
+                                  + " pieces.");
+
+    for (const auto& piece : equation.pieces)
+    {
+      const size_t idx = pieces.size();
+      lower_bounds.push_back(piece.first.lb);
+      upper_bounds.push_back(piece.first.ub);
+      lb_inclusive.push_back(piece.first.lb_inclusive);
+      ub_inclusive.push_back(piece.first.ub_inclusive);
+      const bool force_general = !layout.kernels.empty() && layout.kernels[idx] == Kernel::general;
+      pieces.push_back(compile_piece(piece.first, piece.second, force_general));
+      if (!layout.kernels.empty() && pieces.back().kernel != layout.kernels[idx])
+        throw std::invalid_argument("Piece at index " + std::to_string(idx) + " is " + kernel_name(pieces.back().kernel)
+                                    + " and cannot be evaluated by the " + kernel_name(layout.kernels[idx])
+                                    + " kernel.");
+    }
+
+    if (layout.lookup == Lookup::direct_index)
+      index = index_cells(lower_bounds, upper_bounds);
+  }
+
+  /**
+   * Classify and compile every piece of an equation, laid out for an access
+   * profile.
+   * @param equation Loaded equation
+   * @param piece_hits Hits per piece, in ascending order of bounds. Pieces
+   * without hits are still found, in at most a few more steps than a binary
+   * search would take.
+   * @throws invalid_argument If piece_hits does not have one count per piece
+   */
+  KernelEquation (const JSONEquation& equation, const std::vector<uint64_t>& piece_hits)
+  {
+    const size_t count = equation.pieces.size();
+    if (piece_hits.size() != count)
+      throw std::invalid_argument("Profile has " + std::to_string(piece_hits.size())
+                                  + " piece counts, but the equation has " + std::to_string(count) + " pieces.");
+
+    std::vector<const JSONEquation::PieceMap::value_type*> sorted;
+    for (const auto& piece : equation.pieces)
+    {
+      lower_bounds.push_back(piece.first.lb);
+      upper_bounds.push_back(piece.first.ub);
+      lb_inclusive.push_back(piece.first.lb_inclusive);
+      ub_inclusive.push_back(piece.first.ub_inclusive);
+      sorted.push_back(&piece);
+    }
+    build_tree(piece_hits);
+
+    /*
+     * Copies of the pieces in the tree go first, hottest first, then every
+     * piece in ascending order of bounds for the binary search
+     */
+    for (const uint32_t rank : hot_ranks)
+      pieces.push_back(compile_piece(sorted[rank]->first, sorted[rank]->second));
+    for (const auto* piece : sorted)
+      pieces.push_back(compile_piece(piece->first, piece->second));
+  }
+
+  /**
+   * Calculate the output of the polynomial system given input x. If x is not
+   * included in the range for any piece, std::nullopt is returned instead.
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range. Else, double val
+   */
+  std::optional<double> calculate (const double x) const
+  {
+    using Evaluator = double (KernelEquation::*) (const Piece&, double) const;
+    static constexpr Evaluator kernels[] = {
+        &KernelEquation::evaluate<Kernel::constant>,
+        &KernelEquation::evaluate<Kernel::affine>,
+        &KernelEquation::evaluate<Kernel::quadratic>,
+        &KernelEquation::evaluate<Kernel::cubic>,
+        &KernelEquation::evaluate<Kernel::dense>,
+        &KernelEquation::evaluate<Kernel::rational>,
+        &KernelEquation::evaluate<Kernel::general>};
+
+    const size_t idx = find_piece(x);
+    if (idx == npos)
+      return std::nullopt;
+    const Piece& piece = pieces[idx];
+    return (this->*kernels[static_cast<size_t>(piece.kernel)])(piece, x);
+  }
+
+  std::optional<double> operator() (const double x) const
+  {
+    return calculate(x);
+  }
+
+  /**
+   * @return Number of pieces
+   */
+  size_t size () const
+  {
+    return pieces.size() - hot_ranks.size();
+  }
+
+  /**
+   * @param idx Index of a piece, in ascending order of bounds
+   * @return The kernel the piece was compiled to
+   */
+  Kernel kernel (const size_t idx) const
+  {
+    return pieces[hot_ranks.size() + idx].kernel;
+  }
+
+  /**
+   * @return The lookup and every piece's kernel, in ascending order of bounds
+   */
+  Layout layout () const
+  {
+    Layout current;
+    current.lookup = index.cells.empty() ? Lookup::binary_search : Lookup::direct_index;
+    for (size_t idx = 0; idx < size(); ++idx)
+      current.kernels.push_back(kernel(idx));
+    return current;
+  }
+
+  static const char* kernel_name (const Kernel kernel)
+  {
+    static const char* const names[] = {"constant", "affine", "quadratic", "cubic", "dense", "rational", "general"};
+    return names[static_cast<size_t>(kernel)];
+  }
+
+  static const char* lookup_name (const Lookup lookup)
+  {
+    return lookup == Lookup::direct_index ? "direct_index" : "binary_search";
+  }
+
+  /**
+   * @return Whether an access profile changed the layout, i.e. some pieces
+   * drew enough hits to be placed in a search tree
+   */
+  bool profiled () const
+  {
+    return !tree.empty();
+  }
+
+  /**
+   * Count the pieces a trace of inputs lands in, as a profile for the
+   * profile-guided constructor. A trace sampled from production inputs will
+   * do; only the proportions matter.
+   * @param trace Inputs to the system of equations
+   * @return Hits per piece, in ascending order of bounds
+   */
+  std::vector<uint64_t> profile (const std::vector<double>& trace) const
+  {
+    std::vector<uint64_t> hits(size(), 0);
+    for (const double x : trace)
+    {
+      const size_t slot = find_piece(x);
+      if (slot == npos)
+        continue;
+      ++hits[slot < hot_ranks.size() ? hot_ranks[slot] : slot - hot_ranks.size()];
+    }
+    return hits;
+  }
+
+  /**
+   * @return Memory held by this equation: bound arrays as index, pieces
+   * (with their inline coefficients) and out-of-line coefficients as
+   * polynomials, and pieces left to the general kernel as for JSONEquation
+   */
+  MemoryUsage memory_usage () const
+  {
+    MemoryUsage usage;
+    usage.metadata += sizeof(*this);
+    detail::count_vector(usage, usage.index, lower_bounds);
+    detail::count_vector(usage, usage.index, upper_bounds);
+    detail::count_vector(usage, usage.index, lb_inclusive);
+    detail::count_vector(usage, usage.index, ub_inclusive);
+    detail::count_vector(usage, usage.index, tree);
+    detail::count_vector(usage, usage.index, index.cells);
+    detail::count_vector(usage, usage.metadata, hot_ranks);
+    detail::count_vector(usage, usage.polynomials, pieces);
+    detail::count_vector(usage, usage.polynomials, coefficients);
+    detail::count_vector(usage, usage.metadata, general);
+    for (const auto& function : general)
+      usage += function.memory_usage();
+    return usage;
+  }
+
+private:
+  static constexpr size_t npos = detail::no_piece;
+
+  /*
+   * Powers beyond this magnitude are left to the general kernel.
+   */
+  static constexpr double max_horner_power = 64;
+
+  /**
+   * A compiled piece. Constant to cubic kernels only read the inline
+   * coefficients c0 + c1 x + c2 x^2 + c3 x^3.
+   */
+  struct Piece
+  {
+    double c[4] = {0, 0, 0, 0};
+    uint32_t offset = 0;             /* dense, rational: into coefficients. general: into general */
+    uint16_t numerator_terms = 0;    /* dense, rational: Horner coefficients of the numerator in x */
+    uint16_t denominator_terms = 0;  /* rational: Horner coefficients of the denominator in x */
+    int16_t numerator_shift = 0;     /* rational: lowest non-negative power of the numerator */
+    int16_t denominator_shift = 0;   /* rational: lowest non-negative power of the denominator */
+    uint8_t numerator_recip_terms = 0;    /* rational: Horner coefficients of the numerator in 1/x */
+    uint8_t denominator_recip_terms = 0;  /* rational: Horner coefficients of the denominator in 1/x */
+    Kernel kernel = Kernel::general;
+    bool checked = true;             /* rational: whether to apply pole checks */
+  };
+
+  /*
+   * Piece bounds, in ascending order, as parallel arrays for the search
+   */
+  std::vector<double> lower_bounds;
+  std::vector<double> upper_bounds;
+  std::vector<bool> lb_inclusive;
+  std::vector<bool> ub_inclusive;
+
+  /*
+   * Pieces in ascending order of bounds, preceded if profiled by copies of
+   * the pieces in the search tree in descending order of hits
+   */
+  std::vector<Piece> pieces;
+
+  /**
+   * A hot piece in the search tree of a profiled equation. Children are
+   * indices into the tree, or no_node where the walk ends in a binary search.
+   * Slots index the hot copies at the front of pieces, and are limited to
+   * 30 bits to keep nodes at 32 bytes.
+   */
+  struct SearchNode
+  {
+    double lb = 0;
+    double ub = 0;
+    uint32_t below = 0;
+    uint32_t above = 0;
+    uint32_t rank = 0;
+    uint32_t slot : 30;
+    uint32_t lb_inclusive : 1;
+    uint32_t ub_inclusive : 1;
+  };
+
+  static constexpr uint32_t no_node = static_cast<uint32_t>(-1);
+
+  /*
+   * Profiled only: the search tree in breadth-first order, so the hot top
+   * levels are contiguous, and the rank (index in ascending order of bounds)
+   * of each hot copy
+   */
+  std::vector<SearchNode> tree;
+  std::vector<uint32_t> hot_ranks;
+
+  /*
+   * direct_index only
+   */
+  DirectIndex index;
+
+  /*
+   * Out-of-line Horner coefficients, highest power first, and the pieces
+   * left to the general kernel
+   */
+  std::vector<double> coefficients;
+  std::vector<PolynomialEquation> general;
+
+  template<Kernel K>
+  double evaluate (const Piece& piece, const double x) const
+  {
+    if constexpr (K == Kernel::constant)
+    {
+      return piece.c[0];
+    }
+    else if constexpr (K == Kernel::affine)
+    {
+      return piece.c[0] + x * piece.c[1];
+    }
+    else if constexpr (K == Kernel::quadratic)
+    {
+      return piece.c[0] + x * (piece.c[1] + x * piece.c[2]);
+    }
+    else if constexpr (K == Kernel::cubic)
+    {
+      return piece.c[0] + x * (piece.c[1] + x * (piece.c[2] + x * piece.c[3]));
+    }
+    else if constexpr (K == Kernel::dense)
+    {
+      return horner(coefficients.data() + piece.offset, piece.numerator_terms, x);
+    }
+    else if constexpr (K == Kernel::rational)
+    {
+      const double* const c = coefficients.data() + piece.offset;
+      const double r = (piece.numerator_recip_terms || piece.denominator_recip_terms) ? 1 / x : 0;
+      const double numerator_val = laurent(c, piece.numerator_terms, piece.numerator_shift,
+                                           piece.numerator_recip_terms, x, r);
+      const double denominator_val = laurent(c + piece.numerator_terms + piece.numerator_recip_terms,
+                                             piece.denominator_terms, piece.denominator_shift,
+                                             piece.denominator_recip_terms, x, r);
+      if (piece.checked)
+        return checked_divide(numerator_val, denominator_val);
+      return numerator_val / denominator_val;
+    }
+    else
+    {
+      return general[piece.offset].calculate(x);
+    }
+  }
+
+  static double horner (const double* c, const size_t count, const double x)
+  {
+    double acc = c[0];
+    for (size_t i = 1; i < count; ++i)
+      acc = acc * x + c[i];
+    return acc;
+  }
+
+  /**
+   * Evaluate a sum of integer powers as a Horner polynomial in x for its
+   * non-negative powers plus one in r = 1 / x for its negative powers. A
+   * single Horner polynomial over the whole span, scaled by x^m for the
+   * lowest power m, would overflow for large |x| where the sum does not.
+   */
+  static double laurent (const double* c, const size_t terms, const int shift, const size_t recip_terms,
+                         const double x, const double r)
+  {
+    double sum = terms ? horner(c, terms, x) * detail::ladder_power(x, shift) : 0;
+    if (recip_terms)
+      sum += horner(c + terms, recip_terms, r) * r;
+    return sum;
+  }
+
+  static double checked_divide (const double numerator_val, const double denominator_val)
+  {
+    if (numerator_val == 0 && denominator_val == 0)
+      return 0;
+    else if (numerator_val != 0 && denominator_val == 0)
+      return std::numeric_limits<double>::infinity();
+    return numerator_val / denominator_val;
+  }
+
+  size_t find_piece (const double x) const
+  {
+    /*
+     * Every node passed on the way down narrows the ranks x can be in
+     */
+    size_t lo = 0;
+    size_t hi = upper_bounds.size();
+    if (!index.cells.empty())
+    {
+      const size_t cell = index.cell_of(x);
+      lo = index.cells[cell];
+      hi = std::min<size_t>(index.cells[cell + 1] + 1, hi);
+    }
+    uint32_t idx = tree.empty() ? no_node : 0;
+    while (idx != no_node)
+    {
+      const SearchNode& node = tree[idx];
+      if (x > node.ub || (x == node.ub && !node.ub_inclusive))
+      {
+        lo = node.rank + 1;
+        idx = node.above;
+      }
+      else if (x > node.lb || (x == node.lb && node.lb_inclusive))
+      {
+        return node.slot;
+      }
+      else
+      {
+        hi = node.rank;
+        idx = node.below;
+      }
+    }
+
+    const size_t rank = find_rank(x, lo, hi);
+    return rank == npos ? npos : hot_ranks.size() + rank;
+  }
+
+  /**
+   * Binary search for x among the pieces of ranks [lo, hi).
+   * @return Rank of the piece containing x, or npos
+   */
+  size_t find_rank (const double x, const size_t lo, const size_t end) const
+  {
+    /*
+     * The tree walk and cell_of send NaN here rather than deciding for it
+     */
+    return detail::find_in_bounds(x, lower_bounds, upper_bounds, lb_inclusive, ub_inclusive, lo, end);
+  }
+
+  /**
+   * Build the search tree by weight bisection: the root of each subtree is
+   * the piece at which the cumulative weight of the subtree's pieces crosses
+   * half. A piece's weight is its hits plus a floor of 1/8 of the mean, which
+   * keeps cold pieces from sinking much below log2(pieces). Spans with less
+   * than 1/256 of the hits are left to binary search.
+   * @param piece_hits Hits per piece, in ascending order of bounds
+   */
+  void build_tree (const std::vector<uint64_t>& piece_hits)
+  {
+    const size_t count = piece_hits.size();
+    const double total = std::accumulate(piece_hits.begin(), piece_hits.end(), 0.0);
+    const double floor = std::max(1.0, total / static_cast<double>(8 * std::max<size_t>(count, 1)));
+    const double min_hits = std::max(1.0, total / 256);
+    std::vector<double> hits(count + 1, 0.0);
+    std::vector<double> cumulative(count + 1, 0.0);
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+      hits[idx + 1] = hits[idx] + static_cast<double>(piece_hits[idx]);
+      cumulative[idx + 1] = cumulative[idx] + static_cast<double>(piece_hits[idx]) + floor;
+    }
+
+    /*
+     * Subtrees to build: pieces [first, last) and the child link to set
+     */
+    struct Span
+    {
+      size_t first;
+      size_t last;
+      size_t parent;
+      bool above;
+    };
+    std::vector<Span> spans;
+    if (count > 0 && hits[count] >= min_hits)
+      spans.push_back({0, count, 0, false});
+    for (size_t next = 0; next < spans.size(); ++next)
+    {
+      const Span span = spans[next];
+      const double half = (cumulative[span.first] + cumulative[span.last]) / 2;
+      const auto crossing = std::lower_bound(cumulative.begin() + span.first + 1,
+                                             cumulative.begin() + span.last, half);
+      const size_t root = static_cast<size_t>(crossing - cumulative.begin()) - 1;
+
+      SearchNode node;
+      node.lb = lower_bounds[root];
+      node.ub = upper_bounds[root];
+      node.below = node.above = no_node;
+      node.rank = static_cast<uint32_t>(root);
+      node.slot = 0;
+      node.lb_inclusive = lb_inclusive[root];
+      node.ub_inclusive = ub_inclusive[root];
+      const uint32_t idx = static_cast<uint32_t>(tree.size());
+      tree.push_back(node);
+      if (next > 0)
+        (span.above ? tree[span.parent].above : tree[span.parent].below) = idx;
+
+      if (hits[root] - hits[span.first] >= min_hits)
+        spans.push_back({span.first, root, idx, false});
+      if (hits[span.last] - hits[root + 1] >= min_hits)
+        spans.push_back({root + 1, span.last, idx, true});
+    }
+
+    /*
+     * Hot copies in descending order of hits, ties in ascending order of
+     * bounds
+     */
+    std::vector<uint32_t> order(tree.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&] (const uint32_t a, const uint32_t b)
+    {
+      return piece_hits[tree[a].rank] > piece_hits[tree[b].rank];
+    });
+    for (size_t slot = 0; slot < order.size(); ++slot)
+    {
+      tree[order[slot]].slot = static_cast<uint32_t>(slot);
+      hot_ranks.push_back(tree[order[slot]].rank);
+    }
+  }
+
+  /**
+   * Collect a sum of monomials into coefficients keyed by integer power.
+   * @return Whether every power is an integer within max_horner_power, and
+   * non-negative unless negative powers are allowed
+   */
+  static bool integer_terms (const std::vector<Monomial>& terms, const bool allow_negative,
+                             std::map<long, double>& collected)
+  {
+    for (const auto& term : terms)
+    {
+      if (detail::plan_term(term.power).kind != detail::PowerKind::integer
+          || std::fabs(term.power) > max_horner_power || (term.power < 0 && !allow_negative))
+        return false;
+      collected[static_cast<long>(term.power)] += term.coefficient;
+    }
+    return true;
+  }
+
+  /**
+   * Append the Horner coefficients (highest power first) of a collected sum
+   * from its highest power down to its lowest.
+   * @return Number of coefficients appended
+   */
+  uint16_t append_horner (const std::map<long, double>& collected)
+  {
+    if (collected.empty())
+    {
+      coefficients.push_back(0);
+      return 1;
+    }
+
+    const long lowest = collected.begin()->first;
+    const long highest = collected.rbegin()->first;
+    for (long power = highest; power >= lowest; --power)
+    {
+      const auto found = collected.find(power);
+      coefficients.push_back(found != collected.end() ? found->second : 0.0);
+    }
+    return static_cast<uint16_t>(highest - lowest + 1);
+  }
+
+  /**
+   * Append the Horner coefficients of a collected sum's non-negative powers
+   * in x, then of its negative powers in 1/x from the most negative down to
+   * -1. Either part may be empty.
+   */
+  void append_laurent (const std::map<long, double>& collected, uint16_t& terms, int16_t& shift,
+                       uint8_t& recip_terms)
+  {
+    const auto split = collected.lower_bound(0);
+    const std::map<long, double> non_negative(split, collected.end());
+    terms = 0;
+    shift = 0;
+    if (!non_negative.empty() || split == collected.begin())
+    {
+      shift = static_cast<int16_t>(non_negative.empty() ? 0 : non_negative.begin()->first);
+      terms = append_horner(non_negative);
+    }
+
+    recip_terms = 0;
+    if (split == collected.begin())
+      return;
+    const long most_negative = collected.begin()->first;
+    for (long power = most_negative; power < 0; ++power)
+    {
+      const auto found = collected.find(power);
+      coefficients.push_back(found != collected.end() ? found->second : 0.0);
+    }
+    recip_terms = static_cast<uint8_t>(-most_negative);
+  }
+
+  /**
+   * @param force_general Compile to the general kernel whatever the shape
+   */
+  Piece compile_piece (const numeric_range::NumericRange<double>& range,
+                       const PolynomialEquation& function, const bool force_general = false)
+  {
+    Piece piece;
+    const bool nonzero = range.lb > 0 || (range.lb == 0 && !range.lb_inclusive)
+                         || range.ub < 0 || (range.ub == 0 && !range.ub_inclusive);
+
+    std::map<long, double> numerator;
+    std::map<long, double> denominator;
+    const bool integer = !force_general && integer_terms(function.numerator, nonzero, numerator)
+                         && integer_terms(function.denominator, nonzero, denominator);
+    if (!integer)
+    {
+      piece.kernel = Kernel::general;
+      piece.offset = static_cast<uint32_t>(general.size());
+      general.push_back(function);
+      return piece;
+    }
+
+    /*
+     * A polynomial over a nonzero constant: fold the constant into the
+     * coefficients and drop the denominator
+     */
+    const bool constant_denominator = denominator.size() == 1 && denominator.begin()->first == 0
+                                      && denominator.begin()->second != 0;
+    if (constant_denominator && (numerator.empty() || numerator.begin()->first >= 0))
+    {
+      std::map<long, double> folded;
+      for (const auto& [power, coefficient] : numerator)
+      {
+        if (coefficient != 0)
+          folded[power] = coefficient / denominator.begin()->second;
+      }
+
+      const long degree = folded.empty() ? 0 : folded.rbegin()->first;
+      if (degree <= 3)
+      {
+        piece.kernel = static_cast<Kernel>(degree);
+        for (const auto& [power, coefficient] : folded)
+          piece.c[power] = coefficient;
+        return piece;
+      }
+
+      folded[0] += 0;
+      piece.kernel = Kernel::dense;
+      piece.offset = static_cast<uint32_t>(coefficients.size());
+      piece.numerator_terms = append_horner(folded);
+      return piece;
+    }
+
+    piece.kernel = Kernel::rational;
+    piece.checked = function.pole_status() != PoleStatus::pole_free;
+    piece.offset = static_cast<uint32_t>(coefficients.size());
+    append_laurent(numerator, piece.numerator_terms, piece.numerator_shift, piece.numerator_recip_terms);
+    append_laurent(denominator, piece.denominator_terms, piece.denominator_shift, piece.denominator_recip_terms);
+    return piece;
+  }
+};
+
+} /* namespace json_equation */
+
+#endif //KERNEL_EQUATION_HPP
@@ -0,0 +1,437 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * Latency instrumentation for equation evaluation. TimedEquation wraps a
+ * JSONEquation and records how long its calculate() calls take, in cycle
+ * counter ticks, into per-thread log-bucketed histograms that can be merged,
+ * queried for percentiles and exported as text.
+ */
+
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+#include "json_equation_core.hpp"
+#include "thread_slots.hpp"
+
+namespace json_equation {
+
+namespace detail {
+
+/**
+ * Read the cycle counter. rdtsc is not serializing, so very short intervals
+ * are approximate; on other architectures steady_clock nanoseconds are used.
+ */
+inline uint64_t read_ticks ()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+inline int highest_bit (const uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return 63 - __builtin_clzll(value);
+#else
+  int bit = 0;
+  for (uint64_t v = value; v >>= 1;)
+    ++bit;
+  return bit;
+#endif
+}
+
+struct ThreadHistogram;
+
+} /* namespace detail */
+
+/**
+ * Estimate how many ticks of read_ticks() pass per nanosecond, by timing a
+ * short busy wait against steady_clock. The estimate is made once.
+ */
+inline double ticks_per_ns ()
+{
+  static const double estimate = [] ()
+  {
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t start_ticks = detail::read_ticks();
+    auto now = start;
+    while (now - start < std::chrono::milliseconds(10))
+      now = std::chrono::steady_clock::now();
+    const uint64_t stop_ticks = detail::read_ticks();
+    const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+    return static_cast<double>(stop_ticks - start_ticks) / ns;
+  }();
+  return estimate;
+}
+
+/**
+ * LatencyHistogram counts values in logarithmic buckets: values below 8 are
+ * counted exactly, and every power of two above is split into 8 linear
+ * sub-buckets, so a bucket's bounds are within 12.5% of any value in it.
+ */
+class LatencyHistogram
+{
+public:
+  static constexpr int sub_bucket_bits = 3;
+  static constexpr size_t sub_buckets = size_t{1} << sub_bucket_bits;
+  static constexpr size_t bucket_count = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+  /**
+   * @return Index of the bucket counting value
+   */
+  static size_t bucket_of (const uint64_t value)
+  {
+    if (value < sub_buckets)
+      return static_cast<size_t>(value);
+    const int exponent = detail::highest_bit(value);
+    const uint64_t sub = (value >> (exponent - sub_bucket_bits)) & (sub_buckets - 1);
+    return static_cast<size_t>(exponent - sub_bucket_bits + 1) * sub_buckets + static_cast<size_t>(sub);
+  }
+
+  /**
+   * @return Smallest value counted by bucket idx
+   */
+  static uint64_t bucket_lower (const size_t idx)
+  {
+    if (idx < sub_buckets)
+      return idx;
+    const int shift = static_cast<int>(idx / sub_buckets) - 1;
+    return (sub_buckets + idx % sub_buckets) << shift;
+  }
+
+  /**
+   * @return Largest value counted by bucket idx
+   */
+  static uint64_t bucket_upper (const size_t idx)
+  {
+    return (idx + 1 == bucket_count) ? std::numeric_limits<uint64_t>::max() : bucket_lower(idx + 1) - 1;
+  }
+
+  void record (const uint64_t value, const uint64_t count = 1)
+  {
+    counts[bucket_of(value)] += count;
+    total += count;
+    sum += value * count;
+    min_value = std::min(min_value, value);
+    max_value = std::max(max_value, value);
+  }
+
+  /**
+   * Add the counts of another histogram to this one.
+   */
+  void merge (const LatencyHistogram& other)
+  {
+    for (size_t i = 0; i < bucket_count; ++i)
+      counts[i] += other.counts[i];
+    total += other.total;
+    sum += other.sum;
+    min_value = std::min(min_value, other.min_value);
+    max_value = std::max(max_value, other.max_value);
+  }
+
+  void reset ()
+  {
+    *this = LatencyHistogram();
+  }
+
+  uint64_t count () const
+  {
+    return total;
+  }
+
+  uint64_t count (const size_t idx) const
+  {
+    return counts[idx];
+  }
+
+  /**
+   * @return Smallest recorded value, or 0 if empty
+   */
+  uint64_t min () const
+  {
+    return total ? min_value : 0;
+  }
+
+  uint64_t max () const
+  {
+    return max_value;
+  }
+
+  double mean () const
+  {
+    return total ? static_cast<double>(sum) / static_cast<double>(total) : 0.0;
+  }
+
+  /**
+   * @param p Percentile in [0, 100]
+   * @return Upper bound of the bucket holding the p-th percentile, clamped
+   * to the recorded extremes, or 0 if empty
+   */
+  uint64_t percentile (const double p) const
+  {
+    if (total == 0)
+      return 0;
+    const double clamped = std::clamp(p, 0.0, 100.0);
+    const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(
+        static_cast<double>(total) * clamped / 100.0 + 0.5));
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; ++i)
+    {
+      seen += counts[i];
+      if (seen >= rank)
+        return std::clamp(bucket_upper(i), min_value, max_value);
+    }
+    return max_value;
+  }
+
+  /**
+   * Write the histogram as text: a summary line of count, min, mean, max and
+   * common percentiles, followed by one line per non-empty bucket with its
+   * bounds, count and the cumulative fraction of values up to it.
+   * @param os Stream to write to
+   * @param scale Values are divided by this before writing, e.g. ticks_per_ns()
+   * to write nanoseconds
+   */
+  void write_text (std::ostream& os, const double scale = 1.0) const
+  {
+    const auto scaled = [scale] (const double value) { return value / scale; };
+    os << "count " << total << " min " << scaled(static_cast<double>(min()))
+       << " mean " << scaled(mean()) << " max " << scaled(static_cast<double>(max()));
+    for (const double p : {50.0, 90.0, 99.0, 99.9, 99.99})
+      os << " p" << p << " " << scaled(static_cast<double>(percentile(p)));
+    os << "\n";
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; ++i)
+    {
+      if (counts[i] == 0)
+        continue;
+      seen += counts[i];
+      os << scaled(static_cast<double>(bucket_lower(i))) << " "
+         << scaled(static_cast<double>(bucket_upper(i))) << " " << counts[i] << " "
+         << static_cast<double>(seen) / static_cast<double>(total) << "\n";
+    }
+  }
+
+private:
+  friend struct detail::ThreadHistogram;
+
+  std::array<uint64_t, bucket_count> counts{};
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  uint64_t min_value = std::numeric_limits<uint64_t>::max();
+  uint64_t max_value = 0;
+};
+
+namespace detail {
+
+/**
+ * A histogram written by one thread and read by any. Only the owning thread
+ * records, so every update is a plain relaxed load and store.
+ */
+struct ThreadHistogram
+{
+  std::atomic<uint64_t> counts[LatencyHistogram::bucket_count] = {};
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> min_value{std::numeric_limits<uint64_t>::max()};
+  std::atomic<uint64_t> max_value{0};
+
+  /*
+   * Calls left until the next sampled one; only read by the owning thread
+   */
+  uint32_t countdown = 0;
+
+  void record (const uint64_t value)
+  {
+    increment(counts[LatencyHistogram::bucket_of(value)]);
+    increment(sum, value);
+    if (value < min_value.load(std::memory_order_relaxed))
+      min_value.store(value, std::memory_order_relaxed);
+    if (value > max_value.load(std::memory_order_relaxed))
+      max_value.store(value, std::memory_order_relaxed);
+  }
+
+  void add_to (LatencyHistogram& histogram) const
+  {
+    for (size_t i = 0; i < LatencyHistogram::bucket_count; ++i)
+    {
+      const uint64_t count = counts[i].load(std::memory_order_relaxed);
+      histogram.counts[i] += count;
+      histogram.total += count;
+    }
+    histogram.sum += sum.load(std::memory_order_relaxed);
+    histogram.min_value = std::min(histogram.min_value, min_value.load(std::memory_order_relaxed));
+    histogram.max_value = std::max(histogram.max_value, max_value.load(std::memory_order_relaxed));
+  }
+
+  void reset ()
+  {
+    for (auto& count : counts)
+      count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    min_value.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+    max_value.store(0, std::memory_order_relaxed);
+  }
+};
+
+} /* namespace detail */
+
+/**
+ * BasicTimedEquation wraps a JSONEquation and records the latency of its
+ * calculate() calls, in read_ticks() ticks, into per-thread histograms.
+ * Single-input calls and batch calls are recorded separately; a batch is
+ * timed as a whole. With sample_every = N only every Nth call on each thread
+ * is timed, which keeps the overhead of the others to a counter decrement.
+ * The wrapped equation must outlive the wrapper.
+ * @tparam T Scalar type of the wrapped equation
+ */
+template<typename T>
+class BasicTimedEquation
+{
+public:
+  /**
+   * @param equation Equation to evaluate and time
+   * @param sample_every Time one call in this many, per thread (0 is taken
+   * as 1)
+   */
+  explicit BasicTimedEquation (const BasicJSONEquation<T>& equation, const uint32_t sample_every = 1)
+      : wrapped(&equation), sample_every(std::max<uint32_t>(sample_every, 1))
+  {
+  }
+
+  /**
+   * Calculate the output of the wrapped equation given input x, timing the
+   * call if it is sampled.
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range. Else, T val
+   */
+  std::optional<T> calculate (const T x) const
+  {
+    detail::ThreadHistogram& histogram = single.local();
+    if (!sampled(histogram))
+      return wrapped->calculate(x);
+
+    const uint64_t start = detail::read_ticks();
+    const std::optional<T> result = wrapped->calculate(x);
+    histogram.record(detail::read_ticks() - start);
+    return result;
+  }
+
+  std::optional<T> operator() (const T x) const
+  {
+    return calculate(x);
+  }
+
+  /**
+   * Calculate the output of the wrapped equation for each of count inputs,
+   * timing the whole batch if it is sampled.
+   * @param x Inputs to the system of equations
+   * @param count Number of inputs
+   * @param out Receives count results, nullopt for inputs not included in any
+   * pieces' range
+   */
+  void calculate (const T* x, const size_t count, std::optional<T>* out) const
+  {
+    detail::ThreadHistogram& histogram = batch.local();
+    if (!sampled(histogram))
+    {
+      wrapped->calculate(x, count, out);
+      return;
+    }
+
+    const uint64_t start = detail::read_ticks();
+    wrapped->calculate(x, count, out);
+    histogram.record(detail::read_ticks() - start);
+  }
+
+  std::vector<std::optional<T> > calculate (const std::vector<T>& xs) const
+  {
+    std::vector<std::optional<T> > results(xs.size());
+    calculate(xs.data(), xs.size(), results.data());
+    return results;
+  }
+
+  /**
+   * @return Latencies of sampled single-input calls, merged over all threads
+   */
+  LatencyHistogram latencies () const
+  {
+    return merged(single);
+  }
+
+  /**
+   * @return Latencies of sampled batch calls, merged over all threads
+   */
+  LatencyHistogram batch_latencies () const
+  {
+    return merged(batch);
+  }
+
+  /**
+   * Clear the histograms of every thread. Calls timed by other threads while
+   * this runs may or may not be kept.
+   */
+  void reset ()
+  {
+    for (auto* slots : {&single, &batch})
+      slots->for_each([] (detail::ThreadHistogram& histogram) { histogram.reset(); });
+  }
+
+  const BasicJSONEquation<T>& equation () const
+  {
+    return *wrapped;
+  }
+
+private:
+  const BasicJSONEquation<T>* wrapped;
+  uint32_t sample_every;
+  detail::ThreadSlots<detail::ThreadHistogram> single;
+  detail::ThreadSlots<detail::ThreadHistogram> batch;
+
+  bool sampled (detail::ThreadHistogram& histogram) const
+  {
+    if (histogram.countdown != 0)
+    {
+      --histogram.countdown;
+      return false;
+    }
+    histogram.countdown = sample_every - 1;
+    return true;
+  }
+
+  static LatencyHistogram merged (const detail::ThreadSlots<detail::ThreadHistogram>& slots)
+  {
+    LatencyHistogram histogram;
+    slots.for_each([&] (detail::ThreadHistogram& mine) { mine.add_to(histogram); });
+    return histogram;
+  }
+};
+
+using TimedEquation = BasicTimedEquation<double>;
+
+} /* namespace json_equation */
+
+#endif //LATENCY_HISTOGRAM_HPP
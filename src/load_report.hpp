@@ -0,0 +1,189 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * LoadReport breaks the time spent constructing a JSONEquation down by loader
+ * phase, so that slow startups can be attributed to parsing, walking the
+ * parsed document, converting numbers, building error messages, analysing
+ * poles or inserting into the piece map.
+ */
+
+#ifndef LOAD_REPORT_HPP
+#define LOAD_REPORT_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace json_equation {
+
+/**
+ * Phases of loading an equation, in the order they first occur.
+ */
+enum class LoadPhase : uint8_t
+{
+  tokenize,           /* Parsing text into nlohmann::json (is >> json) */
+  dom_walk,           /* Looking up keys and arrays in the parsed document */
+  numeric_conversion, /* Converting JSON values to T and building monomials */
+  error_context,      /* Building the per-piece error message prefix */
+  analysis,           /* PolynomialEquation::prepare: power plans and pole analysis */
+  map_insertion       /* Inserting pieces into the piece map */
+};
+
+constexpr size_t load_phase_count = 6;
+
+/**
+ * @return Name of a load phase, as spelled in LoadPhase
+ */
+inline const char* load_phase_name (const LoadPhase phase)
+{
+  static const char* const names[load_phase_count] = {"tokenize", "dom_walk", "numeric_conversion",
+                                                       "error_context", "analysis", "map_insertion"};
+  return names[static_cast<size_t>(phase)];
+}
+
+/**
+ * Cost of one load phase.
+ */
+struct LoadPhaseReport
+{
+  std::chrono::nanoseconds time{0};
+
+  /*
+   * Heap allocations made during the phase, if LoadReport::allocation_counter
+   * was set, else 0
+   */
+  uint64_t allocations = 0;
+};
+
+/**
+ * Filled in by the JSONEquation constructors that take one. Profiling reads
+ * the clock at every phase change, a few times per piece, which adds to the
+ * total but not to any phase's share of it.
+ */
+struct LoadReport
+{
+  /*
+   * Optional hook returning a running count of heap allocations, e.g. kept
+   * by a replacement operator new. Read at every phase change.
+   */
+  uint64_t (*allocation_counter) () = nullptr;
+
+  std::array<LoadPhaseReport, load_phase_count> phases{};
+  size_t pieces = 0;
+  size_t monomials = 0;
+
+  /*
+   * Bytes of the stream consumed by the parser, when the stream reports its
+   * position (e.g. files and string streams), else 0
+   */
+  uint64_t bytes_read = 0;
+
+  const LoadPhaseReport& operator[] (const LoadPhase phase) const
+  {
+    return phases[static_cast<size_t>(phase)];
+  }
+
+  /**
+   * @return Time spent in all phases
+   */
+  std::chrono::nanoseconds time () const
+  {
+    std::chrono::nanoseconds total{0};
+    for (const auto& phase : phases)
+      total += phase.time;
+    return total;
+  }
+
+  /**
+   * @return Allocations made in all phases
+   */
+  uint64_t allocations () const
+  {
+    uint64_t total = 0;
+    for (const auto& phase : phases)
+      total += phase.allocations;
+    return total;
+  }
+};
+
+namespace detail {
+
+/**
+ * Attributes elapsed time and allocations to the current phase whenever the
+ * loader moves to another. Without a report, every call is a single branch.
+ */
+class LoadProfiler
+{
+public:
+  /**
+   * @param report Report to fill in, or nullptr to profile nothing
+   * @param first Phase the loader starts in
+   */
+  explicit LoadProfiler (LoadReport* report, const LoadPhase first = LoadPhase::tokenize)
+      : report(report), current(first)
+  {
+    if (report)
+    {
+      const auto allocation_counter = report->allocation_counter;
+      *report = LoadReport();
+      report->allocation_counter = allocation_counter;
+      since = std::chrono::steady_clock::now();
+      allocations_since = allocations();
+    }
+  }
+
+  /**
+   * Close the current phase and start another.
+   */
+  void enter (const LoadPhase phase)
+  {
+    if (!report)
+      return;
+
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t allocations_now = allocations();
+    LoadPhaseReport& closed = report->phases[static_cast<size_t>(current)];
+    closed.time += std::chrono::duration_cast<std::chrono::nanoseconds>(now - since);
+    closed.allocations += allocations_now - allocations_since;
+    current = phase;
+    /*
+     * Reading the clock and counter again excludes the bookkeeping above
+     */
+    since = std::chrono::steady_clock::now();
+    allocations_since = allocations();
+  }
+
+  /**
+   * Close the current phase.
+   */
+  void finish ()
+  {
+    enter(current);
+  }
+
+  LoadReport* get () const
+  {
+    return report;
+  }
+
+private:
+  LoadReport* report;
+  LoadPhase current;
+  std::chrono::steady_clock::time_point since{};
+  uint64_t allocations_since = 0;
+
+  uint64_t allocations () const
+  {
+    return report->allocation_counter ? report->allocation_counter() : 0;
+  }
+};
+
+} /* namespace detail */
+
+} /* namespace json_equation */
+
+#endif //LOAD_REPORT_HPP
@@ -0,0 +1,126 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * MemoryUsage accounts for the memory held by an equation or registry,
+ * broken down into the search index, polynomial data and metadata, plus an
+ * estimate of what the allocator spends on top of the requested bytes.
+ */
+
+#ifndef MEMORY_USAGE_HPP
+#define MEMORY_USAGE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace json_equation {
+
+/**
+ * Bytes held by an equation or registry. Figures come from container sizes
+ * and capacities, so they are exact for vectors and estimates for node-based
+ * containers (a red-black tree node is taken as four pointers plus the
+ * value). Slack is estimated for a glibc-like malloc: an 8 byte header per
+ * block, 16 byte granularity and 32 byte minimum blocks.
+ */
+struct MemoryUsage
+{
+  /*
+   * Search structure: map nodes and bound arrays
+   */
+  size_t index = 0;
+
+  /*
+   * Monomials, coefficients and code: what the pieces evaluate
+   */
+  size_t polynomials = 0;
+
+  /*
+   * Everything else: objects themselves, per-piece plans, flags and offsets
+   */
+  size_t metadata = 0;
+
+  /*
+   * Estimated allocator overhead of the heap blocks counted above
+   */
+  size_t slack = 0;
+
+  /*
+   * Number of heap blocks
+   */
+  size_t allocations = 0;
+
+  /**
+   * @return Bytes in use, including estimated allocator slack
+   */
+  size_t total () const
+  {
+    return index + polynomials + metadata + slack;
+  }
+
+  MemoryUsage& operator+= (const MemoryUsage& other)
+  {
+    index += other.index;
+    polynomials += other.polynomials;
+    metadata += other.metadata;
+    slack += other.slack;
+    allocations += other.allocations;
+    return *this;
+  }
+};
+
+namespace detail {
+
+/**
+ * Size of the bookkeeping in a red-black tree node, besides its value.
+ */
+constexpr size_t map_node_overhead = 4 * sizeof(void*);
+
+/**
+ * @return Bytes malloc spends beyond a request of bytes
+ */
+inline size_t allocation_slack (const size_t bytes)
+{
+  const size_t block = std::max<size_t>(32, (bytes + 8 + 15) / 16 * 16);
+  return block - bytes;
+}
+
+/**
+ * Count one heap block of bytes, whose bytes the caller has attributed.
+ */
+inline void count_block (MemoryUsage& usage, const size_t bytes)
+{
+  if (bytes == 0)
+    return;
+  usage.slack += allocation_slack(bytes);
+  ++usage.allocations;
+}
+
+/**
+ * Count a vector's heap block towards one part of usage.
+ * @param usage Usage to add the block's slack and count to
+ * @param part Member of usage receiving the block's bytes
+ * @param vector Vector whose capacity is counted
+ */
+template<typename V>
+void count_vector (MemoryUsage& usage, size_t& part, const std::vector<V>& vector)
+{
+  const size_t bytes = vector.capacity() * sizeof(V);
+  part += bytes;
+  count_block(usage, bytes);
+}
+
+inline void count_vector (MemoryUsage& usage, size_t& part, const std::vector<bool>& vector)
+{
+  const size_t bytes = (vector.capacity() + 63) / 64 * 8;
+  part += bytes;
+  count_block(usage, bytes);
+}
+
+} /* namespace detail */
+
+} /* namespace json_equation */
+
+#endif //MEMORY_USAGE_HPP
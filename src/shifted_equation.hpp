@@ -0,0 +1,388 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * ShiftedEquation re-expresses every polynomial piece of a JSONEquation in a
+ * piece-local variable t = (x - center) / halfwidth, so that t stays within
+ * [-1, 1] over the piece. Pieces far from the origin then no longer need
+ * huge, cancelling coefficients, which makes them safe to evaluate in float.
+ */
+
+#ifndef SHIFTED_EQUATION_HPP
+#define SHIFTED_EQUATION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <vector>
+
+#include "json_equation_core.hpp"
+
+namespace json_equation {
+
+/**
+ * Result of verifying one piece of a ShiftedEquation against the original
+ * PolynomialEquation::calculate.
+ */
+struct ShiftedPieceCheck
+{
+  /*
+   * Whether the piece is evaluated in the shifted basis. Pieces that cannot
+   * be shifted or that fail verification are evaluated as loaded instead.
+   */
+  bool shifted = false;
+  double max_error = 0;
+  double allowed_error = 0;
+};
+
+/**
+ * BasicShiftedEquation is a compiled, read-only form of a JSONEquation that
+ * evaluates each piece in a piece-local basis.
+ *
+ * Pieces whose numerator and denominator have non-negative integer powers
+ * are re-expressed, at compile time and in long double, as polynomials in
+ * t = (x - center) / halfwidth, where center and halfwidth are those of the
+ * piece's range. At run time t is computed in double and the polynomials are
+ * evaluated in T with Horner's method.
+ *
+ * Every shifted piece is verified against PolynomialEquation::calculate at
+ * evenly spaced points of its range. The allowed error is tolerance times the
+ * piece's largest output, plus the rounding error of the original evaluation
+ * itself. Pieces that fail, and pieces with negative or real powers, keep
+ * being evaluated by their PolynomialEquation (in double, rounded to T).
+ * @tparam T Scalar type the shifted polynomials are stored and evaluated in
+ */
+template<typename T>
+class BasicShiftedEquation
+{
+public:
+  /**
+   * Default tolerance, relative to a piece's largest output.
+   */
+  static constexpr T default_tolerance = 64 * std::numeric_limits<T>::epsilon();
+
+  BasicShiftedEquation () = default;
+
+  /**
+   * Compile and verify every piece of an equation.
+   * @param equation Loaded equation
+   * @param tolerance Error allowed in a shifted piece, relative to the
+   * largest magnitude of the piece's output over its range
+   * @param samples Number of points at which each piece is verified
+   */
+  explicit BasicShiftedEquation (const JSONEquation& equation, const T tolerance = default_tolerance,
+                                 const size_t samples = 257)
+  {
+    for (const auto& piece : equation.pieces)
+    {
+      lower_bounds.push_back(piece.first.lb);
+      upper_bounds.push_back(piece.first.ub);
+      lb_inclusive.push_back(piece.first.lb_inclusive);
+      ub_inclusive.push_back(piece.first.ub_inclusive);
+      compile_piece(piece.first, piece.second, static_cast<double>(tolerance), std::max<size_t>(samples, 2));
+    }
+  }
+
+  /**
+   * Calculate the output of the polynomial system given input x. If x is not
+   * included in the range for any piece, std::nullopt is returned instead.
+   * @param x Input to the system of equations. Kept in double so that the
+   * distance to the piece's center is not rounded away.
+   * @return nullopt if x not included in any pieces' range. Else, T val
+   */
+  std::optional<T> calculate (const double x) const
+  {
+    const size_t idx = find_piece(x);
+    if (idx == npos)
+      return std::nullopt;
+    return evaluate(pieces[idx], x);
+  }
+
+  std::optional<T> operator() (const double x) const
+  {
+    return calculate(x);
+  }
+
+  /**
+   * @return Number of pieces
+   */
+  size_t size () const
+  {
+    return pieces.size();
+  }
+
+  /**
+   * @return Verification results for every piece, in ascending order of bounds
+   */
+  const std::vector<ShiftedPieceCheck>& verification () const
+  {
+    return checks;
+  }
+
+  /**
+   * @return Memory held by this equation: bound arrays as index, shifted
+   * coefficients and pieces evaluated as loaded as polynomials, and piece
+   * descriptors and verification results as metadata
+   */
+  MemoryUsage memory_usage () const
+  {
+    MemoryUsage usage;
+    usage.metadata += sizeof(*this);
+    detail::count_vector(usage, usage.index, lower_bounds);
+    detail::count_vector(usage, usage.index, upper_bounds);
+    detail::count_vector(usage, usage.index, lb_inclusive);
+    detail::count_vector(usage, usage.index, ub_inclusive);
+    detail::count_vector(usage, usage.polynomials, coefficients);
+    detail::count_vector(usage, usage.polynomials, original);
+    for (const auto& function : original)
+      usage += function.memory_usage();
+    detail::count_vector(usage, usage.metadata, pieces);
+    detail::count_vector(usage, usage.metadata, checks);
+    return usage;
+  }
+
+private:
+  static constexpr size_t npos = detail::no_piece;
+
+  /*
+   * Degrees beyond this are left as loaded.
+   */
+  static constexpr long max_degree = 64;
+
+  struct Piece
+  {
+    double center = 0;
+    double inv_halfwidth = 0;
+    uint32_t offset = 0;             /* shifted: into coefficients. else: into original */
+    uint16_t numerator_terms = 0;
+    uint16_t denominator_terms = 0;
+    bool shifted = false;
+    bool checked = true;             /* whether to apply pole checks */
+  };
+
+  /*
+   * Piece bounds, in ascending order, as parallel arrays for the search
+   */
+  std::vector<double> lower_bounds;
+  std::vector<double> upper_bounds;
+  std::vector<bool> lb_inclusive;
+  std::vector<bool> ub_inclusive;
+
+  std::vector<Piece> pieces;
+  std::vector<ShiftedPieceCheck> checks;
+
+  /*
+   * Horner coefficients in t, highest power first, numerator then
+   * denominator, and the pieces that are evaluated as loaded
+   */
+  std::vector<T> coefficients;
+  std::vector<PolynomialEquation> original;
+
+  T evaluate (const Piece& piece, const double x) const
+  {
+    if (!piece.shifted)
+      return static_cast<T>(original[piece.offset].calculate(x));
+
+    const T t = static_cast<T>((x - piece.center) * piece.inv_halfwidth);
+    const T* const c = coefficients.data() + piece.offset;
+    const T numerator_val = horner(c, piece.numerator_terms, t);
+    const T denominator_val = horner(c + piece.numerator_terms, piece.denominator_terms, t);
+    if (!piece.checked)
+      return numerator_val / denominator_val;
+
+    if (numerator_val == 0 && denominator_val == 0)
+      return 0;
+    else if (numerator_val != 0 && denominator_val == 0)
+      return std::numeric_limits<T>::infinity();
+    return numerator_val / denominator_val;
+  }
+
+  static T horner (const T* c, const size_t count, const T t)
+  {
+    T acc = c[0];
+    for (size_t i = 1; i < count; ++i)
+      acc = acc * t + c[i];
+    return acc;
+  }
+
+  size_t find_piece (const double x) const
+  {
+    return detail::find_in_bounds(x, lower_bounds, upper_bounds, lb_inclusive, ub_inclusive, 0, upper_bounds.size());
+  }
+
+  /**
+   * Dense coefficients a_0 .. a_n of a sum of monomials.
+   * @return Whether every power is a non-negative integer up to max_degree
+   */
+  static bool dense_terms (const std::vector<Monomial>& terms, std::vector<long double>& dense)
+  {
+    std::map<long, long double> collected;
+    for (const auto& term : terms)
+    {
+      if (detail::plan_term(term.power).kind != detail::PowerKind::integer
+          || term.power < 0 || term.power > max_degree)
+        return false;
+      collected[static_cast<long>(term.power)] += term.coefficient;
+    }
+
+    dense.assign(collected.empty() ? 1 : static_cast<size_t>(collected.rbegin()->first) + 1, 0.0L);
+    for (const auto& [power, coefficient] : collected)
+      dense[static_cast<size_t>(power)] = coefficient;
+    return true;
+  }
+
+  /**
+   * Rewrite p(x) = sum a_k x^k as q(t) = p(center + halfwidth * t), in place,
+   * with a Taylor shift followed by scaling.
+   */
+  static void shift_basis (std::vector<long double>& a, const long double center,
+                           const long double halfwidth)
+  {
+    const size_t n = a.size() - 1;
+    for (size_t i = 0; i < n; ++i)
+    {
+      for (size_t j = n - 1; j + 1 > i; --j)
+        a[j] += center * a[j + 1];
+    }
+
+    long double scale = 1;
+    for (auto& coefficient : a)
+    {
+      coefficient *= scale;
+      scale *= halfwidth;
+    }
+  }
+
+  static double sum_at (const std::vector<Monomial>& terms, const double x)
+  {
+    double sum = 0;
+    for (const auto& term : terms)
+      sum += term.coefficient * std::pow(x, term.power);
+    return sum;
+  }
+
+  /**
+   * Bound on the rounding error of evaluating a sum of monomials directly in
+   * double at x.
+   */
+  static double rounding_bound (const std::vector<Monomial>& terms, const double x)
+  {
+    double magnitude = 0;
+    for (const auto& term : terms)
+      magnitude += std::fabs(term.coefficient * std::pow(x, term.power));
+    return 4 * static_cast<double>(terms.size() + 1) * std::numeric_limits<double>::epsilon() * magnitude;
+  }
+
+  void compile_piece (const numeric_range::NumericRange<double>& range,
+                      const PolynomialEquation& function, const double tolerance,
+                      const size_t samples)
+  {
+    Piece piece;
+    piece.checked = function.pole_status() != PoleStatus::pole_free;
+    piece.center = range.lb / 2 + range.ub / 2;
+    const double halfwidth = range.ub / 2 - range.lb / 2;
+    piece.inv_halfwidth = (halfwidth > 0) ? 1 / halfwidth : 0;
+
+    std::vector<long double> numerator;
+    std::vector<long double> denominator;
+    const bool polynomial = dense_terms(function.numerator, numerator)
+                            && dense_terms(function.denominator, denominator)
+                            && std::isfinite(piece.center) && std::isfinite(halfwidth);
+
+    ShiftedPieceCheck check;
+    if (polynomial)
+    {
+      shift_basis(numerator, piece.center, halfwidth);
+      shift_basis(denominator, piece.center, halfwidth);
+
+      piece.shifted = true;
+      piece.offset = static_cast<uint32_t>(coefficients.size());
+      piece.numerator_terms = static_cast<uint16_t>(numerator.size());
+      piece.denominator_terms = static_cast<uint16_t>(denominator.size());
+      for (auto it = numerator.rbegin(); it != numerator.rend(); ++it)
+        coefficients.push_back(static_cast<T>(*it));
+      for (auto it = denominator.rbegin(); it != denominator.rend(); ++it)
+        coefficients.push_back(static_cast<T>(*it));
+
+      check = verify(range, function, piece, tolerance, samples);
+    }
+
+    if (!check.shifted)
+    {
+      coefficients.resize(piece.shifted ? piece.offset : coefficients.size());
+      piece.shifted = false;
+      piece.offset = static_cast<uint32_t>(original.size());
+      original.push_back(function);
+    }
+    pieces.push_back(piece);
+    checks.push_back(check);
+  }
+
+  /**
+   * Compare a shifted piece against the original evaluation at evenly spaced
+   * points of its range.
+   */
+  ShiftedPieceCheck verify (const numeric_range::NumericRange<double>& range,
+                            const PolynomialEquation& function, const Piece& piece,
+                            const double tolerance, const size_t samples) const
+  {
+    std::vector<double> xs;
+    for (size_t i = 0; i < samples; ++i)
+    {
+      const double x = range.lb + (range.ub - range.lb) * static_cast<double>(i) / static_cast<double>(samples - 1);
+      if ((x == range.lb && !range.lb_inclusive) || (x == range.ub && !range.ub_inclusive))
+        continue;
+      xs.push_back(x);
+    }
+
+    double scale = 0;
+    for (const double x : xs)
+    {
+      const double expected = function.calculate(x);
+      if (std::isfinite(expected))
+        scale = std::max(scale, std::fabs(expected));
+    }
+
+    ShiftedPieceCheck check;
+    check.shifted = true;
+    for (const double x : xs)
+    {
+      const double expected = function.calculate(x);
+      const double actual = static_cast<double>(evaluate(piece, x));
+      if (!std::isfinite(expected))
+      {
+        /*
+         * Only the same infinity, or NaN for NaN, matches
+         */
+        check.shifted = check.shifted && ((std::isnan(expected) && std::isnan(actual)) || actual == expected);
+        continue;
+      }
+
+      /*
+       * The original's own rounding, propagated through the division
+       */
+      const double denominator_val = std::fabs(sum_at(function.denominator, x));
+      const double original_error = (denominator_val > 0) ?
+                                    (rounding_bound(function.numerator, x)
+                                     + std::fabs(expected) * rounding_bound(function.denominator, x))
+                                    / denominator_val : 0;
+      const double allowed = tolerance * scale + original_error;
+      const double error = std::fabs(actual - expected);
+      check.max_error = std::max(check.max_error, error);
+      check.allowed_error = std::max(check.allowed_error, allowed);
+      check.shifted = check.shifted && error <= allowed;
+    }
+    return check;
+  }
+};
+
+using ShiftedEquation = BasicShiftedEquation<double>;
+
+} /* namespace json_equation */
+
+#endif //SHIFTED_EQUATION_HPP
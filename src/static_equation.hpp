@@ -0,0 +1,270 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * StaticEquation is a compile-time counterpart to JSONEquation for curves
+ * that are known when the program is built. Pieces are given as constexpr
+ * arrays, the piece lookup unrolls into a binary decision tree, and
+ * equations with integer powers can be evaluated in constant expressions.
+ * Results match JSONEquation::calculate exactly for the same pieces.
+ */
+
+#ifndef STATIC_EQUATION_HPP
+#define STATIC_EQUATION_HPP
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+
+#include "json_equation_core.hpp"
+
+namespace json_equation {
+
+/**
+ * The bounds of a StaticPiece, with the same inclusive/exclusive semantics as
+ * numeric_range::NumericRange.
+ */
+struct StaticBounds
+{
+  double lb = 0;
+  bool lb_inclusive = true;
+  double ub = 0;
+  bool ub_inclusive = true;
+};
+
+/**
+ * A monomial c * (x)^p of a StaticPiece. Unlike Monomial, the coefficient
+ * defaults to 0 so that unused trailing entries of a piece's fixed-size term
+ * arrays contribute nothing.
+ */
+struct StaticMonomial
+{
+  double power = 0;
+  double coefficient = 0;
+};
+
+/**
+ * A piece of a StaticEquation: bounds and a rational polynomial with a fixed
+ * number of terms in the numerator and the denominator. A denominator of 1
+ * is written as {{{0, 1}}}.
+ * @tparam NumeratorTerms Maximum number of monomials in the numerator
+ * @tparam DenominatorTerms Maximum number of monomials in the denominator
+ */
+template<size_t NumeratorTerms, size_t DenominatorTerms = 1>
+struct StaticPiece
+{
+  StaticBounds bounds;
+  std::array<StaticMonomial, NumeratorTerms> numerator{};
+  std::array<StaticMonomial, DenominatorTerms> denominator{};
+
+  /**
+   * Calculate the result of this piece's expression given the input value x,
+   * exactly as PolynomialEquation::calculate does.
+   * @param x Input to the expression
+   * @return Result of computing f(x)
+   */
+  constexpr double calculate (const double x) const
+  {
+    bool shares_log = false;
+    if (!all_integer_powers())
+      shares_log = (general_powers(numerator) + general_powers(denominator)) >= 2;
+
+    const double numerator_val = sum_terms(numerator, x, shares_log);
+    const double denominator_val = sum_terms(denominator, x, shares_log);
+
+    if (numerator_val == 0 && denominator_val == 0)
+      return 0;
+    else if (numerator_val != 0 && denominator_val == 0)
+      return std::numeric_limits<double>::infinity();
+
+    return numerator_val / denominator_val;
+  }
+
+  constexpr bool all_integer_powers () const
+  {
+    for (const auto& term : numerator)
+    {
+      if (!is_integer_power(term.power))
+        return false;
+    }
+    for (const auto& term : denominator)
+    {
+      if (!is_integer_power(term.power))
+        return false;
+    }
+    return true;
+  }
+
+private:
+  /**
+   * Matches the integer classification of detail::plan_term without calling
+   * non-constexpr math functions.
+   */
+  static constexpr bool is_integer_power (const double power)
+  {
+    return power >= -1e6 && power <= 1e6
+           && power == static_cast<double>(static_cast<int32_t>(power));
+  }
+
+  template<size_t Terms>
+  static constexpr double sum_terms (const std::array<StaticMonomial, Terms>& terms,
+                                     const double x, const bool shares_log)
+  {
+    double sum = 0.0;
+    for (const auto& term : terms)
+    {
+      if (is_integer_power(term.power))
+        sum += term.coefficient * detail::ladder_power(x, static_cast<int32_t>(term.power));
+      else
+        sum += term.coefficient * real_power(term.power, x, shares_log);
+    }
+    return sum;
+  }
+
+  template<size_t Terms>
+  static size_t general_powers (const std::array<StaticMonomial, Terms>& terms)
+  {
+    size_t count = 0;
+    for (const auto& term : terms)
+      count += (detail::plan_term(term.power).kind == detail::PowerKind::general);
+    return count;
+  }
+
+  /**
+   * Non-integer powers, evaluated the same way as by PolynomialEquation: the
+   * sqrt, cbrt and shared log paths for finite x > 0, std::pow otherwise.
+   */
+  static double real_power (const double power, const double x, const bool shares_log)
+  {
+    if (!(x > 0 && x < std::numeric_limits<double>::infinity()))
+      return std::pow(x, power);
+
+    const detail::TermPlan plan = detail::plan_term(power);
+    const double whole = detail::ladder_power(x, plan.whole);
+    switch (plan.kind)
+    {
+      case detail::PowerKind::half:
+        return (plan.root_power > 0) ? whole * std::sqrt(x) : whole / std::sqrt(x);
+      case detail::PowerKind::third:
+      {
+        const double cbrt_x = std::cbrt(x);
+        const double root = (plan.root_power == 1 || plan.root_power == -1) ?
+                            cbrt_x : cbrt_x * cbrt_x;
+        return (plan.root_power > 0) ? whole * root : whole / root;
+      }
+      default:
+        return shares_log ? std::exp(power * std::log(x)) : std::pow(x, power);
+    }
+  }
+};
+
+/**
+ * StaticEquation represents a system of piecewise polynomial equations whose
+ * pieces are known at compile time. Pieces must be given in ascending order
+ * of their bounds and must not overlap; this is checked on construction (at
+ * compile time for constexpr objects).
+ *
+ * constexpr StaticEquation<2, 2> curve({{
+ *     {{0, true, 1, false}, {{{0, 5}, {1, 10}}}, {{{0, 1}}}},
+ *     {{1, true, 2, true}, {{{0, 20}, {1, -5}}}, {{{0, 1}}}}}});
+ * static_assert(curve(0.5).value() == 10.0);
+ *
+ * @tparam Pieces Number of pieces
+ * @tparam NumeratorTerms Maximum number of monomials in each numerator
+ * @tparam DenominatorTerms Maximum number of monomials in each denominator
+ */
+template<size_t Pieces, size_t NumeratorTerms, size_t DenominatorTerms = 1>
+class StaticEquation
+{
+public:
+  using Piece = StaticPiece<NumeratorTerms, DenominatorTerms>;
+
+  std::array<Piece, Pieces> pieces;
+
+  /**
+   * Construct a StaticEquation from its pieces.
+   * @param _pieces Pieces in ascending order of their bounds
+   * @throws runtime_error If bounds are invalid or pieces overlap or are out
+   * of order, making the constant expression ill-formed at compile time
+   */
+  constexpr explicit StaticEquation (const std::array<Piece, Pieces>& _pieces) :
+      pieces(_pieces)
+  {
+    for (size_t i = 0; i < Pieces; ++i)
+    {
+      const StaticBounds& bounds = pieces[i].bounds;
+      if (bounds.lb > bounds.ub)
+        throw std::runtime_error("LB cannot be greater than UB");
+      if (bounds.lb == bounds.ub && (!bounds.lb_inclusive || !bounds.ub_inclusive))
+        throw std::runtime_error("LB and UB must be inclusive when LB == UB");
+      if (i > 0 && !precedes(pieces[i - 1].bounds, bounds))
+        throw std::runtime_error("StaticEquation pieces must be ordered and not overlap");
+    }
+  }
+
+  /**
+   * Calculate the output of the polynomial system given input x. If x is not
+   * included in the range for any piece, std::nullopt is returned instead and
+   * it is up to the caller to determine the course of action.
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range, or NaN. Else,
+   * double val
+   */
+  constexpr std::optional<double> calculate (const double x) const
+  {
+    /*
+     * NaN fails both bound comparisons and would land on a piece; std::isnan
+     * is not constexpr
+     */
+    if (x != x)
+      return std::nullopt;
+    return find_and_calculate<0, Pieces>(x);
+  }
+
+  /**
+   * Shorthand operator provided for convenience, equivalent to calculate().
+   * @param x Input to the system of equations
+   * @return nullopt if x not included in any pieces' range. Else, double val
+   */
+  constexpr std::optional<double> operator() (const double x) const
+  {
+    return calculate(x);
+  }
+
+private:
+  static constexpr bool precedes (const StaticBounds& lhs, const StaticBounds& rhs)
+  {
+    return lhs.ub < rhs.lb || (lhs.ub == rhs.lb && !(lhs.ub_inclusive && rhs.lb_inclusive));
+  }
+
+  /**
+   * Binary decision tree over pieces [Lo, Hi), unrolled at compile time.
+   */
+  template<size_t Lo, size_t Hi>
+  constexpr std::optional<double> find_and_calculate (const double x) const
+  {
+    if constexpr (Lo >= Hi)
+    {
+      return std::nullopt;
+    }
+    else
+    {
+      constexpr size_t mid = Lo + (Hi - Lo) / 2;
+      const StaticBounds& bounds = pieces[mid].bounds;
+      if (x < bounds.lb || (x == bounds.lb && !bounds.lb_inclusive))
+        return find_and_calculate<Lo, mid>(x);
+      else if (x > bounds.ub || (x == bounds.ub && !bounds.ub_inclusive))
+        return find_and_calculate<mid + 1, Hi>(x);
+      return pieces[mid].calculate(x);
+    }
+  }
+};
+
+} /* namespace json_equation */
+
+#endif //STATIC_EQUATION_HPP
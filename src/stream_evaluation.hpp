@@ -0,0 +1,291 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * Streaming evaluation runs an equation over long sequences of inputs, given
+ * as newline-separated text or raw float64 arrays. Each batch is split across
+ * threads, which parse, evaluate and format their share independently.
+ * json_equation_eval reads and writes the streams.
+ */
+
+#ifndef STREAM_EVALUATION_HPP
+#define STREAM_EVALUATION_HPP
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace json_equation {
+
+enum class StreamFormat
+{
+  text,     /* One number per line, read by std::from_chars and written by std::to_chars */
+  float64   /* Raw doubles in native byte order */
+};
+
+struct StreamStatistics
+{
+  uint64_t inputs = 0;
+  uint64_t out_of_domain = 0;
+};
+
+namespace detail {
+
+/*
+ * Longest text std::to_chars writes for a double in shortest round-trip form
+ */
+constexpr size_t max_double_chars = 24;
+
+/**
+ * Parse one line of text input. Surrounding spaces and tabs, a carriage
+ * return and a leading '+' are allowed.
+ * @return Whether the line held exactly one number
+ */
+inline bool parse_input_line (const char* begin, const char* end, double& x)
+{
+  while (begin != end && (*begin == ' ' || *begin == '\t'))
+    ++begin;
+  while (end != begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+    --end;
+  if (end - begin > 1 && *begin == '+' && begin[1] != '-')
+    ++begin;
+  const std::from_chars_result result = std::from_chars(begin, end, x);
+  return begin != end && result.ec == std::errc() && result.ptr == end;
+}
+
+} /* namespace detail */
+
+/**
+ * Evaluates batches of a stream of inputs with an equation, appending the
+ * results in the same order. Inputs outside the equation's domain, NaN
+ * included, produce a marker instead of a result.
+ * @tparam Equation Any type with std::optional<double> calculate(double) const,
+ * e.g. JSONEquation or KernelEquation
+ */
+template<typename Equation>
+class StreamEvaluator
+{
+public:
+  /**
+   * @param equation Equation to evaluate, which must outlive the evaluator
+   * @param output_format Format results are appended in
+   * @param marker Output for inputs outside the domain: written as is in text,
+   * and parsed as a number for float64 output
+   * @param threads Number of threads each batch is split across
+   * @throws invalid_argument If threads is 0, or if float64 output needs a
+   * marker that is not a number
+   */
+  StreamEvaluator (const Equation& equation, const StreamFormat output_format, const std::string& marker = "nan",
+                   const unsigned threads = 1)
+      : equation(equation), output_format(output_format), marker(marker), slices(threads)
+  {
+    if (threads == 0)
+      throw std::invalid_argument("A stream needs at least one thread.");
+    if (output_format == StreamFormat::float64
+        && !detail::parse_input_line(marker.data(), marker.data() + marker.size(), marker_value))
+      throw std::invalid_argument("Out-of-domain marker \"" + marker + "\" is not a number for float64 output.");
+  }
+
+  /**
+   * Evaluate a batch of text inputs, one per line, and append the results to
+   * out. The last line need not end in a newline, so a batch cut from the
+   * middle of a stream must end just after one.
+   * @throws invalid_argument If a line is not a number, naming the line's
+   * number in the whole stream. Nothing is appended.
+   */
+  void evaluate_text (const char* begin, const char* end, std::vector<char>& out)
+  {
+    const size_t share = (static_cast<size_t>(end - begin) + slices.size() - 1) / slices.size();
+    const char* slice_begin = begin;
+    for (Slice& slice : slices)
+    {
+      /*
+       * Cut after the first newline past an even share of the bytes
+       */
+      const char* slice_end = end;
+      if (static_cast<size_t>(end - slice_begin) > share)
+      {
+        const void* newline = std::memchr(slice_begin + share, '\n', end - slice_begin - share);
+        slice_end = newline ? static_cast<const char*>(newline) + 1 : end;
+      }
+      slice.text_begin = slice_begin;
+      slice.text_end = slice_end;
+      slice_begin = slice_end;
+    }
+
+    run([this] (Slice& slice) { parse_and_evaluate(slice); });
+
+    uint64_t line = lines;
+    for (const Slice& slice : slices)
+    {
+      if (!slice.invalid_line)
+      {
+        line += slice.lines;
+        continue;
+      }
+      throw std::invalid_argument("Invalid input \"" + slice.invalid_text + "\" on line "
+                                  + std::to_string(line + slice.invalid_line) + ".");
+    }
+    lines = line;
+    append(out);
+  }
+
+  /**
+   * Evaluate a batch of count inputs and append the results to out.
+   */
+  void evaluate_float64 (const double* x, const size_t count, std::vector<char>& out)
+  {
+    const size_t share = (count + slices.size() - 1) / slices.size();
+    size_t first = 0;
+    for (Slice& slice : slices)
+    {
+      slice.inputs_begin = x + first;
+      slice.count = std::min(share, count - first);
+      first += slice.count;
+    }
+
+    run([this] (Slice& slice) { evaluate(slice, slice.inputs_begin, slice.count); });
+    lines += count;
+    append(out);
+  }
+
+  /**
+   * @return Inputs evaluated so far, and how many were outside the domain
+   */
+  const StreamStatistics& statistics () const
+  {
+    return totals;
+  }
+
+private:
+  /*
+   * One thread's share of a batch
+   */
+  struct Slice
+  {
+    const char* text_begin = nullptr;
+    const char* text_end = nullptr;
+    const double* inputs_begin = nullptr;
+    size_t count = 0;
+
+    std::vector<double> parsed;
+    std::vector<char> out;
+    StreamStatistics statistics;
+    uint64_t lines = 0;
+
+    /*
+     * Line in the slice, from 1, of the first invalid input, or 0
+     */
+    uint64_t invalid_line = 0;
+    std::string invalid_text;
+  };
+
+  const Equation& equation;
+  const StreamFormat output_format;
+  const std::string marker;
+  double marker_value = 0;
+  std::vector<Slice> slices;
+  StreamStatistics totals;
+
+  /*
+   * Lines (or float64 inputs) consumed by previous batches
+   */
+  uint64_t lines = 0;
+
+  /**
+   * Run work on every slice, the first on this thread and the rest on threads
+   * of their own.
+   */
+  template<typename Work>
+  void run (Work work)
+  {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < slices.size(); ++i)
+      threads.emplace_back(work, std::ref(slices[i]));
+    work(slices[0]);
+    for (std::thread& thread : threads)
+      thread.join();
+  }
+
+  void parse_and_evaluate (Slice& slice)
+  {
+    slice.parsed.clear();
+    slice.lines = 0;
+    slice.invalid_line = 0;
+    const char* line = slice.text_begin;
+    while (line != slice.text_end)
+    {
+      const void* newline = std::memchr(line, '\n', slice.text_end - line);
+      const char* line_end = newline ? static_cast<const char*>(newline) : slice.text_end;
+      ++slice.lines;
+      double x = 0;
+      if (!detail::parse_input_line(line, line_end, x))
+      {
+        slice.invalid_line = slice.lines;
+        slice.invalid_text.assign(line, std::min(line_end, line + 40));
+        slice.out.clear();
+        return;
+      }
+      slice.parsed.push_back(x);
+      line = newline ? line_end + 1 : slice.text_end;
+    }
+    evaluate(slice, slice.parsed.data(), slice.parsed.size());
+  }
+
+  void evaluate (Slice& slice, const double* x, const size_t count)
+  {
+    const size_t width = output_format == StreamFormat::float64 ?
+                         sizeof(double) : std::max(detail::max_double_chars, marker.size()) + 1;
+    slice.out.resize(count * width);
+    slice.statistics = StreamStatistics();
+    slice.statistics.inputs = count;
+
+    char* out = slice.out.data();
+    for (size_t i = 0; i < count; ++i)
+    {
+      /*
+       * NaN is in no piece, whatever the engine's comparisons make of it
+       */
+      const std::optional<double> y = std::isnan(x[i]) ? std::nullopt : equation.calculate(x[i]);
+      slice.statistics.out_of_domain += !y;
+      if (output_format == StreamFormat::float64)
+      {
+        const double value = y ? *y : marker_value;
+        std::memcpy(out, &value, sizeof(double));
+        out += sizeof(double);
+        continue;
+      }
+      if (y)
+        out = std::to_chars(out, out + detail::max_double_chars, *y).ptr;
+      else
+        out = std::copy(marker.begin(), marker.end(), out);
+      *out++ = '\n';
+    }
+    slice.out.resize(out - slice.out.data());
+  }
+
+  void append (std::vector<char>& out)
+  {
+    for (const Slice& slice : slices)
+    {
+      out.insert(out.end(), slice.out.begin(), slice.out.end());
+      totals.inputs += slice.statistics.inputs;
+      totals.out_of_domain += slice.statistics.out_of_domain;
+    }
+  }
+};
+
+} /* namespace json_equation */
+
+#endif //STREAM_EVALUATION_HPP
@@ -0,0 +1,130 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * Per-thread slots for instrumentation. Each thread writes only its own slot,
+ * so counting adds no contention on shared cache lines; readers visit every
+ * thread's slot when they want a total.
+ */
+
+#ifndef THREAD_SLOTS_HPP
+#define THREAD_SLOTS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace json_equation {
+
+namespace detail {
+
+/**
+ * ThreadSlots owns one Slot per thread that has used it. Slots outlive their
+ * threads, so counts made by finished threads are kept. Copies get slots of
+ * their own, starting from default-constructed Slots.
+ * @tparam Slot Default-constructible per-thread state. Fields read by other
+ * threads must be atomic (or otherwise synchronized by the Slot itself).
+ */
+template<typename Slot>
+class ThreadSlots
+{
+public:
+  ThreadSlots () = default;
+
+  ThreadSlots (const ThreadSlots&) : ThreadSlots() {}
+
+  ThreadSlots& operator= (const ThreadSlots&)
+  {
+    return *this;
+  }
+
+  friend void swap (ThreadSlots& first, ThreadSlots& second)
+  {
+    std::swap(first.state, second.state);
+  }
+
+  /**
+   * The calling thread's slot. A small direct-mapped cache per thread, keyed
+   * by the never-reused id of the slots, avoids taking the lock on every call.
+   */
+  Slot& local () const
+  {
+    return local([] { return std::make_unique<Slot>(); });
+  }
+
+  /**
+   * The calling thread's slot, created by make() on the thread's first call.
+   * @param make Returns a std::unique_ptr<Slot>, for Slots that need
+   * constructor arguments
+   */
+  template<typename Make>
+  Slot& local (Make make) const
+  {
+    struct CacheEntry
+    {
+      uint64_t id = 0;
+      Slot* slot = nullptr;
+    };
+    thread_local CacheEntry cache[8];
+
+    CacheEntry& entry = cache[state->id % 8];
+    if (entry.id != state->id)
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      auto& owned = state->slots[std::this_thread::get_id()];
+      if (!owned)
+        owned = make();
+      entry = {state->id, owned.get()};
+    }
+    return *entry.slot;
+  }
+
+  /**
+   * Call visit(slot) for every thread's slot. Slots may be added meanwhile
+   * by threads using them for the first time; those are waited for.
+   */
+  template<typename Visitor>
+  void for_each (Visitor visit) const
+  {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    for (const auto& entry : state->slots)
+      visit(*entry.second);
+  }
+
+private:
+  struct State
+  {
+    uint64_t id = next_id();
+    std::mutex mutex;
+    std::unordered_map<std::thread::id, std::unique_ptr<Slot> > slots;
+  };
+
+  std::shared_ptr<State> state = std::make_shared<State>();
+
+  static uint64_t next_id ()
+  {
+    static std::atomic<uint64_t> id{1};
+    return id.fetch_add(1, std::memory_order_relaxed);
+  }
+};
+
+/**
+ * Add one to a counter that only the calling thread writes. A plain load and
+ * store suffices, and is cheaper than a locked read-modify-write; the atomic
+ * only makes concurrent reads well-defined.
+ */
+inline void increment (std::atomic<uint64_t>& count, const uint64_t amount = 1)
+{
+  count.store(count.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+} /* namespace detail */
+
+} /* namespace json_equation */
+
+#endif //THREAD_SLOTS_HPP
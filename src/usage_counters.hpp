@@ -0,0 +1,202 @@
+/*
+ * json_equation
+ *
+ * Copyright (c) 2020 Amal Bansode <https://www.amalbansode.com>.
+ * Provided under the MIT License
+ *
+ * Optional instrumentation of JSONEquation lookups: hits per piece, and
+ * misses by whether the input fell below the domain, in a gap between pieces
+ * or above the domain. Counting is compiled in only when
+ * JSON_EQUATION_USAGE_COUNTERS is defined, consistently for every translation
+ * unit of a program since it changes the layout of JSONEquation and
+ * PolynomialEquation. Each thread counts into its own slots, which are only
+ * summed when a report is taken.
+ */
+
+#ifndef USAGE_COUNTERS_HPP
+#define USAGE_COUNTERS_HPP
+
+#include <cstdint>
+#include <vector>
+
+#ifdef JSON_EQUATION_USAGE_COUNTERS
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "thread_slots.hpp"
+#endif
+
+namespace json_equation {
+
+/**
+ * Lookup counts of one equation, summed over all threads.
+ */
+struct UsageReport
+{
+  /*
+   * Hits per piece, in ascending order of bounds
+   */
+  std::vector<uint64_t> piece_hits;
+  uint64_t below_domain = 0;
+  uint64_t in_gap = 0;
+  uint64_t above_domain = 0;
+
+  uint64_t hits () const
+  {
+    uint64_t total = 0;
+    for (const uint64_t count : piece_hits)
+      total += count;
+    return total;
+  }
+
+  uint64_t misses () const
+  {
+    return below_domain + in_gap + above_domain;
+  }
+};
+
+/**
+ * Where an input that is not in any piece fell.
+ */
+enum class Miss : uint8_t
+{
+  below_domain,
+  in_gap,
+  above_domain
+};
+
+#ifdef JSON_EQUATION_USAGE_COUNTERS
+
+namespace detail {
+
+/**
+ * Per-thread lookup counters of one equation. The equation's pieces are
+ * numbered once, by number(), and each thread counts hits in a flat array
+ * indexed by those numbers, so a hit costs no search. Copies start from zero.
+ */
+class UsageCounters
+{
+public:
+  /*
+   * Number of a piece added since the pieces were last numbered, which is
+   * not counted
+   */
+  static constexpr uint32_t unnumbered = static_cast<uint32_t>(-1);
+
+  friend void swap (UsageCounters& first, UsageCounters& second)
+  {
+    swap(first.slots, second.slots);
+    std::swap(first.numbered, second.numbered);
+  }
+
+  /**
+   * Number the pieces in ascending order of bounds, and zero every thread's
+   * counts. Must not run alongside lookups.
+   * @param pieces The equation's piece map
+   */
+  template<typename PieceMap>
+  void number (PieceMap& pieces)
+  {
+    uint32_t idx = 0;
+    for (auto& piece : pieces)
+      piece.second.usage_index = idx++;
+    numbered = idx;
+
+    slots.for_each([] (Slot& counters)
+    {
+      std::lock_guard<std::mutex> lock(counters.mutex);
+      for (size_t i = 0; i < counters.size; ++i)
+        counters.hits[i].store(0, std::memory_order_relaxed);
+      for (auto& count : counters.misses)
+        count.store(0, std::memory_order_relaxed);
+    });
+  }
+
+  /**
+   * @param piece Polynomial of the piece that was hit
+   */
+  template<typename Polynomial>
+  void hit (const Polynomial& piece) const
+  {
+    Slot& counters = slots.local();
+    const uint32_t idx = piece.usage_index;
+    if (idx >= counters.size)
+    {
+      if (idx >= numbered)
+        return;
+      grow(counters);
+    }
+    increment(counters.hits[idx]);
+  }
+
+  void miss (const Miss kind) const
+  {
+    increment(slots.local().misses[static_cast<size_t>(kind)]);
+  }
+
+  /**
+   * Sum every thread's counts.
+   * @param pieces The equation's piece map
+   */
+  template<typename PieceMap>
+  UsageReport report (const PieceMap& pieces) const
+  {
+    UsageReport usage;
+    usage.piece_hits.assign(pieces.size(), 0);
+    slots.for_each([&] (Slot& counters)
+    {
+      std::lock_guard<std::mutex> lock(counters.mutex);
+      size_t idx = 0;
+      for (const auto& piece : pieces)
+      {
+        if (piece.second.usage_index < counters.size)
+          usage.piece_hits[idx] += counters.hits[piece.second.usage_index].load(std::memory_order_relaxed);
+        ++idx;
+      }
+      usage.below_domain += counters.misses[0].load(std::memory_order_relaxed);
+      usage.in_gap += counters.misses[1].load(std::memory_order_relaxed);
+      usage.above_domain += counters.misses[2].load(std::memory_order_relaxed);
+    });
+    return usage;
+  }
+
+private:
+  /**
+   * One thread's counts, written only by that thread
+   */
+  struct Slot
+  {
+    std::unique_ptr<std::atomic<uint64_t>[]> hits;
+    size_t size = 0;
+    std::atomic<uint64_t> misses[3] = {};
+    std::mutex mutex;
+  };
+
+  ThreadSlots<Slot> slots;
+  uint32_t numbered = 0;
+
+  /**
+   * Make room in the calling thread's slot for every numbered piece. Only
+   * replacing the array needs the lock; the owning thread's own hits run
+   * alongside report(), which only reads.
+   */
+  void grow (Slot& counters) const
+  {
+    std::unique_ptr<std::atomic<uint64_t>[]> grown(new std::atomic<uint64_t>[numbered]);
+    for (size_t i = 0; i < numbered; ++i)
+      grown[i].store(i < counters.size ? counters.hits[i].load(std::memory_order_relaxed) : 0,
+                     std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(counters.mutex);
+    counters.hits = std::move(grown);
+    counters.size = numbered;
+  }
+};
+
+} /* namespace detail */
+
+#endif
+
+} /* namespace json_equation */
+
+#endif //USAGE_COUNTERS_HPP
@@ -0,0 +1,158 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+
+#include "catch.hpp"
+#include "../src/json_equation.hpp"
+
+/*
+ * Replaces every global allocation and deallocation function to count heap
+ * allocations for LoadReport::allocation_counter. This changes allocation for
+ * the whole executable, so it is kept apart from the other tests.
+ */
+
+using namespace json_equation;
+using namespace std;
+
+static std::atomic<uint64_t> allocation_count{0};
+
+static void* counted_allocate (const std::size_t size, const std::size_t alignment)
+{
+  ++allocation_count;
+  /*
+   * aligned_alloc needs a size that is a multiple of the alignment
+   */
+  const std::size_t rounded = (std::max<std::size_t>(size, 1) + alignment - 1) / alignment * alignment;
+  return alignment <= alignof(std::max_align_t) ? std::malloc(rounded) : std::aligned_alloc(alignment, rounded);
+}
+
+static void* checked_allocate (const std::size_t size, const std::size_t alignment)
+{
+  if (void* p = counted_allocate(size, alignment))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new (std::size_t size)
+{
+  return checked_allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new[] (std::size_t size)
+{
+  return checked_allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new (std::size_t size, std::align_val_t alignment)
+{
+  return checked_allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[] (std::size_t size, std::align_val_t alignment)
+{
+  return checked_allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept
+{
+  return counted_allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept
+{
+  return counted_allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new (std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+  return counted_allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[] (std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+  return counted_allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete (void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[] (void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete (void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[] (void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete (void* p, std::align_val_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[] (void* p, std::align_val_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete (void* p, std::size_t, std::align_val_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[] (void* p, std::size_t, std::align_val_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete (void* p, const std::nothrow_t&) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[] (void* p, const std::nothrow_t&) noexcept
+{
+  std::free(p);
+}
+
+void operator delete (void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[] (void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+  std::free(p);
+}
+
+TEST_CASE("LoadReport Counts Allocations per Phase", "[load_report]") {
+  LoadReport report;
+  report.allocation_counter = [] () -> uint64_t { return allocation_count.load(); };
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile, report);
+
+  REQUIRE(equation.pieces.size() == 4);
+  REQUIRE(report[LoadPhase::tokenize].allocations > 0);
+  REQUIRE(report[LoadPhase::error_context].allocations > 0);
+  REQUIRE(report[LoadPhase::map_insertion].allocations >= 4);
+  REQUIRE(report.allocations() > report[LoadPhase::tokenize].allocations);
+
+  // Without a counter nothing is counted
+  LoadReport uncounted;
+  ifstream plain_file("../test/multiple_pieces.json");
+  JSONEquation plain(plain_file, uncounted);
+  REQUIRE(uncounted.allocations() == 0);
+}
@@ -0,0 +1,33 @@
+#include <fstream>
+#include <optional>
+#include <vector>
+
+#include "catch.hpp"
+#include "../src/json_equation_core.hpp"
+
+/*
+ * This translation unit evaluates equations without including the JSON
+ * loader; construction from JSON comes from the json_equation_loader library.
+ */
+#ifdef INCLUDE_NLOHMANN_JSON_HPP_
+#error "json_equation_core.hpp must not include json.hpp"
+#endif
+
+using namespace json_equation;
+using namespace std;
+
+TEST_CASE("Core Header Evaluates Without the JSON Loader", "[json_equation_core]") {
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile);
+  REQUIRE(equation.pieces.size() == 4);
+
+  const vector<double> xs{-1.0, 0.5, 1.0, 2.5, 4.0, 5.0, 0.25};
+  const vector<optional<double> > results = equation.calculate(xs);
+  REQUIRE(results.size() == xs.size());
+  for (size_t i = 0; i < xs.size(); ++i)
+    REQUIRE(results[i] == equation.calculate(xs[i]));
+
+  ifstream float_file("../test/multiple_pieces.json");
+  BasicJSONEquation<float> single(float_file);
+  REQUIRE(single.calculate(0.5f).value() == Approx(7.0f));
+}
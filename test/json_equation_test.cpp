@@ -3,11 +3,109 @@
 #include "catch.hpp"
 #include "../include/json.hpp"
 #include "../src/json_equation.hpp"
+#include "../src/equation_cache.hpp"
+#include "../src/static_equation.hpp"
+#include "../src/bytecode_equation.hpp"
+#include "../src/kernel_equation.hpp"
+#include "../src/shifted_equation.hpp"
+#include "../src/fixed_point_equation.hpp"
+#include "../src/equation_registry.hpp"
+#include "../src/equation_generator.hpp"
+#include "../src/latency_histogram.hpp"
+#include "../src/accuracy_report.hpp"
+#include "../src/evaluation_planner.hpp"
+#include "../src/stream_evaluation.hpp"
+#include "multiple_pieces_equation.hpp"
+#include "fractional_powers_equation.hpp"
+#include "integer_powers_equation.hpp"
+#include "laurent_powers_equation.hpp"
+
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include <thread>
 
 using namespace std;
 using namespace nlohmann;
 using namespace json_equation;
 
+// Stand-in for LoadReport::allocation_counter that counts its own calls, so
+// every phase change shows up as allocations. Real allocations are counted in
+// json_equation_allocation_test.
+static uint64_t counter_reads = 0;
+
+// Evaluate a piece the way PolynomialEquation did before powers were
+// classified, i.e. with the general std::pow for every term
+static double reference_calculate (const PolynomialEquation& function, const double x)
+{
+  double numerator_val = 0.0;
+  double denominator_val = 0.0;
+  for (const auto& i : function.numerator)
+    numerator_val += i.coefficient * std::pow(x, i.power);
+  for (const auto& i : function.denominator)
+    denominator_val += i.coefficient * std::pow(x, i.power);
+
+  if (numerator_val == 0 && denominator_val == 0)
+    return 0;
+  else if (numerator_val != 0 && denominator_val == 0)
+    return std::numeric_limits<double>::infinity();
+  return numerator_val / denominator_val;
+}
+
+// Check an engine built from each fixture against JSONEquation::calculate
+// over a sweep of x, far from the origin and on both sides of every bound.
+// Near bounds the outputs can be arbitrarily ill-conditioned (open-bound
+// poles), so there only the domain, NaN and infinities must agree.
+// check(engine, equation, x, expected, actual) compares finite results.
+template<typename Engine, typename Check>
+static void require_matches_json_equation (const std::vector<std::string>& paths, Check check)
+{
+  for (const std::string& path : paths)
+  {
+    ifstream infile(path);
+    JSONEquation equation(infile);
+    const Engine engine(equation);
+    REQUIRE(engine.size() == equation.pieces.size());
+
+    std::vector<double> xs{1e60, -1e60, 1e100, -1e100, 1e200, -1e200};
+    for (double x = -5.0; x <= 25.0; x += 0.03125)
+      xs.push_back(x);
+    std::vector<double> edges{std::nan(""), -std::nan(""), HUGE_VAL, -HUGE_VAL};
+    for (const auto& piece : equation.pieces)
+    {
+      for (const double bound : {piece.first.lb, piece.first.ub})
+        edges.insert(edges.end(), {std::nextafter(bound, -HUGE_VAL), bound, std::nextafter(bound, HUGE_VAL)});
+    }
+
+    for (const double x : xs)
+    {
+      const auto expected = equation.calculate(x);
+      const auto actual = engine(x);
+      REQUIRE(expected.has_value() == actual.has_value());
+      if (!expected.has_value())
+        continue;
+      if (std::isfinite(expected.value()))
+        check(engine, equation, x, expected.value(), actual.value());
+      else
+        REQUIRE(std::isnan(actual.value()) == std::isnan(expected.value()));
+    }
+    for (const double x : edges)
+    {
+      const auto expected = equation.calculate(x);
+      const auto actual = engine(x);
+      REQUIRE(expected.has_value() == actual.has_value());
+      if (expected.has_value())
+        REQUIRE(std::isnan(actual.value()) == std::isnan(expected.value()));
+    }
+  }
+}
+
+// Fixtures every compiled engine evaluates
+static const std::vector<std::string> engine_fixtures{
+    "../test/single_piece.json", "../test/multiple_pieces.json", "../test/missing_numerator_denominator.json",
+    "../test/fractional_powers.json", "../test/integer_powers.json", "../test/laurent_powers.json",
+    "../test/poles.json", "../test/fixed_point.json"};
+
 TEST_CASE("Single Piece Construction & Computation", "[json_equation]") {
   ifstream infile("../test/single_piece.json");
   JSONEquation equation(infile);
@@ -145,3 +243,1332 @@ TEST_CASE("JSONEquation Swap Operation", "[json_equation]") {
   REQUIRE(postswap_e2x0.value() == 5.0);
 }
 
+
+TEST_CASE("EquationCache Serves Repeated Inputs", "[equation_cache]") {
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile);
+  EquationCache<16> cache(equation);
+
+  auto x0 = cache.calculate(0);
+  REQUIRE(x0.has_value());
+  REQUIRE(x0.value() == 2.0);
+  REQUIRE(cache.stats().hits == 0);
+  REQUIRE(cache.stats().misses == 1);
+
+  auto x0_again = cache(0);
+  REQUIRE(x0_again.has_value());
+  REQUIRE(x0_again.value() == 2.0);
+  REQUIRE(cache.stats().hits == 1);
+
+  // The "no piece" outcome is cached too
+  REQUIRE(!cache.calculate(2.5).has_value());
+  REQUIRE(!cache.calculate(2.5).has_value());
+  REQUIRE(cache.stats().hits == 2);
+  REQUIRE(cache.stats().misses == 2);
+
+  // Keys are exact bit patterns, so -0.0 is distinct from 0.0
+  auto neg_x0 = cache.calculate(-0.0);
+  REQUIRE(neg_x0.has_value());
+  REQUIRE(neg_x0.value() == 2.0);
+  REQUIRE(cache.stats().misses == 3);
+
+  cache.clear();
+  cache.calculate(0);
+  REQUIRE(cache.stats().misses == 4);
+
+  cache.reset_stats();
+  REQUIRE(cache.stats().hits == 0);
+  REQUIRE(cache.stats().misses == 0);
+}
+
+TEST_CASE("EquationCache Matches Uncached Results Under Collisions", "[equation_cache]") {
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile);
+  EquationCache<1> cache(equation);
+
+  for (int round = 0; round < 2; ++round)
+  {
+    for (double x = -1.0; x <= 6.0; x += 0.25)
+    {
+      const auto expected = equation.calculate(x);
+      const auto actual = cache.calculate(x);
+      REQUIRE(expected.has_value() == actual.has_value());
+      if (expected.has_value())
+        REQUIRE(expected.value() == actual.value());
+    }
+  }
+}
+
+TEST_CASE("ThreadLocalEquationCache Aggregates Per-Thread Counters", "[equation_cache]") {
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile);
+  ThreadLocalEquationCache<64> cache(equation);
+
+  // Catch assertions are not thread-safe, so only record results on workers
+  auto worker = [&cache](bool& all_correct) {
+    for (int i = 0; i < 100; ++i)
+    {
+      auto x4 = cache.calculate(4.0);
+      all_correct = all_correct && x4.has_value() && x4.value() == 32.0;
+    }
+  };
+
+  bool t1_correct = true;
+  bool t2_correct = true;
+  std::thread t1(worker, std::ref(t1_correct));
+  std::thread t2(worker, std::ref(t2_correct));
+  t1.join();
+  t2.join();
+  REQUIRE(t1_correct);
+  REQUIRE(t2_correct);
+
+  // Each thread misses once on its own private cache, then hits
+  const auto stats = cache.stats();
+  REQUIRE(stats.misses == 2);
+  REQUIRE(stats.hits == 198);
+
+  // Short-lived instances on one thread each start from an empty cache
+  for (int i = 0; i < 100; ++i)
+  {
+    ThreadLocalEquationCache<64> short_lived(equation);
+    REQUIRE(short_lived.calculate(4.0).value() == 32.0);
+    REQUIRE(short_lived.calculate(4.0).value() == 32.0);
+    REQUIRE(short_lived.stats().misses == 1);
+    REQUIRE(short_lived.stats().hits == 1);
+  }
+}
+
+TEST_CASE("PieceCursor Lookups Match Full Search", "[json_equation]") {
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile);
+
+  auto cursor = equation.locate(0.5);
+  REQUIRE(cursor.found());
+
+  // Sweep forwards then backwards so the hint is exercised in both directions
+  // across gaps, piece boundaries, and the domain's edges
+  std::vector<double> inputs;
+  for (double x = -1.0; x <= 6.0; x += 0.125)
+    inputs.push_back(x);
+  for (double x = 6.0; x >= -1.0; x -= 0.125)
+    inputs.push_back(x);
+  // Jumps further than one neighbour away fall back to a full search
+  inputs.insert(inputs.end(), {0.0, 5.0, 0.25, 4.0, -3.0, 1.5, 7.0, 2.0});
+
+  for (const double x : inputs)
+  {
+    const auto expected = equation.calculate(x);
+    const auto actual = equation.calculate(x, cursor);
+    REQUIRE(expected.has_value() == actual.has_value());
+    REQUIRE(cursor.found() == expected.has_value());
+    if (expected.has_value())
+      REQUIRE(expected.value() == actual.value());
+  }
+}
+
+TEST_CASE("PieceCursor Default and Empty Equation", "[json_equation]") {
+  JSONEquation empty;
+  auto cursor = empty.locate(0);
+  REQUIRE(!cursor.found());
+  REQUIRE(!empty.calculate(0, cursor).has_value());
+
+  ifstream infile("../test/single_piece.json");
+  JSONEquation equation(infile);
+  JSONEquation::PieceCursor fresh;
+  auto x0 = equation.calculate(0, fresh);
+  REQUIRE(x0.has_value());
+  REQUIRE(x0.value() == 5.0);
+  REQUIRE(fresh.found());
+}
+
+TEST_CASE("NaN is in No Piece With or Without a Cursor", "[json_equation]") {
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile);
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+
+  REQUIRE(!equation.calculate(nan).has_value());
+  REQUIRE(!equation.calculate_with_derivative(nan).has_value());
+  REQUIRE(!equation.locate(nan).found());
+
+  // A cursor left in a piece must not capture NaN, and stays a useful hint
+  auto cursor = equation.locate(4.0);
+  REQUIRE(cursor.found());
+  REQUIRE(!equation.calculate(nan, cursor).has_value());
+  REQUIRE(!cursor.found());
+  REQUIRE(equation.calculate(4.0, cursor).value() == 32.0);
+
+  const std::vector<double> xs{4.0, nan, 4.0};
+  const auto results = equation.calculate(xs);
+  REQUIRE(results[0].value() == 32.0);
+  REQUIRE(!results[1].has_value());
+  REQUIRE(results[2].value() == 32.0);
+  REQUIRE(!equation.calculate_with_derivative(xs)[1].has_value());
+}
+
+TEST_CASE("Fractional Powers Match std::pow", "[json_equation]") {
+  ifstream infile("../test/fractional_powers.json");
+  JSONEquation equation(infile);
+
+  for (const auto& piece : equation.pieces)
+  {
+    const auto& range = piece.first;
+    for (int i = 0; i <= 64; ++i)
+    {
+      const double x = range.lb + (range.ub - range.lb) * i / 64.0;
+      if (x <= 0)
+        continue;
+      const double expected = reference_calculate(piece.second, x);
+      REQUIRE(piece.second.calculate(x) == Approx(expected).epsilon(1e-13));
+    }
+  }
+}
+
+TEST_CASE("Fractional Powers Keep std::pow Domain Rules", "[json_equation]") {
+  ifstream infile("../test/fractional_powers.json");
+  JSONEquation equation(infile);
+
+  // x^-0.5 at 0 is infinite
+  auto x0 = equation.calculate(0.0);
+  REQUIRE(x0.has_value());
+  REQUIRE(std::isinf(x0.value()));
+
+  // Real powers of negative inputs are not defined
+  auto xm1 = equation.calculate(-1.0);
+  REQUIRE(xm1.has_value());
+  REQUIRE(std::isnan(xm1.value()));
+}
+
+TEST_CASE("Integer Power Ladder Matches std::pow", "[json_equation]") {
+  ifstream infile("../test/integer_powers.json");
+  JSONEquation equation(infile);
+
+  for (const auto& piece : equation.pieces)
+  {
+    const auto& range = piece.first;
+    for (int i = 0; i <= 64; ++i)
+    {
+      const double x = range.lb + (range.ub - range.lb) * i / 64.0;
+      const double expected = reference_calculate(piece.second, x);
+      REQUIRE(piece.second.calculate(x) == Approx(expected).epsilon(1e-13));
+    }
+  }
+}
+
+TEST_CASE("Negative Integer Powers Keep std::pow Special Values", "[json_equation]") {
+  PolynomialEquation function;
+  function.numerator = {{-1, 1}, {-2, 1}};
+  function.denominator = {{0, 1}};
+  function.prepare();
+
+  const double inf = std::numeric_limits<double>::infinity();
+  for (const double x : {0.0, -0.0, inf, -inf, 1e-300})
+  {
+    const double expected = reference_calculate(function, x);
+    const double actual = function.calculate(x);
+    REQUIRE(std::isnan(expected) == std::isnan(actual));
+    REQUIRE(std::isinf(expected) == std::isinf(actual));
+    if (std::isfinite(expected))
+      REQUIRE(actual == Approx(expected));
+  }
+}
+
+TEST_CASE("Pole-Free Pieces are Identified at Load", "[json_equation]") {
+  ifstream single("../test/multiple_pieces.json");
+  JSONEquation pole_free(single);
+  REQUIRE(pole_free.poles().empty());
+
+  ifstream infile("../test/poles.json");
+  JSONEquation equation(infile);
+  const auto reports = equation.poles();
+  REQUIRE(reports.size() == 3);
+
+  // 1 / (x - 1) over [0, 2] has a root at a sample point
+  REQUIRE(reports[0].bounds.lb == 0.0);
+  REQUIRE(reports[0].status == PoleStatus::has_pole);
+
+  // 1 / (x^2 - 4) over (2, 3] approaches its root at the excluded bound
+  REQUIRE(reports[1].bounds.lb == 2.0);
+  REQUIRE(reports[1].status == PoleStatus::unknown);
+
+  // 1 / (x - 4.4) over [4, 5] changes sign
+  REQUIRE(reports[2].bounds.lb == 4.0);
+  REQUIRE(reports[2].status == PoleStatus::has_pole);
+
+  // A root exactly on an excluded bound is not a pole, on either side of it
+  for (const char* piece : {R"({"lower_bound": 1, "upper_bound": 2, "lb_inclusive": false,
+                                "denominator": {"powers": [0, 1], "coefficients": [1, -1]}})",
+                            R"({"lower_bound": 1, "upper_bound": 2, "lb_inclusive": false,
+                                "denominator": {"powers": [0, 1], "coefficients": [-1, 1]}})",
+                            R"({"lower_bound": 0, "upper_bound": 1, "ub_inclusive": false,
+                                "denominator": {"powers": [0, 1], "coefficients": [-1, 1]}})",
+                            R"({"lower_bound": 0, "upper_bound": 1, "ub_inclusive": false,
+                                "denominator": {"powers": [0, 1], "coefficients": [1, -1]}})"})
+  {
+    nlohmann::json open_bound;
+    open_bound["pieces"] = nlohmann::json::array({nlohmann::json::parse(piece)});
+    const auto open_reports = JSONEquation(open_bound).poles();
+    REQUIRE(open_reports.size() == 1);
+    REQUIRE(open_reports[0].status == PoleStatus::unknown);
+  }
+}
+
+TEST_CASE("Pole Handling is Unchanged Around Poles", "[json_equation]") {
+  ifstream infile("../test/poles.json");
+  JSONEquation equation(infile);
+
+  auto x1 = equation.calculate(1.0);
+  REQUIRE(x1.has_value());
+  REQUIRE(x1.value() == std::numeric_limits<double>::infinity());
+
+  for (const auto& piece : equation.pieces)
+  {
+    const auto& range = piece.first;
+    for (int i = 1; i < 64; ++i)
+    {
+      const double x = range.lb + (range.ub - range.lb) * i / 64.0;
+      const double expected = reference_calculate(piece.second, x);
+      REQUIRE(piece.second.calculate(x) == Approx(expected).epsilon(1e-13));
+    }
+  }
+}
+
+TEST_CASE("Generated Equations are Constant Expressions", "[json_equation_codegen]") {
+  static_assert(json_equation_generated::multiple_pieces(0.0).value() == 2.0);
+  static_assert(json_equation_generated::multiple_pieces(4.0).value() == 32.0);
+  static_assert(json_equation_generated::multiple_pieces(5.0).value() == 42.0);
+  static_assert(!json_equation_generated::multiple_pieces(2.5).has_value());
+  static_assert(!json_equation_generated::multiple_pieces(6.0).has_value());
+}
+
+TEST_CASE("Generated Equations Match JSONEquation", "[json_equation_codegen]") {
+  const std::vector<std::pair<std::string, std::optional<double> (*)(double)> > cases = {
+      {"../test/multiple_pieces.json", json_equation_generated::multiple_pieces},
+      {"../test/fractional_powers.json", json_equation_generated::fractional_powers},
+      {"../test/integer_powers.json", json_equation_generated::integer_powers},
+      {"../test/laurent_powers.json", json_equation_generated::laurent_powers}};
+
+  for (const auto& [path, generated] : cases)
+  {
+    ifstream infile(path);
+    JSONEquation equation(infile);
+    REQUIRE(!generated(std::numeric_limits<double>::quiet_NaN()).has_value());
+
+    // Laurent pieces far from the origin stay finite wherever JSONEquation does
+    std::vector<double> xs{-1e100, -1e60, 1e60, 1e100};
+    for (double x = -5.0; x <= 25.0; x += 0.0625)
+      xs.push_back(x);
+    for (const double x : xs)
+    {
+      const auto expected = equation.calculate(x);
+      const auto actual = generated(x);
+      REQUIRE(expected.has_value() == actual.has_value());
+      if (expected.has_value() && std::isfinite(expected.value()))
+        REQUIRE(actual.value() == Approx(expected.value()).epsilon(1e-12));
+      else if (expected.has_value())
+        REQUIRE(std::isnan(actual.value()) == std::isnan(expected.value()));
+    }
+  }
+}
+
+// Same pieces as multiple_pieces.json
+constexpr StaticEquation<4, 2, 2> static_multiple_pieces({{
+    {{0.0, true, 1.0, false}, {{{0, 2}, {1, 10}}}, {{{0, 1}}}},
+    {{1.0, true, 2.0, true}, {{{0, 20}, {1, -5}}}, {{{0, 1}}}},
+    {{3.0, false, 5.0, false}, {{{0, 32}, {2, 4}}}, {{{0, -1}, {1, 1}}}},
+    {{5.0, true, 5.0, true}, {{{0, 42}}}, {{{0, 1}}}}}});
+
+TEST_CASE("StaticEquation is Usable in Constant Expressions", "[static_equation]") {
+  static_assert(static_multiple_pieces.calculate(0.0).value() == 2.0);
+  static_assert(static_multiple_pieces(2.0).value() == 10.0);
+  static_assert(!static_multiple_pieces(2.5).has_value());
+  static_assert(static_multiple_pieces(4.0).value() == 32.0);
+  static_assert(static_multiple_pieces(5.0).value() == 42.0);
+  static_assert(!static_multiple_pieces(3.0).has_value());
+  static_assert(!static_multiple_pieces(std::numeric_limits<double>::quiet_NaN()).has_value());
+}
+
+TEST_CASE("StaticEquation Matches JSONEquation Exactly", "[static_equation]") {
+  ifstream multiple("../test/multiple_pieces.json");
+  JSONEquation multiple_equation(multiple);
+
+  ifstream fractional("../test/fractional_powers.json");
+  JSONEquation fractional_equation(fractional);
+  const StaticEquation<3, 3, 2> static_fractional({{
+      {{-4.0, true, 4.0, true}, {{{0.5, 2}, {1.5, 1}, {-0.5, 3}}}, {{{0, 1}}}},
+      {{4.0, false, 8.0, true},
+       {{{0.3333333333333333, 1}, {1.3333333333333333, 2}, {-0.6666666666666666, -1}}},
+       {{{0, 1}, {0.5, 1}}}},
+      {{8.0, false, 16.0, true}, {{{0.7, 1}, {2.3, 0.5}}}, {{{1.1, 2}}}}}});
+
+  for (double x = -5.0; x <= 17.0; x += 0.03125)
+  {
+    const auto expected = multiple_equation.calculate(x);
+    const auto actual = static_multiple_pieces.calculate(x);
+    REQUIRE(expected.has_value() == actual.has_value());
+    if (expected.has_value())
+      REQUIRE(expected.value() == actual.value());
+
+    const auto expected_fractional = fractional_equation.calculate(x);
+    const auto actual_fractional = static_fractional.calculate(x);
+    REQUIRE(expected_fractional.has_value() == actual_fractional.has_value());
+    if (expected_fractional.has_value() && !std::isnan(expected_fractional.value()))
+      REQUIRE(expected_fractional.value() == actual_fractional.value());
+    else if (expected_fractional.has_value())
+      REQUIRE(std::isnan(actual_fractional.value()));
+  }
+
+  // NaN is in no piece, as in JSONEquation
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  REQUIRE(multiple_equation.calculate(nan) == static_multiple_pieces.calculate(nan));
+  REQUIRE_FALSE(static_fractional.calculate(nan).has_value());
+}
+
+TEST_CASE("StaticEquation Rejects Overlapping Pieces", "[static_equation]") {
+  using Equation = StaticEquation<2, 1>;
+  REQUIRE_THROWS_AS(Equation({{{{0.0, true, 1.0, true}, {{{0, 1}}}, {{{0, 1}}}},
+                               {{1.0, true, 2.0, true}, {{{0, 1}}}, {{{0, 1}}}}}}),
+                    std::runtime_error);
+  REQUIRE_NOTHROW(Equation({{{{0.0, true, 1.0, false}, {{{0, 1}}}, {{{0, 1}}}},
+                             {{1.0, true, 2.0, true}, {{{0, 1}}}, {{{0, 1}}}}}}));
+}
+
+TEST_CASE("BytecodeEquation Matches JSONEquation", "[bytecode_equation]") {
+  const auto check = [] (const BytecodeEquation&, const JSONEquation&, double, const double expected,
+                         const double actual)
+  {
+    REQUIRE(actual == Approx(expected).epsilon(1e-12));
+  };
+  require_matches_json_equation<BytecodeEquation>(engine_fixtures, check);
+}
+
+TEST_CASE("BytecodeEquation Lowers Polynomials to Horner Form", "[bytecode_equation]") {
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile);
+  BytecodeEquation bytecode(equation);
+
+  // (32 + 4x^2) / (x - 1) on (3, 5) is pole-free, so it needs no pole checks
+  const std::string listing = bytecode.disassemble();
+  REQUIRE(listing.find("piece 2:\n"
+                       "  load_const 4\n"
+                       "  mul_x\n"
+                       "  horner 32\n"
+                       "  accumulate\n"
+                       "  end_numerator\n"
+                       "  load_const 1\n"
+                       "  horner -1\n"
+                       "  accumulate\n"
+                       "  divide\n") != std::string::npos);
+
+  ifstream fractional("../test/fractional_powers.json");
+  JSONEquation fractional_equation(fractional);
+  BytecodeEquation fractional_bytecode(fractional_equation);
+  // sqrt(x) appears in the piece on (4, 8], which is positive
+  REQUIRE(fractional_bytecode.disassemble().find("mul_sqrt") != std::string::npos);
+}
+
+TEST_CASE("float and long double Equations Agree with double", "[json_equation]") {
+  for (const std::string path : {"../test/multiple_pieces.json", "../test/fractional_powers.json",
+                                 "../test/integer_powers.json", "../test/poles.json"})
+  {
+    ifstream double_file(path);
+    JSONEquation reference(double_file);
+    ifstream float_file(path);
+    BasicJSONEquation<float> single(float_file);
+    ifstream long_double_file(path);
+    BasicJSONEquation<long double> extended(long_double_file);
+
+    REQUIRE(single.poles().size() == reference.poles().size());
+    REQUIRE(extended.poles().size() == reference.poles().size());
+
+    for (double x = -5.0; x <= 25.0; x += 0.0625)
+    {
+      const auto expected = reference.calculate(x);
+      const auto actual_single = single.calculate(static_cast<float>(x));
+      const auto actual_extended = extended.calculate(static_cast<long double>(x));
+      REQUIRE(expected.has_value() == actual_single.has_value());
+      REQUIRE(expected.has_value() == actual_extended.has_value());
+      if (!expected.has_value() || !std::isfinite(expected.value()))
+        continue;
+
+      // x^40 overflows float in the last piece of integer_powers.json
+      if (std::isfinite(actual_single.value()) || x <= 10.0)
+        REQUIRE(actual_single.value() == Approx(expected.value()).epsilon(1e-5).margin(1e-5));
+      REQUIRE(static_cast<double>(actual_extended.value())
+              == Approx(expected.value()).epsilon(1e-13));
+    }
+  }
+}
+
+TEST_CASE("FixedPointEquation Matches JSONEquation", "[fixed_point_equation]") {
+  ifstream infile("../test/fixed_point.json");
+  JSONEquation equation(infile);
+  FixedPointEquation fixed(equation);
+
+  for (double x = -5.0; x <= 11.0; x += 0.0078125)
+  {
+    const int64_t fixed_x = fixed.input_to_fixed(x);
+    const double real_x = std::ldexp(static_cast<double>(fixed_x), -fixed.input_fraction_bits());
+    const auto expected = equation.calculate(real_x);
+    const auto actual = fixed(fixed_x);
+    REQUIRE(expected.has_value() == actual.has_value());
+    if (expected.has_value())
+      REQUIRE(fixed.output_to_double(actual.value()) == Approx(expected.value()).margin(1e-5));
+  }
+
+  // Results are integers, so they are reproducible bit for bit
+  REQUIRE(fixed(fixed.input_to_fixed(10.0)).value()
+          == std::llround(std::ldexp(7.0, fixed.output_fraction_bits())));
+  REQUIRE_FALSE(fixed(fixed.input_to_fixed(9.0)).has_value());
+
+  const FixedPointReport report = fixed.quantization_report(equation);
+  REQUIRE(report.pieces.size() == equation.pieces.size());
+  REQUIRE(report.max_abs_error < 1e-5);
+  for (const auto& piece : report.pieces)
+    REQUIRE(piece.max_abs_error <= report.max_abs_error);
+}
+
+TEST_CASE("FixedPointEquation Rejects Non-Polynomial Pieces", "[fixed_point_equation]") {
+  // (32 + 4x^2) / (x - 1) has a non-constant denominator
+  ifstream rational("../test/multiple_pieces.json");
+  JSONEquation rational_equation(rational);
+  REQUIRE_THROWS_AS(FixedPointEquation(rational_equation), std::runtime_error);
+
+  ifstream fractional("../test/fractional_powers.json");
+  JSONEquation fractional_equation(fractional);
+  REQUIRE_THROWS_AS(FixedPointEquation(fractional_equation), std::runtime_error);
+}
+
+TEST_CASE("EquationRegistry Interns Identical Polynomials", "[equation_registry]") {
+  EquationRegistry registry;
+  std::deque<JSONEquation> equations;
+  for (const std::string path : {"../test/multiple_pieces.json", "../test/integer_powers.json",
+                                 "../test/multiple_pieces.json", "../test/multiple_pieces.json"})
+  {
+    ifstream infile(path);
+    equations.emplace_back(infile);
+    REQUIRE(registry.add(equations.back()) == equations.size() - 1);
+  }
+
+  // The three copies of multiple_pieces.json share their 4 polynomials
+  REQUIRE(registry.size() == 4);
+  REQUIRE(registry.piece_count() == 15);
+  REQUIRE(registry.pool().size() == 7);
+  REQUIRE(registry[0].polynomials == registry[2].polynomials);
+
+  for (size_t i = 0; i < equations.size(); ++i)
+  {
+    for (double x = -5.0; x <= 25.0; x += 0.125)
+    {
+      const auto expected = equations[i].calculate(x);
+      const auto actual = registry.calculate(i, x);
+      REQUIRE(expected.has_value() == actual.has_value());
+      if (expected.has_value() && !std::isnan(expected.value()))
+        REQUIRE(actual.value() == expected.value());
+    }
+    // NaN is in no piece, as in JSONEquation
+    REQUIRE_FALSE(registry.calculate(i, std::numeric_limits<double>::quiet_NaN()).has_value());
+  }
+}
+
+TEST_CASE("Polynomial Hash Distinguishes Contents", "[equation_registry]") {
+  PolynomialEquation a;
+  a.numerator = {{0, 1}, {1, 2}};
+  a.prepare();
+  PolynomialEquation b = a;
+  REQUIRE(polynomial_hash(a) == polynomial_hash(b));
+  REQUIRE(same_polynomial(a, b));
+
+  // Same terms in another order round differently, so they are not merged
+  b.numerator = {{1, 2}, {0, 1}};
+  b.prepare();
+  REQUIRE_FALSE(same_polynomial(a, b));
+
+  b.numerator = {{0, 1}, {1, -0.0}};
+  PolynomialEquation c = b;
+  c.numerator[1].coefficient = 0.0;
+  REQUIRE_FALSE(same_polynomial(b, c));
+
+  PolynomialPool pool;
+  REQUIRE(pool.intern(a) == 0);
+  REQUIRE(pool.intern(b) == 1);
+  REQUIRE(pool.intern(c) == 2);
+  REQUIRE(pool.intern(a) == 0);
+  REQUIRE(pool.size() == 3);
+}
+
+TEST_CASE("KernelEquation Matches JSONEquation", "[kernel_equation]") {
+  const auto check = [] (const KernelEquation&, const JSONEquation&, double, const double expected,
+                         const double actual)
+  {
+    REQUIRE(actual == Approx(expected).epsilon(1e-12));
+  };
+  require_matches_json_equation<KernelEquation>(engine_fixtures, check);
+}
+
+TEST_CASE("KernelEquation Classifies Pieces", "[kernel_equation]") {
+  using Kernel = KernelEquation::Kernel;
+
+  ifstream multiple("../test/multiple_pieces.json");
+  JSONEquation multiple_equation(multiple);
+  KernelEquation multiple_kernels(multiple_equation);
+  REQUIRE(multiple_kernels.kernel(0) == Kernel::affine);
+  REQUIRE(multiple_kernels.kernel(1) == Kernel::affine);
+  REQUIRE(multiple_kernels.kernel(2) == Kernel::rational);
+  REQUIRE(multiple_kernels.kernel(3) == Kernel::constant);
+
+  ifstream fixed_point("../test/fixed_point.json");
+  JSONEquation fixed_point_equation(fixed_point);
+  KernelEquation fixed_point_kernels(fixed_point_equation);
+  REQUIRE(fixed_point_kernels.kernel(0) == Kernel::cubic);
+  // (3 + 2x - x^2 + 0.5x^4) / 4 folds its denominator into a dense polynomial
+  REQUIRE(fixed_point_kernels.kernel(1) == Kernel::dense);
+
+  const nlohmann::json quadratic = nlohmann::json::parse(R"({"pieces": [
+      {"lower_bound": -1, "upper_bound": 1,
+       "numerator": {"powers": [2, 0], "coefficients": [3, 1]},
+       "denominator": {"powers": [0], "coefficients": [2]}},
+      {"lower_bound": 2, "upper_bound": 3,
+       "numerator": {"powers": [0.5], "coefficients": [1]}},
+      {"lower_bound": 4, "upper_bound": 5,
+       "numerator": {"powers": [-1], "coefficients": [1]}}]})");
+  JSONEquation quadratic_equation(quadratic);
+  KernelEquation quadratic_kernels(quadratic_equation);
+  REQUIRE(quadratic_kernels.kernel(0) == Kernel::quadratic);
+  REQUIRE(quadratic_kernels(0.5).value() == Approx(0.875));
+  REQUIRE(quadratic_kernels.kernel(1) == Kernel::general);
+  REQUIRE(quadratic_kernels.kernel(2) == Kernel::rational);
+  REQUIRE(quadratic_kernels(4.0).value() == 0.25);
+}
+
+TEST_CASE("Profile-Guided KernelEquation Matches KernelEquation", "[kernel_equation]") {
+  GeneratorOptions options;
+  options.seed = 7;
+  options.pieces = 300;
+  options.gap_fraction = 0.25;
+  options.inclusivity = Inclusivity::random;
+  options.min_degree = 0;
+  options.max_degree = 6;
+  options.powers = PowerTypes::mixed;
+  options.rational_fraction = 0.3;
+  JSONEquation equation(generate_equation(options));
+  KernelEquation kernels(equation);
+  REQUIRE_FALSE(kernels.profiled());
+
+  // A trace concentrated on a few pieces, plus inputs in gaps and outside the domain
+  std::vector<double> trace;
+  std::vector<double> probes{options.domain_start - 1, options.domain_end + 1};
+  size_t idx = 0;
+  for (const auto& piece : equation.pieces)
+  {
+    const double midpoint = piece.first.lb + (piece.first.ub - piece.first.lb) / 2;
+    trace.insert(trace.end(), idx % 37 == 5 ? 1000 : idx % 3 == 0, midpoint);
+    probes.insert(probes.end(), {piece.first.lb, midpoint, piece.first.ub,
+                                 piece.first.ub + (piece.first.ub - piece.first.lb) / 8});
+    ++idx;
+  }
+  const std::vector<uint64_t> hits = kernels.profile(trace);
+  REQUIRE(hits.size() == kernels.size());
+  REQUIRE(hits[5] == 1000);
+  REQUIRE(hits[7] == 0);
+
+  KernelEquation profiled(equation, hits);
+  REQUIRE(profiled.profiled());
+  REQUIRE(profiled.size() == kernels.size());
+  REQUIRE(profiled.profile(trace) == hits);
+  for (size_t piece = 0; piece < kernels.size(); ++piece)
+    REQUIRE(profiled.kernel(piece) == kernels.kernel(piece));
+
+  // Profiles without any hits still find every piece
+  KernelEquation cold(equation, std::vector<uint64_t>(kernels.size(), 0));
+  for (const double x : probes)
+  {
+    const auto expected = kernels(x);
+    for (const KernelEquation* layout : {&profiled, &cold})
+    {
+      const auto actual = (*layout)(x);
+      REQUIRE(expected.has_value() == actual.has_value());
+      if (expected.has_value())
+        REQUIRE((actual.value() == expected.value() || (std::isnan(actual.value()) && std::isnan(expected.value()))));
+    }
+  }
+
+  REQUIRE_THROWS_AS(KernelEquation(equation, std::vector<uint64_t>{1}), std::invalid_argument);
+  REQUIRE_FALSE(KernelEquation(JSONEquation(), std::vector<uint64_t>{}).calculate(1.0).has_value());
+}
+
+TEST_CASE("ShiftedEquation Matches JSONEquation", "[shifted_equation]") {
+  const auto check = [] (const ShiftedEquation& shifted, const JSONEquation& equation, const double x,
+                         const double expected, const double actual)
+  {
+    // Shifted pieces are accurate relative to the piece's largest output
+    const auto piece = equation.pieces.find(numeric_range::NumericRange<double>{x});
+    const auto verified = shifted.verification()[std::distance(equation.pieces.begin(), piece)];
+    REQUIRE(actual == Approx(expected).epsilon(1e-10).margin(2 * verified.allowed_error));
+  };
+  require_matches_json_equation<ShiftedEquation>(engine_fixtures, check);
+}
+
+TEST_CASE("ShiftedEquation Evaluates Distant Pieces in float", "[shifted_equation]") {
+  // (x - 1000005)^2 + 1 on [1000000, 1000010], expanded around the origin
+  const nlohmann::json distant = nlohmann::json::parse(R"({"pieces": [
+      {"lower_bound": 1000000, "upper_bound": 1000010,
+       "numerator": {"powers": [0, 1, 2], "coefficients": [1000010000026, -2000010, 1]}},
+      {"lower_bound": 1000020, "upper_bound": 1000030,
+       "numerator": {"powers": [0.5], "coefficients": [1]}}]})");
+  JSONEquation equation(distant);
+  BasicShiftedEquation<float> shifted(equation);
+
+  REQUIRE(shifted.verification()[0].shifted);
+  // Real powers are not shifted and are evaluated as loaded
+  REQUIRE_FALSE(shifted.verification()[1].shifted);
+  REQUIRE(shifted(1000025.0).value() == Approx(std::sqrt(1000025.0)));
+
+  for (double x = 1000000.0; x <= 1000010.0; x += 0.0625)
+  {
+    const double exact = (x - 1000005) * (x - 1000005) + 1;
+    REQUIRE(static_cast<double>(shifted(x).value()) == Approx(exact).epsilon(1e-5));
+  }
+}
+
+TEST_CASE("ShiftedEquation Keeps Poles at Sample Points", "[shifted_equation]") {
+  // 1 / (x - pole) on [0, 0.7], where pole is the third of 4 sample points.
+  // The original divides by exactly 0 there, while the shifted form rounds
+  // its denominator to a tiny nonzero value.
+  const double pole = 0.7 * 2 / 3;
+  nlohmann::json sampled_pole;
+  sampled_pole["pieces"] = nlohmann::json::array({{{"lower_bound", 0}, {"upper_bound", 0.7},
+      {"denominator", {{"powers", {0, 1}}, {"coefficients", {-pole, 1}}}}}});
+  JSONEquation equation(sampled_pole);
+  const ShiftedEquation shifted(equation, ShiftedEquation::default_tolerance, 4);
+
+  REQUIRE(equation.calculate(pole).value() == HUGE_VAL);
+  REQUIRE_FALSE(shifted.verification()[0].shifted);
+  REQUIRE(shifted(pole) == equation.calculate(pole));
+}
+
+TEST_CASE("Value and Derivative in One Pass", "[json_equation]") {
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile);
+
+  // 2 + 10x on [0, 1)
+  REQUIRE(equation.calculate_with_derivative(0.5).value().value == 7.0);
+  REQUIRE(equation.calculate_with_derivative(0.5).value().derivative == 10.0);
+  // 20 - 5x on [1, 2]: the piece containing the shared bound 1
+  REQUIRE(equation.calculate_with_derivative(1.0).value().derivative == -5.0);
+  // 42 on [5, 5]
+  REQUIRE(equation.calculate_with_derivative(5.0).value().derivative == 0.0);
+  REQUIRE_FALSE(equation.calculate_with_derivative(2.5).has_value());
+
+  // (32 + 4x^2) / (x - 1) on (3, 5), by the quotient rule
+  for (double x = 3.125; x < 5.0; x += 0.125)
+  {
+    const auto result = equation.calculate_with_derivative(x).value();
+    const double expected = (8 * x * (x - 1) - (32 + 4 * x * x)) / ((x - 1) * (x - 1));
+    REQUIRE(result.value == equation.calculate(x).value());
+    REQUIRE(result.derivative == Approx(expected).epsilon(1e-14));
+  }
+}
+
+TEST_CASE("Derivatives Near Zero Survive Underflow", "[json_equation]") {
+  // 1 + 1.1x: x itself is subnormal, so x * slope rounds away
+  PolynomialEquation line;
+  line.numerator = {{0, 1}, {1, 1.1}};
+  line.prepare();
+  REQUIRE(line.calculate_with_derivative(5e-324).value == 1.0);
+  REQUIRE(line.calculate_with_derivative(5e-324).derivative == Approx(1.1));
+  REQUIRE(line.calculate_with_derivative(-5e-324).derivative == Approx(1.1));
+
+  // (2x^2 + 3x) / (1 - x): x^2 underflows long before x does
+  PolynomialEquation rational;
+  rational.numerator = {{2, 2}, {1, 3}};
+  rational.denominator = {{0, 1}, {1, -1}};
+  rational.prepare();
+  for (const double x : {1e-170, 1e-200, 1e-300, 5e-324})
+  {
+    const auto result = rational.calculate_with_derivative(x);
+    REQUIRE(result.value == rational.calculate(x));
+    REQUIRE(result.derivative == Approx(3.0));
+  }
+  REQUIRE(rational.calculate_with_derivative(0.5).derivative == Approx(18.0));
+}
+
+TEST_CASE("Derivatives Match Finite Differences", "[json_equation]") {
+  for (const std::string path : {"../test/fractional_powers.json", "../test/integer_powers.json",
+                                 "../test/poles.json", "../test/fixed_point.json"})
+  {
+    ifstream infile(path);
+    JSONEquation equation(infile);
+
+    std::vector<double> xs;
+    for (double x = -5.0; x <= 20.0; x += 0.015625)
+      xs.push_back(x);
+    const auto batch = equation.calculate_with_derivative(xs);
+    REQUIRE(batch.size() == xs.size());
+
+    const double h = 1e-6;
+    for (size_t i = 0; i < xs.size(); ++i)
+    {
+      const double x = xs[i];
+      const auto single = equation.calculate_with_derivative(x);
+      const auto value = equation.calculate(x);
+      REQUIRE(batch[i].has_value() == value.has_value());
+      REQUIRE(single.has_value() == value.has_value());
+      if (!value.has_value() || !std::isfinite(value.value()))
+        continue;
+
+      REQUIRE(single.value().value == value.value());
+      REQUIRE(batch[i].value().value == value.value());
+      REQUIRE(batch[i].value().derivative == single.value().derivative);
+
+      // Central differences need both neighbours in the same piece
+      const auto below = equation.pieces.find(numeric_range::NumericRange<double>{x - h});
+      const auto above = equation.pieces.find(numeric_range::NumericRange<double>{x + h});
+      if (below == equation.pieces.end() || below != above)
+        continue;
+      const double left = equation.calculate(x - h).value();
+      const double right = equation.calculate(x + h).value();
+      if (!std::isfinite(left) || !std::isfinite(right) || std::fabs(right - left) > 1e3)
+        continue;
+      const double difference = (right - left) / (2 * h);
+      REQUIRE(single.value().derivative
+              == Approx(difference).epsilon(1e-5).margin(1e-6 * (1 + std::fabs(value.value()))));
+    }
+  }
+}
+
+TEST_CASE("Generated Equations Load", "[equation_generator]") {
+  for (const Spacing spacing : {Spacing::uniform, Spacing::geometric, Spacing::random})
+  {
+    for (const Inclusivity inclusivity : {Inclusivity::lower, Inclusivity::upper, Inclusivity::both,
+                                          Inclusivity::alternating, Inclusivity::random})
+    {
+      for (const double gap_fraction : {0.0, 0.25})
+      {
+        GeneratorOptions options;
+        options.seed = 42;
+        options.pieces = 200;
+        options.spacing = spacing;
+        options.inclusivity = inclusivity;
+        options.gap_fraction = gap_fraction;
+        options.min_degree = 0;
+        options.max_degree = 6;
+        options.powers = PowerTypes::mixed;
+        options.rational_fraction = 0.5;
+
+        // Adjacent pieces never overlap, whatever the inclusivity pattern
+        const nlohmann::json generated = generate_equation(options);
+        JSONEquation equation(generated);
+        REQUIRE(equation.pieces.size() == options.pieces);
+        REQUIRE(equation.pieces.begin()->first.lb == options.domain_start);
+
+        for (const auto& piece : equation.pieces)
+        {
+          const double width = piece.first.ub - piece.first.lb;
+          const double midpoint = piece.first.lb + width / 2;
+          REQUIRE(width > 0);
+          // Positive denominators over a positive domain: no poles
+          REQUIRE(std::isfinite(equation.calculate(midpoint).value()));
+          if (gap_fraction > 0)
+            REQUIRE_FALSE(equation.calculate(piece.first.ub + width / 4).has_value());
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("Generated Equations are Deterministic", "[equation_generator]") {
+  GeneratorOptions options;
+  options.pieces = 1000;
+  options.spacing = Spacing::random;
+  options.inclusivity = Inclusivity::random;
+  options.powers = PowerTypes::mixed;
+  options.rational_fraction = 0.25;
+  options.min_degree = 1;
+  options.max_degree = 8;
+
+  const nlohmann::json first = generate_equation(options);
+  REQUIRE(first == generate_equation(options));
+  options.seed = 2;
+  REQUIRE(first != generate_equation(options));
+
+  size_t rational = 0;
+  for (const auto& piece : first["pieces"])
+  {
+    rational += piece.contains("denominator");
+    const size_t terms = piece["numerator"]["powers"].size();
+    REQUIRE(terms >= 2);
+    REQUIRE(terms <= 9);
+  }
+  REQUIRE(rational > 150);
+  REQUIRE(rational < 350);
+
+  // Binary encodings decode to the same equation
+  JSONEquation expected(first);
+  for (const EquationFormat format : {EquationFormat::json, EquationFormat::cbor, EquationFormat::msgpack,
+                                      EquationFormat::ubjson, EquationFormat::bson})
+  {
+    const nlohmann::json decoded = decode_equation(encode_equation(first, format), format);
+    REQUIRE(decoded == first);
+    JSONEquation equation(decoded);
+    for (double x = 1.0; x < 101.0; x += 0.37)
+      REQUIRE(equation.calculate(x) == expected.calculate(x));
+  }
+
+  options.gap_fraction = 1.0;
+  REQUIRE_THROWS(generate_equation(options));
+  options.gap_fraction = 0;
+  options.spacing = Spacing::geometric;
+  options.domain_start = 0;
+  REQUIRE_THROWS(generate_equation(options));
+}
+
+TEST_CASE("Usage Counters are Compiled Out by Default", "[usage_counters]") {
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile);
+  equation.calculate(0.5);
+  equation.calculate(-1.0);
+  const UsageReport usage = equation.usage();
+  REQUIRE(usage.piece_hits.size() == 4);
+
+  // Unless configured with -DJSON_EQUATION_USAGE_COUNTERS=ON
+  if (!JSONEquation::counts_usage)
+  {
+    REQUIRE(usage.piece_hits == vector<uint64_t>(4, 0));
+    REQUIRE(usage.misses() == 0);
+  }
+  else
+  {
+    REQUIRE(usage.piece_hits[0] == 1);
+    REQUIRE(usage.below_domain == 1);
+  }
+}
+
+TEST_CASE("LatencyHistogram Buckets and Percentiles", "[latency_histogram]") {
+  // Every value lies within its bucket, and buckets are at most 1/8 wide
+  for (uint64_t value : {0ull, 1ull, 7ull, 8ull, 15ull, 16ull, 17ull, 1000ull, 123456789ull,
+                         (1ull << 40) + 12345, ~0ull})
+  {
+    const size_t idx = LatencyHistogram::bucket_of(value);
+    REQUIRE(idx < LatencyHistogram::bucket_count);
+    REQUIRE(LatencyHistogram::bucket_lower(idx) <= value);
+    REQUIRE(value <= LatencyHistogram::bucket_upper(idx));
+    REQUIRE(static_cast<double>(LatencyHistogram::bucket_upper(idx) - LatencyHistogram::bucket_lower(idx))
+            <= static_cast<double>(LatencyHistogram::bucket_lower(idx)) / 8);
+  }
+  for (size_t idx = 1; idx < LatencyHistogram::bucket_count; ++idx)
+    REQUIRE(LatencyHistogram::bucket_lower(idx) == LatencyHistogram::bucket_upper(idx - 1) + 1);
+
+  LatencyHistogram histogram;
+  REQUIRE(histogram.percentile(50) == 0);
+  for (uint64_t value = 1; value <= 1000; ++value)
+    histogram.record(value);
+  REQUIRE(histogram.count() == 1000);
+  REQUIRE(histogram.min() == 1);
+  REQUIRE(histogram.max() == 1000);
+  REQUIRE(histogram.mean() == 500.5);
+  REQUIRE(histogram.percentile(0) == 1);
+  REQUIRE(histogram.percentile(100) == 1000);
+  // Percentiles are bucket upper bounds, within 12.5% above the exact value
+  for (const double p : {10.0, 50.0, 90.0, 99.0})
+  {
+    REQUIRE(histogram.percentile(p) >= static_cast<uint64_t>(p * 10));
+    REQUIRE(histogram.percentile(p) <= static_cast<uint64_t>(p * 10 * 1.125) + 1);
+  }
+
+  LatencyHistogram tail;
+  tail.record(1000000, 10);
+  histogram.merge(tail);
+  REQUIRE(histogram.count() == 1010);
+  REQUIRE(histogram.max() == 1000000);
+  REQUIRE(histogram.percentile(99.5) == 1000000);
+
+  std::ostringstream text;
+  histogram.write_text(text);
+  REQUIRE(text.str().rfind("count 1010 min 1 ", 0) == 0);
+  REQUIRE(text.str().find("\n1 1 1 ") != std::string::npos);
+
+  histogram.reset();
+  REQUIRE(histogram.count() == 0);
+  REQUIRE(histogram.min() == 0);
+}
+
+TEST_CASE("TimedEquation Records Sampled Latencies", "[latency_histogram]") {
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile);
+  TimedEquation timed(equation);
+
+  const vector<double> xs{-1.0, 0.5, 1.0, 2.5, 4.0, 5.0, 0.25};
+  for (const double x : xs)
+    REQUIRE(timed(x) == equation.calculate(x));
+  REQUIRE(timed.calculate(xs) == equation.calculate(xs));
+  REQUIRE(timed.latencies().count() == xs.size());
+  REQUIRE(timed.batch_latencies().count() == 1);
+  REQUIRE(timed.latencies().max() > 0);
+  REQUIRE(ticks_per_ns() > 0);
+
+  // One call in four is timed, on each thread, and threads are merged
+  TimedEquation sampled(equation, 4);
+  vector<thread> threads;
+  for (int t = 0; t < 3; ++t)
+  {
+    threads.emplace_back([&] ()
+    {
+      for (int i = 0; i < 100; ++i)
+        sampled.calculate(0.5);
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  REQUIRE(sampled.latencies().count() == 75);
+
+  sampled.reset();
+  REQUIRE(sampled.latencies().count() == 0);
+  REQUIRE(&sampled.equation() == &equation);
+}
+
+TEST_CASE("LoadReport Breaks Loading Down by Phase", "[load_report]") {
+  const auto count_monomials = [] (const JSONEquation& equation)
+  {
+    size_t monomials = 0;
+    for (const auto& piece : equation.pieces)
+      monomials += piece.second.numerator.size() + piece.second.denominator.size();
+    return monomials;
+  };
+
+  ifstream sized("../test/multiple_pieces.json", std::ios::binary | std::ios::ate);
+  const auto file_size = static_cast<uint64_t>(sized.tellg());
+
+  LoadReport report;
+  report.allocation_counter = [] () -> uint64_t { return counter_reads++; };
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile, report);
+  ifstream plain_file("../test/multiple_pieces.json");
+  JSONEquation plain(plain_file);
+
+  REQUIRE(equation.pieces.size() == plain.pieces.size());
+  for (double x = -1.0; x <= 6.0; x += 0.125)
+    REQUIRE(equation.calculate(x) == plain.calculate(x));
+  REQUIRE(report.pieces == 4);
+  REQUIRE(report.monomials == count_monomials(equation));
+  // The parser stops at the closing brace, leaving the trailing newline
+  REQUIRE(report.bytes_read == file_size - 1);
+  REQUIRE(report[LoadPhase::tokenize].time.count() > 0);
+  REQUIRE(report.time() >= report[LoadPhase::tokenize].time);
+  // The counter is read once up front and twice per phase change, each of
+  // which closes a phase with the reads between
+  for (const LoadPhase phase : {LoadPhase::tokenize, LoadPhase::dom_walk, LoadPhase::numeric_conversion,
+                                LoadPhase::error_context, LoadPhase::analysis, LoadPhase::map_insertion})
+    REQUIRE(report[phase].allocations > 0);
+  REQUIRE(report.allocations() == (counter_reads - 1) / 2);
+  REQUIRE(string(load_phase_name(LoadPhase::numeric_conversion)) == "numeric_conversion");
+
+  // Nothing is tokenized or read when loading from nlohmann::json
+  GeneratorOptions options;
+  options.pieces = 1000;
+  options.rational_fraction = 0.5;
+  const nlohmann::json generated = generate_equation(options);
+  LoadReport json_report;
+  JSONEquation generated_equation(generated, json_report);
+  REQUIRE(json_report.pieces == 1000);
+  REQUIRE(json_report.monomials == count_monomials(generated_equation));
+  REQUIRE(json_report.bytes_read == 0);
+  REQUIRE(json_report[LoadPhase::tokenize].time.count() == 0);
+  REQUIRE(json_report.allocations() == 0);
+  for (const LoadPhase phase : {LoadPhase::dom_walk, LoadPhase::numeric_conversion, LoadPhase::error_context,
+                                LoadPhase::analysis, LoadPhase::map_insertion})
+    REQUIRE(json_report[phase].time.count() > 0);
+
+  // Errors are reported as before
+  ifstream missing("../test/missing_ub.json");
+  LoadReport missing_report;
+  REQUIRE_THROWS(JSONEquation(missing, missing_report));
+
+  // Bad bounds are reported ahead of a polynomial with missing arrays
+  const nlohmann::json inverted = nlohmann::json::parse(R"({"pieces": [{"lower_bound": 2, "upper_bound": 1,
+                                                            "numerator": {"coefficients": [1]}}]})");
+  LoadReport inverted_report;
+  REQUIRE_THROWS_WITH(JSONEquation(inverted, inverted_report),
+                      "Error building JSONEquation: LB cannot be greater than UB");
+}
+
+TEST_CASE("Accuracy Report Compares Modes Against long double", "[accuracy_report]") {
+  REQUIRE(json_equation::detail::ulp_at<double>(1.0L) == std::ldexp(1.0L, -52));
+  REQUIRE(json_equation::detail::ulp_at<float>(3.0L) == std::ldexp(1.0L, -22));
+  REQUIRE(json_equation::detail::ulp_at<double>(0.0L) == std::numeric_limits<double>::denorm_min());
+
+  ifstream infile("../test/multiple_pieces.json");
+  nlohmann::json json_in;
+  infile >> json_in;
+  const JSONEquation equation(json_in);
+
+  AccuracyOptions options;
+  options.samples = 2000;
+  options.distribution = SampleDistribution::edges;
+  options.worst_inputs = 3;
+  options.repeats = 1;
+  const std::vector<double> inputs = accuracy_inputs(equation, options);
+  REQUIRE(inputs.size() == options.samples);
+  REQUIRE(accuracy_inputs(equation, options) == inputs);
+
+  const AccuracyReport report = accuracy_report(json_in, inputs, options);
+  REQUIRE(report.size() == 7);
+  for (const auto& mode : report)
+  {
+    if (mode.mode == "fixed_point")
+    {
+      // One piece has a non-constant denominator
+      REQUIRE_FALSE(mode.skipped.empty());
+      continue;
+    }
+    REQUIRE(mode.skipped.empty());
+    REQUIRE(mode.compared + mode.domain_mismatches <= inputs.size());
+    REQUIRE(mode.worst.size() == options.worst_inputs);
+    REQUIRE(mode.worst.front().ulp_error == mode.max_ulp_error);
+    for (size_t i = 1; i < mode.worst.size(); ++i)
+      REQUIRE(mode.worst[i - 1].ulp_error >= mode.worst[i].ulp_error);
+
+    if (mode.mode == "json_equation_float")
+    {
+      // Inputs just below a bound round onto it in float, landing in the next piece or a gap
+      REQUIRE(mode.domain_mismatches > 0);
+    }
+    else
+    {
+      REQUIRE(mode.domain_mismatches == 0);
+      REQUIRE(mode.max_ulp_error < 4);
+    }
+  }
+
+  const nlohmann::json written = accuracy_json(report);
+  REQUIRE(written.size() == report.size());
+  REQUIRE(written[0]["mode"] == "json_equation");
+}
+
+TEST_CASE("Direct Index Lookups Match Binary Search", "[evaluation_planner]") {
+  for (const Spacing spacing : {Spacing::uniform, Spacing::geometric, Spacing::random})
+  {
+    GeneratorOptions options;
+    options.seed = 11;
+    options.pieces = 500;
+    options.spacing = spacing;
+    options.gap_fraction = 0.2;
+    options.inclusivity = Inclusivity::random;
+    JSONEquation equation(generate_equation(options));
+
+    KernelEquation::Layout layout;
+    layout.lookup = KernelEquation::Lookup::direct_index;
+    const KernelEquation searched(equation);
+    const KernelEquation indexed(equation, layout);
+    REQUIRE(indexed.layout().lookup == KernelEquation::Lookup::direct_index);
+    REQUIRE(searched.layout().lookup == KernelEquation::Lookup::binary_search);
+
+    std::vector<double> probes{options.domain_start - 1, options.domain_end + 1};
+    for (const auto& piece : equation.pieces)
+    {
+      for (const double bound : {piece.first.lb, piece.first.ub})
+        probes.insert(probes.end(), {std::nextafter(bound, -HUGE_VAL), bound, std::nextafter(bound, HUGE_VAL)});
+      probes.push_back(piece.first.ub + (piece.first.ub - piece.first.lb) / 8);
+    }
+    for (const double x : probes)
+      REQUIRE(indexed(x) == searched(x));
+  }
+
+  KernelEquation::Layout direct;
+  direct.lookup = KernelEquation::Lookup::direct_index;
+  REQUIRE_THROWS_AS(KernelEquation(JSONEquation(), direct), std::invalid_argument);
+
+  // Each cell starts at the first piece whose upper bound reaches it
+  const KernelEquation::DirectIndex index = KernelEquation::index_cells({0, 1, 2}, {1, 2, 3});
+  REQUIRE(index.cells == std::vector<uint32_t>{0, 0, 1, 3});
+  REQUIRE(index.cell_of(-1) == 0);
+  REQUIRE(index.cell_of(1.5) == 1);
+  REQUIRE(index.cell_of(10) == 2);
+  REQUIRE_THROWS_AS(KernelEquation::index_cells({0}, {HUGE_VAL}), std::invalid_argument);
+}
+
+TEST_CASE("Planner Chooses Lookup and Kernels by Cost", "[evaluation_planner]") {
+  using Kernel = KernelEquation::Kernel;
+
+  // Evenly spaced pieces are indexed directly; a single piece is not worth an index
+  GeneratorOptions options;
+  options.pieces = 1000;
+  JSONEquation even(generate_equation(options));
+  const EvaluationPlan even_plan = plan_equation(even);
+  REQUIRE(even_plan.statistics.pieces == 1000);
+  REQUIRE(even_plan.statistics.width_variation < 1e-6);
+  REQUIRE(even_plan.statistics.kernels[static_cast<size_t>(Kernel::cubic)] == 1000);
+  REQUIRE(even_plan.layout.lookup == KernelEquation::Lookup::direct_index);
+  REQUIRE(even_plan.direct_index_ns < even_plan.binary_search_ns);
+
+  ifstream single_file("../test/single_piece.json");
+  JSONEquation single(single_file);
+  REQUIRE(plan_equation(single).layout.lookup == KernelEquation::Lookup::binary_search);
+
+  // A sparse high power is cheaper through a power ladder than through Horner's rule
+  const nlohmann::json sparse_json = nlohmann::json::parse(R"({"pieces": [
+      {"lower_bound": 0, "upper_bound": 1,
+       "numerator": {"powers": [30, 0], "coefficients": [2, 1]}},
+      {"lower_bound": 1, "upper_bound": 2, "lb_inclusive": false,
+       "numerator": {"powers": [3, 2, 1, 0], "coefficients": [1, 1, 1, 1]}}]})");
+  JSONEquation sparse(sparse_json);
+  const EvaluationPlan sparse_plan = plan_equation(sparse);
+  REQUIRE(sparse_plan.statistics.kernels[static_cast<size_t>(Kernel::dense)] == 1);
+  REQUIRE(sparse_plan.layout.kernels == std::vector<Kernel>{Kernel::general, Kernel::cubic});
+  REQUIRE(sparse_plan.kernel_ns.size() == 2);
+  REQUIRE(sparse_plan.predicted_ns > 0);
+
+  const KernelEquation planned(sparse, sparse_plan.layout);
+  REQUIRE(planned.kernel(0) == Kernel::general);
+  REQUIRE(planned(0.5).value() == Approx(sparse.calculate(0.5).value()));
+  REQUIRE(planned(1.5).value() == Approx(sparse.calculate(1.5).value()));
+
+  // Plans round-trip through JSON, where they can be overridden
+  nlohmann::json recorded = plan_json(sparse_plan);
+  REQUIRE(recorded["kernels"][0] == "general");
+  recorded["kernels"][0] = "dense";
+  recorded["lookup"] = "direct_index";
+  const KernelEquation::Layout overridden = layout_from_json(recorded);
+  REQUIRE(KernelEquation(sparse, overridden).layout().kernels[0] == Kernel::dense);
+  recorded["kernels"][1] = "constant";
+  REQUIRE_THROWS_AS(KernelEquation(sparse, layout_from_json(recorded)), std::invalid_argument);
+  recorded["kernels"][1] = "lookup_table";
+  REQUIRE_THROWS_AS(layout_from_json(recorded), std::invalid_argument);
+}
+
+TEST_CASE("Calibrated Cost Models are Positive", "[evaluation_planner]") {
+  const CostModel model = CostModel::calibrate();
+  for (const double cost : {model.search_step, model.cache_miss, model.index_lookup, model.multiply_add,
+                            model.divide, model.pow})
+  {
+    REQUIRE(std::isfinite(cost));
+    REQUIRE(cost > 0);
+  }
+  REQUIRE(model.cache_miss > model.multiply_add);
+}
+
+TEST_CASE("Stream Evaluation Matches calculate", "[stream_evaluation]") {
+  GeneratorOptions options;
+  options.seed = 5;
+  options.pieces = 200;
+  options.gap_fraction = 0.1;
+  JSONEquation equation(generate_equation(options));
+
+  std::vector<double> xs;
+  std::string text;
+  for (size_t i = 0; i < 5000; ++i)
+  {
+    xs.push_back(options.domain_start - 1 + (options.domain_end - options.domain_start + 2) * i / 4999.0);
+    text += (i % 3 == 0 ? " " : "") + std::to_string(xs.back()) + (i % 7 == 0 ? "\r\n" : "\n");
+  }
+  text.pop_back();
+
+  // Results are the same however batches are split over threads
+  std::vector<char> single;
+  StreamEvaluator<JSONEquation> single_thread(equation, StreamFormat::text, "OUT");
+  single_thread.evaluate_text(text.data(), text.data() + text.size(), single);
+  std::vector<char> split;
+  StreamEvaluator<JSONEquation> three_threads(equation, StreamFormat::text, "OUT", 3);
+  const size_t half = text.find('\n', text.size() / 2) + 1;
+  three_threads.evaluate_text(text.data(), text.data() + half, split);
+  three_threads.evaluate_text(text.data() + half, text.data() + text.size(), split);
+  REQUIRE(split == single);
+  REQUIRE(three_threads.statistics().inputs == xs.size());
+  REQUIRE(three_threads.statistics().out_of_domain > 0);
+
+  // Text round-trips every result exactly, and marks inputs outside the domain
+  std::istringstream lines(std::string(single.begin(), single.end()));
+  std::string line;
+  size_t idx = 0;
+  for (; std::getline(lines, line); ++idx)
+  {
+    const std::optional<double> expected = equation.calculate(std::stod(std::to_string(xs[idx])));
+    if (expected)
+      REQUIRE(std::stod(line) == *expected);
+    else
+      REQUIRE(line == "OUT");
+  }
+  REQUIRE(idx == xs.size());
+
+  // float64 output carries a numeric marker
+  std::vector<char> binary;
+  const KernelEquation reference(equation);
+  StreamEvaluator<KernelEquation> kernels(reference, StreamFormat::float64, "-1e300", 2);
+  kernels.evaluate_float64(xs.data(), xs.size(), binary);
+  REQUIRE(binary.size() == xs.size() * sizeof(double));
+  for (size_t i = 0; i < xs.size(); ++i)
+  {
+    double y = 0;
+    std::memcpy(&y, binary.data() + i * sizeof(double), sizeof(double));
+    REQUIRE(y == reference(xs[i]).value_or(-1e300));
+  }
+
+  // NaN inputs are outside the domain in every engine
+  const std::string nans = "nan\n" + std::to_string(xs[2500]) + "\n-nan\n";
+  std::vector<char> marked;
+  StreamEvaluator<JSONEquation> nan_equation(equation, StreamFormat::text, "OUT");
+  nan_equation.evaluate_text(nans.data(), nans.data() + nans.size(), marked);
+  REQUIRE(std::string(marked.begin(), marked.end()).find("OUT\n") == 0);
+  const bool text_in_domain = equation.calculate(std::stod(std::to_string(xs[2500]))).has_value();
+  REQUIRE(nan_equation.statistics().out_of_domain == (text_in_domain ? 2u : 3u));
+  const double nan_inputs[] = {std::nan(""), xs[2500]};
+  std::vector<char> nan_binary;
+  StreamEvaluator<KernelEquation> nan_kernel(reference, StreamFormat::float64, "-1e300");
+  nan_kernel.evaluate_float64(nan_inputs, 2, nan_binary);
+  double nan_y = 0;
+  std::memcpy(&nan_y, nan_binary.data(), sizeof(double));
+  REQUIRE(nan_y == -1e300);
+  REQUIRE(nan_kernel.statistics().out_of_domain == (reference(xs[2500]).has_value() ? 1u : 2u));
+
+  REQUIRE_THROWS_AS(StreamEvaluator<JSONEquation>(equation, StreamFormat::float64, "nothing"), std::invalid_argument);
+  REQUIRE_THROWS_AS(StreamEvaluator<JSONEquation>(equation, StreamFormat::text, "nan", 0), std::invalid_argument);
+  const std::string invalid = "1\n2\n\n4\n";
+  std::vector<char> unused;
+  REQUIRE_THROWS_WITH(single_thread.evaluate_text(invalid.data(), invalid.data() + invalid.size(), unused),
+                      "Invalid input \"\" on line 5003.");
+  REQUIRE(unused.empty());
+}
+
+TEST_CASE("Memory Usage of Equations and Registries", "[memory_usage]") {
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile);
+  const MemoryUsage usage = equation.memory_usage();
+
+  size_t monomial_bytes = 0;
+  MemoryUsage polynomial_usage;
+  for (const auto& piece : equation.pieces)
+  {
+    monomial_bytes += (piece.second.numerator.capacity() + piece.second.denominator.capacity()) * sizeof(Monomial);
+    polynomial_usage += piece.second.memory_usage();
+  }
+  REQUIRE(usage.polynomials == monomial_bytes);
+  REQUIRE(polynomial_usage.polynomials == monomial_bytes);
+  REQUIRE(usage.index == 4 * (json_equation::detail::map_node_overhead + sizeof(JSONEquation::PieceMap::value_type)
+                              - sizeof(PolynomialEquation)));
+  REQUIRE(usage.metadata == sizeof(JSONEquation) + 4 * sizeof(PolynomialEquation) + polynomial_usage.metadata);
+  // One map node per piece plus its polynomial's vectors
+  REQUIRE(usage.allocations == 4 + polynomial_usage.allocations);
+  REQUIRE(usage.slack > 0);
+  REQUIRE(usage.total() == usage.index + usage.polynomials + usage.metadata + usage.slack);
+  REQUIRE(json_equation::detail::allocation_slack(1) == 31);
+  REQUIRE(json_equation::detail::allocation_slack(24) == 8);
+  REQUIRE(json_equation::detail::allocation_slack(40) == 8);
+
+  // A registry of eight copies stores their polynomials once
+  EquationRegistry registry;
+  for (int i = 0; i < 8; ++i)
+    registry.add(equation);
+  const MemoryUsage registry_usage = registry.memory_usage();
+  REQUIRE(registry_usage.total() < 3 * usage.total());
+  REQUIRE(registry_usage.polynomials == registry.pool().memory_usage().polynomials);
+
+  // Compiled layouts of a larger equation
+  GeneratorOptions options;
+  options.pieces = 1000;
+  const JSONEquation generated(generate_equation(options));
+  const size_t json_bytes = generated.memory_usage().total();
+  REQUIRE(KernelEquation(generated).memory_usage().total() < json_bytes / 2);
+  REQUIRE(BytecodeEquation(generated).memory_usage().total() < json_bytes);
+  REQUIRE(ShiftedEquation(generated).memory_usage().total() < json_bytes);
+  REQUIRE(FixedPointEquation(generated).memory_usage().total() < json_bytes / 2);
+  REQUIRE(BytecodeEquation(generated).memory_usage().index == KernelEquation(generated).memory_usage().index);
+}
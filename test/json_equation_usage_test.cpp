@@ -0,0 +1,102 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+
+#include <fstream>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+#include "../src/json_equation.hpp"
+
+/*
+ * Built with JSON_EQUATION_USAGE_COUNTERS defined for the whole executable.
+ */
+#ifndef JSON_EQUATION_USAGE_COUNTERS
+#error "json_equation_usage_test must be built with JSON_EQUATION_USAGE_COUNTERS"
+#endif
+
+using namespace json_equation;
+using namespace std;
+
+TEST_CASE("Usage Counters Count Hits and Misses", "[usage_counters]") {
+  ifstream infile("../test/multiple_pieces.json");
+  JSONEquation equation(infile);
+  REQUIRE(JSONEquation::counts_usage);
+  REQUIRE(equation.usage().hits() == 0);
+
+  // [0, 1), [1, 2], (3, 5), [5, 5]
+  for (const double x : {0.5, 0.25, 1.0, 4.0, 5.0, -1.0, 2.5, 3.0, 6.0, 7.0})
+    equation.calculate(x);
+  equation(1.5);
+  equation.calculate_with_derivative(0.75);
+  equation.calculate_with_derivative(-2.0);
+
+  // Hinted and batch lookups count too
+  const vector<double> xs{4.5, 4.75, 5.5};
+  equation.calculate(xs);
+  equation.calculate_with_derivative(xs);
+
+  UsageReport usage = equation.usage();
+  REQUIRE(usage.piece_hits == vector<uint64_t>{3, 2, 5, 1});
+  REQUIRE(usage.below_domain == 2);
+  REQUIRE(usage.in_gap == 2);
+  REQUIRE(usage.above_domain == 4);
+  REQUIRE(usage.hits() == 11);
+  REQUIRE(usage.misses() == 8);
+
+  // Copies count from zero
+  JSONEquation copy(equation);
+  REQUIRE(copy.usage().hits() == 0);
+  copy.calculate(0.5);
+  REQUIRE(copy.usage().piece_hits[0] == 1);
+  REQUIRE(equation.usage().piece_hits[0] == 3);
+
+  equation.reset_usage();
+  usage = equation.usage();
+  REQUIRE(usage.hits() == 0);
+  REQUIRE(usage.misses() == 0);
+  REQUIRE(usage.piece_hits.size() == 4);
+
+  // Pieces added later are counted once reset_usage() numbers them
+  equation.pieces.insert({numeric_range::NumericRange<double>{10.0, true, 11.0, true}, PolynomialEquation()});
+  REQUIRE(equation.calculate(10.5).has_value());
+  REQUIRE(equation.usage().piece_hits == vector<uint64_t>{0, 0, 0, 0, 0});
+  equation.reset_usage();
+  equation.calculate(10.5);
+  equation.calculate(0.5);
+  REQUIRE(equation.usage().piece_hits == vector<uint64_t>{1, 0, 0, 0, 1});
+}
+
+TEST_CASE("Usage Counters Sum Over Threads", "[usage_counters]") {
+  ifstream infile("../test/multiple_pieces.json");
+  const JSONEquation equation(infile);
+  ifstream other_file("../test/single_piece.json");
+  const JSONEquation other(other_file);
+
+  const size_t per_thread = 10000;
+  vector<thread> threads;
+  for (int t = 0; t < 4; ++t)
+  {
+    threads.emplace_back([&] ()
+    {
+      for (size_t i = 0; i < per_thread; ++i)
+      {
+        equation.calculate(0.5);
+        equation.calculate(2.5);
+        // Alternating equations share the calling thread's slot cache
+        other.calculate(0.0);
+      }
+    });
+  }
+
+  // Reports may be taken while other threads are counting
+  for (int i = 0; i < 10; ++i)
+    REQUIRE(equation.usage().piece_hits[0] <= 4 * per_thread);
+  for (auto& t : threads)
+    t.join();
+
+  const UsageReport usage = equation.usage();
+  REQUIRE(usage.piece_hits[0] == 4 * per_thread);
+  REQUIRE(usage.in_gap == 4 * per_thread);
+  REQUIRE(other.usage().hits() + other.usage().misses() == 4 * per_thread);
+}